@@ -0,0 +1,885 @@
+/**
+ * Workload driver for the accumulator
+ * Build from the repository root with:
+ *   gcc -std=c11 -O2 -I. bench/mmr_bench.c mmr.c -o mmr_bench -lcrypto -pthread -lm
+ * Every run preloads an accumulator, then issues a read/write mix where a read
+ * is mmr_witness_into() plus mmr_verify() on a leaf picked by the chosen
+ * distribution and a write is mmr_add() of a fresh element. With -t the
+ * readers instead run on 1 to 64 pinned threads beside one writer thread, to
+ * show how reads scale while mmr_add() merges mountains. With -p every run is
+ * followed by the per-operation latency and hardware counter report of
+ * mmr_stats_print(). Run with -h for options
+ */
+#define _GNU_SOURCE
+
+#include "mmr.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ELEMENT_BYTES 12
+
+#define DEFAULT_LEAVES (1u << 16)
+#define DEFAULT_OPS 200000
+
+// Zipfian skew, as in YCSB
+#define ZIPF_THETA 0.99
+
+// Reads picked by the recency distribution cluster at the newest leaves,
+// more tightly the larger this exponent
+#define RECENT_SKEW 4.0
+
+// Reads following each add that go to the newest leaves, and how many of
+// the newest leaves they spread over
+#define BURST_READS 32
+#define BURST_SPREAD 16
+
+/**
+ * Fill element i with distinct data, the same as the test driver uses
+ * @param data Output buffer of ELEMENT_BYTES bytes
+ * @param i Element index
+ */
+static void element_data(uint8_t *data, uint64_t i)
+{
+    memcpy(data, "leaf", 4);
+    memcpy(data + 4, &i, sizeof(i));
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+// ------------------------------- HISTOGRAM ------------------------------------
+
+// Log-linear buckets: exact below 2^HIST_SUB_BITS ns, then 2^HIST_SUB_BITS
+// buckets per power of two, so any percentile is within about 6%
+#define HIST_SUB_BITS 4
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+
+typedef struct
+{
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+} Histogram;
+
+static unsigned hist_bucket(uint64_t ns)
+{
+    if (ns < (1u << HIST_SUB_BITS)) return (unsigned) ns;
+
+    unsigned shift = 63 - (unsigned) __builtin_clzll(ns) - HIST_SUB_BITS;
+
+    return ((shift + 1) << HIST_SUB_BITS) + (unsigned) ((ns >> shift) & ((1u << HIST_SUB_BITS) - 1));
+}
+
+static uint64_t hist_bucket_floor(unsigned bucket)
+{
+    if (bucket < (1u << HIST_SUB_BITS)) return bucket;
+
+    unsigned shift = (bucket >> HIST_SUB_BITS) - 1;
+
+    return (uint64_t) ((bucket & ((1u << HIST_SUB_BITS) - 1)) | (1u << HIST_SUB_BITS)) << shift;
+}
+
+static inline void hist_add(Histogram *h, uint64_t ns)
+{
+    ++h->counts[hist_bucket(ns)];
+    ++h->total;
+}
+
+/**
+ * Estimate a percentile from a histogram
+ * @param h Histogram
+ * @param q Fraction of samples at or below the result, in (0, 1]
+ * @return Lower edge of the bucket holding the percentile, 0 for an empty histogram
+ */
+static uint64_t hist_percentile(const Histogram *h, double q)
+{
+    if (h->total == 0) return 0;
+
+    uint64_t rank = (uint64_t) ceil(q * (double) h->total);
+    if (rank == 0) rank = 1;
+
+    uint64_t seen = 0;
+    for (unsigned b = 0; b < HIST_BUCKETS; ++b)
+    {
+        seen += h->counts[b];
+        if (seen >= rank) return hist_bucket_floor(b);
+    }
+
+    return hist_bucket_floor(HIST_BUCKETS - 1);
+}
+
+// ----------------------------- DISTRIBUTIONS ----------------------------------
+
+typedef enum
+{
+    DIST_UNIFORM,
+    DIST_ZIPF,
+    DIST_RECENT,
+    DIST_BURST,
+    DISTS
+} Dist;
+
+static const char *const dist_names[DISTS] = {"uniform", "zipf", "recent", "burst"};
+
+/**
+ * Picks the leaf each read goes to
+ * The Zipfian ranks cover the preloaded leaves and are scattered over them,
+ * so the hot leaves sit in different mountains rather than one corner
+ */
+typedef struct
+{
+    Dist dist;
+    uint64_t rng;
+
+    uint64_t zipf_n;
+    double zipf_zetan;
+    double zipf_alpha;
+    double zipf_eta;
+
+    unsigned burst;
+} Picker;
+
+static inline uint64_t rng_next(uint64_t *state)
+{
+    // xorshift64*
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+
+    return x * 0x2545F4914F6CDD1Dull;
+}
+
+static inline double rng_unit(uint64_t *state)
+{
+    return (double) (rng_next(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/**
+ * Set up a picker
+ * @param p Picker to initialise
+ * @param dist Distribution to draw from
+ * @param leaves Number of preloaded leaves, over which the Zipfian ranks run
+ * @param seed Non-zero random seed
+ */
+static void picker_init(Picker *p, Dist dist, uint64_t leaves, uint64_t seed)
+{
+    memset(p, 0, sizeof(*p));
+    p->dist = dist;
+    p->rng = seed ? seed : 1;
+
+    if (dist != DIST_ZIPF) return;
+
+    // Gray et al., "Quickly generating billion-record synthetic databases"
+    double zeta2 = 1.0 + pow(0.5, ZIPF_THETA);
+    double zetan = 0.0;
+    for (uint64_t i = 1; i <= leaves; ++i) zetan += 1.0 / pow((double) i, ZIPF_THETA);
+
+    p->zipf_n = leaves;
+    p->zipf_zetan = zetan;
+    p->zipf_alpha = 1.0 / (1.0 - ZIPF_THETA);
+    p->zipf_eta = (1.0 - pow(2.0 / (double) leaves, 1.0 - ZIPF_THETA)) / (1.0 - zeta2 / zetan);
+}
+
+/**
+ * Note an add, which starts a burst of reads for the bursty distribution
+ * @param p Picker
+ */
+static inline void picker_added(Picker *p)
+{
+    p->burst = BURST_READS;
+}
+
+/**
+ * Pick the position of the next leaf to read
+ * @param p Picker
+ * @param leaves Current number of leaves, at least one
+ * @return Leaf position below leaves
+ */
+static uint64_t picker_next(Picker *p, uint64_t leaves)
+{
+    switch (p->dist)
+    {
+    case DIST_ZIPF:
+    {
+        double u = rng_unit(&p->rng);
+        double uz = u * p->zipf_zetan;
+        uint64_t rank;
+
+        if (uz < 1.0)
+        {
+            rank = 0;
+        }
+        else if (uz < 1.0 + pow(0.5, ZIPF_THETA))
+        {
+            rank = 1;
+        }
+        else
+        {
+            rank = (uint64_t) ((double) p->zipf_n * pow(p->zipf_eta * u - p->zipf_eta + 1.0, p->zipf_alpha));
+        }
+
+        return (rank * 0x9E3779B97F4A7C15ull) % p->zipf_n;
+    }
+    case DIST_RECENT:
+    {
+        uint64_t back = (uint64_t) ((double) leaves * pow(rng_unit(&p->rng), RECENT_SKEW));
+        return leaves - 1 - (back < leaves ? back : leaves - 1);
+    }
+    case DIST_BURST:
+        if (p->burst > 0)
+        {
+            --p->burst;
+            uint64_t spread = leaves < BURST_SPREAD ? leaves : BURST_SPREAD;
+            return leaves - 1 - rng_next(&p->rng) % spread;
+        }
+        return rng_next(&p->rng) % leaves;
+    default:
+        return rng_next(&p->rng) % leaves;
+    }
+}
+
+// ------------------------------- WORKLOAD -------------------------------------
+
+typedef struct
+{
+    uint64_t leaves;
+    uint64_t ops;
+    unsigned sparse_height;
+    uint64_t seed;
+    bool perf_counters;
+} BenchOptions;
+
+typedef struct
+{
+    Histogram reads;
+    Histogram adds;
+    uint64_t failed;
+    uint64_t ns;
+    MMRStats stats;
+} RunResult;
+
+/**
+ * Run one read/write mix on a fresh accumulator
+ * Counters are reset after the preload, so the hit rate covers the mix only
+ * @param opt Options
+ * @param dist Distribution reads are drawn from
+ * @param read_pct Percentage of operations that are reads
+ * @param res Output results
+ * @return true on success, false if the accumulator could not be built
+ */
+static bool run_mix(const BenchOptions *opt, Dist dist, unsigned read_pct, RunResult *res)
+{
+    memset(res, 0, sizeof(*res));
+
+    MMRConfig cfg = {.sparse_height = opt->sparse_height, .perf_counters = opt->perf_counters};
+    MMRAccumulator acc;
+    if (!mmr_init_config(&acc, &cfg)) return false;
+
+    uint8_t data[ELEMENT_BYTES];
+    for (uint64_t i = 0; i < opt->leaves; ++i)
+    {
+        element_data(data, i);
+        if (!mmr_add(&acc, data, sizeof(data)))
+        {
+            mmr_destroy(&acc);
+            return false;
+        }
+    }
+
+    Picker picker;
+    picker_init(&picker, dist, opt->leaves, opt->seed);
+
+    uint64_t mix_rng = opt->seed ^ 0x5DEECE66Dull;
+    uint64_t leaves = opt->leaves;
+
+    mmr_stats_reset(&acc);
+    uint64_t began = now_ns();
+
+    for (uint64_t op = 0; op < opt->ops; ++op)
+    {
+        bool read = rng_next(&mix_rng) % 100 < read_pct;
+        uint64_t t0 = now_ns();
+
+        if (read)
+        {
+            element_data(data, picker_next(&picker, leaves));
+
+            MMRWitness w;
+            bytes32 siblings[WITNESS_MAX_SIBLINGS];
+            if (!mmr_witness_into(&acc, &w, siblings, data, sizeof(data)) || !mmr_verify(&acc, &w)) ++res->failed;
+
+            hist_add(&res->reads, now_ns() - t0);
+        }
+        else
+        {
+            element_data(data, leaves);
+            if (mmr_add(&acc, data, sizeof(data)))
+            {
+                ++leaves;
+                picker_added(&picker);
+            }
+            else
+            {
+                ++res->failed;
+            }
+
+            hist_add(&res->adds, now_ns() - t0);
+        }
+    }
+
+    res->ns = now_ns() - began;
+    mmr_stats(&acc, &res->stats);
+    mmr_destroy(&acc);
+
+    return true;
+}
+
+/**
+ * Print the per-operation report of a run, set off from the result lines
+ * @param stats Counters of the run
+ */
+static void print_report(const MMRStats *stats)
+{
+    putchar('\n');
+    mmr_stats_print(stats, stdout);
+    putchar('\n');
+}
+
+static void print_header(void)
+{
+    printf("%-8s %5s %11s %6s %6s %9s %9s %9s %9s\n", "dist", "read%", "ops/s", "hit%", "stale%", "read p50",
+           "read p99", "add p50", "add p99");
+}
+
+static void print_result(Dist dist, unsigned read_pct, const RunResult *res)
+{
+    const MMRStats *s = &res->stats;
+    uint64_t lookups = s->witness_hits + s->witness_misses;
+    uint64_t ops = res->reads.total + res->adds.total;
+
+    double hit = lookups ? 100.0 * (double) s->witness_hits / (double) lookups : 0.0;
+    double stale = lookups ? 100.0 * (double) s->witness_stale / (double) lookups : 0.0;
+    double rate = res->ns ? (double) ops * 1e9 / (double) res->ns : 0.0;
+
+    printf("%-8s %5u %11.0f %6.1f %6.1f %9llu %9llu %9llu %9llu\n", dist_names[dist], read_pct, rate, hit, stale,
+           (unsigned long long) hist_percentile(&res->reads, 0.50),
+           (unsigned long long) hist_percentile(&res->reads, 0.99),
+           (unsigned long long) hist_percentile(&res->adds, 0.50),
+           (unsigned long long) hist_percentile(&res->adds, 0.99));
+
+    if (res->failed) printf("  %llu operations failed\n", (unsigned long long) res->failed);
+}
+
+// --------------------------------- SWEEP --------------------------------------
+
+#define MAX_THREADS 64
+
+// Reads a reader issues between updates of the shared read count
+#define READS_PER_REPORT 64
+
+typedef struct
+{
+    MMRAccumulator *acc;
+    Picker picker;
+    uint64_t reads;
+    unsigned cpu;
+    pthread_barrier_t *start;
+
+    const uint64_t *leaves;
+    uint64_t *reads_done;
+
+    // Proofs whose peak an add merged away between witness and verify
+    // are counted as raced rather than failed
+    Histogram hist;
+    uint64_t failed;
+    uint64_t raced;
+    uint64_t ns;
+} SweepReader;
+
+typedef struct
+{
+    MMRAccumulator *acc;
+    unsigned read_pct;
+    unsigned cpu;
+    pthread_barrier_t *start;
+
+    uint64_t *leaves;
+    const uint64_t *reads_done;
+    const bool *stop;
+
+    Histogram hist;
+    uint64_t failed;
+} SweepWriter;
+
+/**
+ * Pin the calling thread to one CPU, wrapping around the CPUs online
+ * Failures are ignored, leaving the thread unpinned
+ * @param cpu CPU index
+ */
+static void pin_self(unsigned cpu)
+{
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    if (online < 1) return;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu % (unsigned) online, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+/**
+ * Issue a reader's share of the reads, timing each one
+ * A burst of the bursty distribution starts whenever the writer has added
+ */
+static void *sweep_reader(void *arg)
+{
+    SweepReader *r = arg;
+    pin_self(r->cpu);
+    pthread_barrier_wait(r->start);
+
+    uint64_t seen = __atomic_load_n(r->leaves, __ATOMIC_ACQUIRE);
+    uint64_t began = now_ns();
+
+    for (uint64_t i = 0; i < r->reads; ++i)
+    {
+        uint64_t leaves = __atomic_load_n(r->leaves, __ATOMIC_ACQUIRE);
+        if (leaves != seen)
+        {
+            seen = leaves;
+            picker_added(&r->picker);
+        }
+
+        uint8_t data[ELEMENT_BYTES];
+        element_data(data, picker_next(&r->picker, leaves));
+
+        uint64_t t0 = now_ns();
+
+        MMRWitness w;
+        bytes32 siblings[WITNESS_MAX_SIBLINGS];
+        if (!mmr_witness_into(r->acc, &w, siblings, data, sizeof(data)))
+        {
+            ++r->failed;
+        }
+        else if (!mmr_verify(r->acc, &w))
+        {
+            ++r->raced;
+        }
+
+        hist_add(&r->hist, now_ns() - t0);
+
+        if ((i + 1) % READS_PER_REPORT == 0) __atomic_add_fetch(r->reads_done, READS_PER_REPORT, __ATOMIC_RELAXED);
+    }
+
+    __atomic_add_fetch(r->reads_done, r->reads % READS_PER_REPORT, __ATOMIC_RELAXED);
+    r->ns = now_ns() - began;
+
+    return NULL;
+}
+
+/**
+ * Add fresh leaves until the readers finish, keeping adds at the mix's share
+ * of all operations, and publish each new leaf count to the readers
+ */
+static void *sweep_writer(void *arg)
+{
+    SweepWriter *wr = arg;
+    pin_self(wr->cpu);
+    pthread_barrier_wait(wr->start);
+
+    uint64_t leaves = *wr->leaves;
+    uint64_t adds = 0;
+
+    while (!__atomic_load_n(wr->stop, __ATOMIC_ACQUIRE))
+    {
+        uint64_t reads = __atomic_load_n(wr->reads_done, __ATOMIC_RELAXED);
+        if (adds * wr->read_pct >= reads * (100 - wr->read_pct))
+        {
+            sched_yield();
+            continue;
+        }
+
+        uint8_t data[ELEMENT_BYTES];
+        element_data(data, leaves);
+
+        uint64_t t0 = now_ns();
+        bool ok = mmr_add(wr->acc, data, sizeof(data));
+        hist_add(&wr->hist, now_ns() - t0);
+
+        if (!ok)
+        {
+            ++wr->failed;
+            continue;
+        }
+
+        ++adds;
+        __atomic_store_n(wr->leaves, ++leaves, __ATOMIC_RELEASE);
+    }
+
+    return NULL;
+}
+
+typedef struct
+{
+    unsigned threads;
+    uint64_t reads;
+    uint64_t adds;
+    uint64_t failed;
+    uint64_t raced;
+    uint64_t ns;
+
+    // Slowest reader's throughput and worst reader's p99, in reads/s and ns
+    double slowest;
+    uint64_t worst_p99;
+
+    Histogram reads_hist;
+    Histogram adds_hist;
+    MMRStats stats;
+} SweepResult;
+
+/**
+ * Run readers on threads threads against one writer on a fresh concurrent accumulator
+ * The reads are split evenly across the readers, so perfect scaling divides the run time by threads
+ * @param opt Options, opt->ops being the total number of reads
+ * @param model Picker to copy into every reader, reseeded per reader
+ * @param read_pct Percentage of all operations that are reads
+ * @param threads Number of reader threads
+ * @param res Output results
+ * @return true on success, false if the accumulator or the threads could not be set up
+ */
+static bool run_sweep(const BenchOptions *opt, const Picker *model, unsigned read_pct, unsigned threads,
+                      SweepResult *res)
+{
+    memset(res, 0, sizeof(*res));
+    res->threads = threads;
+
+    MMRConfig cfg = {.concurrent = true, .sparse_height = opt->sparse_height, .perf_counters = opt->perf_counters};
+    MMRAccumulator acc;
+    if (!mmr_init_config(&acc, &cfg)) return false;
+
+    uint8_t data[ELEMENT_BYTES];
+    for (uint64_t i = 0; i < opt->leaves; ++i)
+    {
+        element_data(data, i);
+        if (!mmr_add(&acc, data, sizeof(data)))
+        {
+            mmr_destroy(&acc);
+            return false;
+        }
+    }
+
+    SweepReader *readers = calloc(threads, sizeof(SweepReader));
+    pthread_t *tids = calloc(threads, sizeof(pthread_t));
+    if (!readers || !tids)
+    {
+        free(readers);
+        free(tids);
+        mmr_destroy(&acc);
+        return false;
+    }
+
+    uint64_t leaves = opt->leaves;
+    uint64_t reads_done = 0;
+    bool stop = false;
+
+    // Readers, the writer and this thread start timing together
+    pthread_barrier_t start;
+    pthread_barrier_init(&start, NULL, threads + 2);
+
+    SweepWriter writer = {.acc = &acc,
+                          .read_pct = read_pct,
+                          .cpu = threads,
+                          .start = &start,
+                          .leaves = &leaves,
+                          .reads_done = &reads_done,
+                          .stop = &stop};
+
+    mmr_stats_reset(&acc);
+
+    pthread_t writer_tid;
+    if (pthread_create(&writer_tid, NULL, sweep_writer, &writer) != 0) abort();
+
+    for (unsigned t = 0; t < threads; ++t)
+    {
+        SweepReader *r = &readers[t];
+        r->acc = &acc;
+        r->picker = *model;
+        r->picker.rng = opt->seed + t + 1;
+        r->reads = opt->ops / threads + (t < opt->ops % threads);
+        r->cpu = t;
+        r->start = &start;
+        r->leaves = &leaves;
+        r->reads_done = &reads_done;
+
+        if (pthread_create(&tids[t], NULL, sweep_reader, r) != 0) abort();
+    }
+
+    pthread_barrier_wait(&start);
+    uint64_t began = now_ns();
+
+    for (unsigned t = 0; t < threads; ++t) pthread_join(tids[t], NULL);
+
+    res->ns = now_ns() - began;
+    __atomic_store_n(&stop, true, __ATOMIC_RELEASE);
+    pthread_join(writer_tid, NULL);
+    pthread_barrier_destroy(&start);
+
+    res->slowest = -1.0;
+    for (unsigned t = 0; t < threads; ++t)
+    {
+        const SweepReader *r = &readers[t];
+
+        for (unsigned b = 0; b < HIST_BUCKETS; ++b) res->reads_hist.counts[b] += r->hist.counts[b];
+        res->reads_hist.total += r->hist.total;
+        res->reads += r->reads;
+        res->failed += r->failed;
+        res->raced += r->raced;
+
+        double rate = r->ns ? (double) r->reads * 1e9 / (double) r->ns : 0.0;
+        if (res->slowest < 0.0 || rate < res->slowest) res->slowest = rate;
+
+        uint64_t p99 = hist_percentile(&r->hist, 0.99);
+        if (p99 > res->worst_p99) res->worst_p99 = p99;
+    }
+
+    res->adds_hist = writer.hist;
+    res->adds = writer.hist.total - writer.failed;
+    res->failed += writer.failed;
+
+    mmr_stats(&acc, &res->stats);
+    mmr_destroy(&acc);
+    free(readers);
+    free(tids);
+
+    return true;
+}
+
+static void print_sweep_header(void)
+{
+    printf("%-8s %5s %7s %11s %11s %11s %9s %6s %8s %8s %8s %9s %9s %6s\n", "dist", "read%", "threads", "reads/s",
+           "per-thread", "slowest", "adds/s", "hit%", "p50", "p99", "p99.9", "worst p99", "add p99", "eff%");
+}
+
+/**
+ * Print one sweep run
+ * @param dist Distribution the reads were drawn from
+ * @param read_pct Percentage of reads
+ * @param res Results of the run
+ * @param base Throughput of the single reader run of the same mix, in reads/s
+ */
+static void print_sweep(Dist dist, unsigned read_pct, const SweepResult *res, double base)
+{
+    const MMRStats *s = &res->stats;
+    uint64_t lookups = s->witness_hits + s->witness_misses;
+    double seconds = (double) res->ns / 1e9;
+
+    double rate = seconds > 0.0 ? (double) res->reads / seconds : 0.0;
+    double adds = seconds > 0.0 ? (double) res->adds / seconds : 0.0;
+    double hit = lookups ? 100.0 * (double) s->witness_hits / (double) lookups : 0.0;
+    double eff = base > 0.0 ? 100.0 * rate / (base * res->threads) : 0.0;
+
+    printf("%-8s %5u %7u %11.0f %11.0f %11.0f %9.0f %6.1f %8llu %8llu %8llu %9llu %9llu %6.1f\n", dist_names[dist],
+           read_pct, res->threads, rate, rate / res->threads, res->slowest, adds, hit,
+           (unsigned long long) hist_percentile(&res->reads_hist, 0.50),
+           (unsigned long long) hist_percentile(&res->reads_hist, 0.99),
+           (unsigned long long) hist_percentile(&res->reads_hist, 0.999), (unsigned long long) res->worst_p99,
+           (unsigned long long) hist_percentile(&res->adds_hist, 0.99), eff);
+
+    if (res->failed) printf("  %llu operations failed\n", (unsigned long long) res->failed);
+    if (res->raced) printf("  %llu proofs outpaced by a merge\n", (unsigned long long) res->raced);
+}
+
+/**
+ * Sweep the reader count in powers of two up to max_threads for one distribution and mix
+ * @param opt Options
+ * @param dist Distribution reads are drawn from
+ * @param read_pct Percentage of reads
+ * @param max_threads Largest number of readers
+ * @return true if every run completed without failed operations
+ */
+static bool sweep(const BenchOptions *opt, Dist dist, unsigned read_pct, unsigned max_threads)
+{
+    Picker model;
+    picker_init(&model, dist, opt->leaves, opt->seed);
+
+    double base = 0.0;
+    bool ok = true;
+
+    for (unsigned threads = 1;; threads *= 2)
+    {
+        if (threads > max_threads) threads = max_threads;
+
+        SweepResult res;
+        if (!run_sweep(opt, &model, read_pct, threads, &res)) return false;
+
+        if (threads == 1 && res.ns) base = (double) res.reads * 1e9 / (double) res.ns;
+
+        print_sweep(dist, read_pct, &res, base);
+        if (opt->perf_counters) print_report(&res.stats);
+        ok = ok && res.failed == 0;
+
+        if (threads == max_threads) break;
+    }
+
+    return ok;
+}
+
+// --------------------------------- MAIN ---------------------------------------
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-n leaves] [-o ops] [-r read%%] [-d dist] [-s sparse] [-S seed] [-t threads] [-p]\n"
+            "  -n  leaves preloaded before each run (default %u)\n"
+            "  -o  operations per run, or reads per run split across the readers with -t (default %u)\n"
+            "  -r  percentage of reads, repeatable (default 50, 90 and 99)\n"
+            "  -d  uniform, zipf, recent or burst, repeatable (default all)\n"
+            "  -s  sparse height of the accumulator (default 0)\n"
+            "  -S  random seed (default 1)\n"
+            "  -t  sweep 1 to this many pinned reader threads, at most %u, against one writer\n"
+            "      thread; efficiency is throughput over the single reader's times the readers\n"
+            "  -p  sample hardware counters and print the per-operation report after each run;\n"
+            "      events the kernel refuses are shown as -, latency is always kept\n"
+            "Latencies are in nanoseconds\n",
+            prog, DEFAULT_LEAVES, DEFAULT_OPS, MAX_THREADS);
+}
+
+int main(int argc, char **argv)
+{
+    BenchOptions opt = {.leaves = DEFAULT_LEAVES, .ops = DEFAULT_OPS, .seed = 1};
+
+    unsigned mixes[16];
+    size_t n_mixes = 0;
+    bool dists[DISTS] = {false};
+    bool any_dist = false;
+    unsigned max_threads = 0;
+
+    int c;
+    while ((c = getopt(argc, argv, "n:o:r:d:s:S:t:ph")) != -1)
+    {
+        switch (c)
+        {
+        case 'n':
+            opt.leaves = strtoull(optarg, NULL, 0);
+            break;
+        case 'o':
+            opt.ops = strtoull(optarg, NULL, 0);
+            break;
+        case 'r':
+        {
+            unsigned long pct = strtoul(optarg, NULL, 0);
+            if (pct > 100 || n_mixes == sizeof(mixes) / sizeof(mixes[0]))
+            {
+                usage(argv[0]);
+                return 2;
+            }
+            mixes[n_mixes++] = (unsigned) pct;
+            break;
+        }
+        case 'd':
+        {
+            Dist d = 0;
+            while (d < DISTS && strcmp(optarg, dist_names[d]) != 0) ++d;
+            if (d == DISTS)
+            {
+                usage(argv[0]);
+                return 2;
+            }
+            dists[d] = any_dist = true;
+            break;
+        }
+        case 's':
+            opt.sparse_height = (unsigned) strtoul(optarg, NULL, 0);
+            break;
+        case 'S':
+            opt.seed = strtoull(optarg, NULL, 0);
+            break;
+        case 'p':
+            opt.perf_counters = true;
+            break;
+        case 't':
+            max_threads = (unsigned) strtoul(optarg, NULL, 0);
+            if (max_threads == 0 || max_threads > MAX_THREADS)
+            {
+                usage(argv[0]);
+                return 2;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return c == 'h' ? 0 : 2;
+        }
+    }
+
+    if (opt.leaves == 0)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    if (n_mixes == 0)
+    {
+        mixes[n_mixes++] = 50;
+        mixes[n_mixes++] = 90;
+        mixes[n_mixes++] = 99;
+    }
+
+    bool ok = true;
+
+    if (max_threads > 0)
+    {
+        print_sweep_header();
+
+        // Sweeps are long, so they default to the uniform distribution alone
+        for (Dist d = 0; d < DISTS; ++d)
+        {
+            if (any_dist ? !dists[d] : d != DIST_UNIFORM) continue;
+
+            for (size_t m = 0; m < n_mixes; ++m)
+            {
+                if (!sweep(&opt, d, mixes[m], max_threads))
+                {
+                    fprintf(stderr, "sweep of %s at %u%% reads failed\n", dist_names[d], mixes[m]);
+                    ok = false;
+                }
+            }
+        }
+
+        return ok ? 0 : 1;
+    }
+
+    print_header();
+
+    for (Dist d = 0; d < DISTS; ++d)
+    {
+        if (any_dist && !dists[d]) continue;
+
+        for (size_t m = 0; m < n_mixes; ++m)
+        {
+            RunResult res;
+            if (!run_mix(&opt, d, mixes[m], &res))
+            {
+                fprintf(stderr, "could not build an accumulator of %llu leaves\n", (unsigned long long) opt.leaves);
+                return 1;
+            }
+
+            print_result(d, mixes[m], &res);
+            if (opt.perf_counters) print_report(&res.stats);
+            ok = ok && res.failed == 0;
+        }
+    }
+
+    return ok ? 0 : 1;
+}
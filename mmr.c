@@ -1,11 +1,28 @@
+#define _GNU_SOURCE
+
+// The single-block leaf path drives the compression function directly
+#define OPENSSL_SUPPRESS_DEPRECATED
+
 #include "mmr.h"
 #include <endian.h>
+#include <errno.h>
+#include <openssl/evp.h>
 #include <openssl/sha.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 /**
  * MMR sibling position constants for witness path encoding
@@ -14,14 +31,99 @@
 #define MMR_SIBLING_LEFT 0
 #define MMR_SIBLING_RIGHT 1
 
-#define WITNESS_MAX_SIBLINGS 63
+// One lock per possible peak height in concurrent mode
+#define MMR_MAX_HEIGHT 64
+
 #define TRACKER_LOAD_THRESH 0.75
 #define TRACKER_MIN_CAPACITY 16
 
+// Longest element whose padded message fits a single SHA-256 block
+#define SHA256_BLOCK_BYTES 64
+#define SHORT_LEAF_MAX_BYTES (SHA256_BLOCK_BYTES - 1 - 8)
+
+// Leaves hashed per pass of a batch add before they are merged, unless tuned otherwise
+#define ADD_BATCH_CHUNK 256
+
+// Items freed per step by a deferred destroy before yielding the CPU
+#define DESTROY_STEP_ITEMS 4096
+
+/**
+ * Add to an accumulator counter if counters are available
+ * Counters are updated atomically since concurrent readers share them
+ */
+#define MMR_STAT_ADD(acc, field, v)                                                                                    \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        if ((acc)->stats) __atomic_fetch_add(&(acc)->stats->field, (v), __ATOMIC_RELAXED);                             \
+    } while (0)
+
+#define MMR_STAT_INC(acc, field) MMR_STAT_ADD(acc, field, 1)
+
 // ---------------------------- HASHING -------------------------------------
 
+// SHA-256 initial hash state, the starting point of every untagged compression
+static const SHA_LONG sha256_iv[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                       0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+// Second block of a 64-byte message: the 0x80 terminator and a 512-bit length
+static const uint8_t sha256_pad64[SHA256_BLOCK_BYTES] = {[0] = 0x80, [SHA256_BLOCK_BYTES - 2] = 0x02};
+
+/**
+ * Write a SHA-256 chaining state out as a big-endian digest
+ * @param state Final chaining state
+ * @param hash Output buffer to store the digest
+ */
+static inline void sha256_digest(const SHA_LONG state[8], bytes32 *hash)
+{
+    for (size_t i = 0; i < 8; ++i)
+    {
+        uint32_t word = htobe32(state[i]);
+        memcpy(*hash + i * sizeof(word), &word, sizeof(word));
+    }
+}
+
+/**
+ * Finish a SHA-256 hash whose remaining input fits in a single block
+ * Pads the tail in place on the stack and runs exactly one compression,
+ * skipping the context setup, buffering and finalisation of the generic path
+ * @param state Chaining state after all preceding whole blocks
+ * @param prior Number of bytes already absorbed into state (a multiple of 64)
+ * @param msg Remaining message data to hash
+ * @param n Length of the remaining data in bytes (at most SHORT_LEAF_MAX_BYTES)
+ * @param hash Output buffer to store the computed hash
+ */
+static inline void sha256_final_block(const SHA_LONG state[8], uint64_t prior, const uint8_t *msg, size_t n,
+                                      bytes32 *hash)
+{
+    uint8_t block[SHA256_BLOCK_BYTES] = {0};
+
+    memcpy(block, msg, n);
+    block[n] = 0x80;
+
+    uint64_t bits = htobe64((prior + n) * 8);
+    memcpy(block + SHA256_BLOCK_BYTES - sizeof(bits), &bits, sizeof(bits));
+
+    SHA256_CTX ctx;
+    memcpy(ctx.h, state, sizeof(ctx.h));
+    SHA256_Transform(&ctx, block);
+
+    sha256_digest(ctx.h, hash);
+}
+
+/**
+ * Compute SHA-256 hash of a message that fits in a single block
+ * @param msg Input message data to hash
+ * @param n Length of the message in bytes (at most SHORT_LEAF_MAX_BYTES)
+ * @param hash Output buffer to store the computed hash
+ */
+static inline void sha256_short(const uint8_t *msg, size_t n, bytes32 *hash)
+{
+    sha256_final_block(sha256_iv, 0, msg, n, hash);
+}
+
 /**
  * Compute SHA-256 hash of a message
+ * Short messages take the single-block path, anything longer goes to OpenSSL
  * @param msg Input message data to hash
  * @param n Length of the message in bytes
  * @param hash Output buffer to store the computed hash
@@ -31,10 +133,152 @@ static inline bool sha256(const uint8_t *msg, size_t n, bytes32 *hash)
 {
     if (!msg || !hash) return false;
 
+    if (n <= SHORT_LEAF_MAX_BYTES)
+    {
+        sha256_short(msg, n, hash);
+        return true;
+    }
+
     SHA256(msg, n, (unsigned char *) hash);
     return true;
 }
 
+/**
+ * Compute SHA-256 hash of a registered prefix followed by a message
+ * Resumes from the prefix midstate instead of hashing the prefix again, and
+ * when the prefix ends on a block boundary a short message costs one compression
+ * @param prefix Prefix midstate from mmr_prefix_init
+ * @param msg Message data to hash after the prefix
+ * @param n Length of the message in bytes
+ * @param hash Output buffer to store the computed hash
+ */
+static void sha256_prefixed(const MMRPrefix *prefix, const uint8_t *msg, size_t n, bytes32 *hash)
+{
+    if (prefix->ctx.num == 0 && n <= SHORT_LEAF_MAX_BYTES)
+    {
+        sha256_final_block(prefix->ctx.h, prefix->n, msg, n, hash);
+        return;
+    }
+
+    SHA256_CTX ctx = prefix->ctx;
+    SHA256_Update(&ctx, msg, n);
+    SHA256_Final((unsigned char *) hash, &ctx);
+}
+
+// OpenSSL names of the backends hashed through EVP
+static const char *const hash_names[] = {
+    [MMR_HASH_SHA3_256] = "SHA3-256",
+    [MMR_HASH_BLAKE2S_256] = "BLAKE2S-256",
+    [MMR_HASH_SHA512_256] = "SHA512-256",
+};
+
+#define MMR_HASH_BACKENDS (sizeof(hash_names) / sizeof(hash_names[0]))
+
+static EVP_MD *hash_mds[MMR_HASH_BACKENDS];
+static pthread_once_t hash_mds_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Fetch the digests of the EVP backends once per process
+ * Fetching is costly in OpenSSL 3, so it is kept off the per-hash path
+ */
+static void hash_mds_fetch(void)
+{
+    for (size_t b = MMR_HASH_SHA3_256; b < MMR_HASH_BACKENDS; ++b)
+    {
+        hash_mds[b] = EVP_MD_fetch(NULL, hash_names[b], NULL);
+    }
+}
+
+/**
+ * Look up the EVP digest of a backend other than SHA-256
+ * @param backend Backend to look up
+ * @return The digest, or NULL if the backend is unknown or OpenSSL lacks it
+ */
+static const EVP_MD *hash_md(MMRHashBackend backend)
+{
+    if (backend == MMR_HASH_SHA256 || (size_t) backend >= MMR_HASH_BACKENDS) return NULL;
+
+    pthread_once(&hash_mds_once, hash_mds_fetch);
+    return hash_mds[backend];
+}
+
+/**
+ * Check whether a hash backend can be used on this build
+ * @param backend Backend to check
+ * @return true if hashes can be computed under the backend
+ */
+static bool hash_supported(MMRHashBackend backend)
+{
+    return backend == MMR_HASH_SHA256 || hash_md(backend);
+}
+
+/**
+ * Compute the hash of a message under a backend
+ * @param backend Hash backend to use
+ * @param msg Input message data to hash
+ * @param n Length of the message in bytes
+ * @param hash Output buffer to store the computed hash
+ * @return true on success, false if any parameter is NULL or hashing fails
+ */
+static inline bool hash_bytes(MMRHashBackend backend, const uint8_t *msg, size_t n, bytes32 *hash)
+{
+    if (backend == MMR_HASH_SHA256) return sha256(msg, n, hash);
+    if (!msg || !hash) return false;
+
+    const EVP_MD *md = hash_md(backend);
+    return md && EVP_Digest(msg, n, *hash, NULL, md, NULL) == 1;
+}
+
+/**
+ * Check whether a prefix can be hashed under an accumulator's backend
+ * Prefix midstates are SHA-256 states, so other backends take no prefix
+ * @param acc Pointer to accumulator
+ * @param prefix Prefix midstate, or NULL
+ * @return true if the prefix is NULL or the accumulator hashes with SHA-256
+ */
+static inline bool prefix_supported(const MMRAccumulator *acc, const MMRPrefix *prefix)
+{
+    return !prefix || acc->hash_backend == MMR_HASH_SHA256;
+}
+
+/**
+ * Compute the leaf hash of an element, optionally under a prefix
+ * @param backend Hash backend to use
+ * @param prefix Prefix midstate, or NULL for a plain hash of the element
+ * @param msg Element data to hash
+ * @param n Length of the element in bytes
+ * @param hash Output buffer to store the computed hash
+ * @return true on success, false if any parameter is NULL or the backend takes no prefix
+ */
+static inline bool leaf_hash(MMRHashBackend backend, const MMRPrefix *prefix, const uint8_t *msg, size_t n,
+                             bytes32 *hash)
+{
+    if (!prefix) return hash_bytes(backend, msg, n, hash);
+    if (!msg || !hash || backend != MMR_HASH_SHA256) return false;
+
+    sha256_prefixed(prefix, msg, n, hash);
+    return true;
+}
+
+/**
+ * Compute leaf hashes for a batch of elements, optionally under a prefix
+ * Under SHA-256 the elements run back to back through the single-block kernel
+ * so the compression function and its constants stay hot across the whole batch
+ * @param backend Hash backend to use
+ * @param prefix Prefix midstate, or NULL for plain hashes (checked by the caller)
+ * @param elems Elements to hash (all validated by the caller)
+ * @param count Number of elements
+ * @param hashes Output array of count hashes
+ */
+static void leaf_hash_batch(MMRHashBackend backend, const MMRPrefix *prefix, const MMRElement *elems, size_t count,
+                            bytes32 *hashes)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        leaf_hash(backend, prefix, elems[i].data, elems[i].n, &hashes[i]);
+    }
+}
+
 /**
  * Compute Merkle hash by concatenating and hashing two child hashes
  * @param left Hash of the left child node
@@ -50,11 +294,53 @@ static inline bool merkle_hash(const bytes32 *left, const bytes32 *right, bytes3
     memcpy(buff, *left, SHA256_DIGEST_LENGTH);
     memcpy(buff + SHA256_DIGEST_LENGTH, *right, SHA256_DIGEST_LENGTH);
 
-    if (!sha256(buff, SHA256_DIGEST_LENGTH * 2, hash)) return false;
+    // The concatenation is exactly one block, followed by a constant padding block
+    SHA256_CTX ctx;
+    memcpy(ctx.h, sha256_iv, sizeof(ctx.h));
+    SHA256_Transform(&ctx, buff);
+    SHA256_Transform(&ctx, sha256_pad64);
+
+    sha256_digest(ctx.h, hash);
 
     return true;
 }
 
+/**
+ * Compute the parent hash of two child hashes under a backend
+ * @param backend Hash backend to use
+ * @param left Hash of the left child node
+ * @param right Hash of the right child node
+ * @param hash Output buffer to store the computed parent hash
+ * @return true on success, false if any parameter is NULL or hashing fails
+ */
+static inline bool node_hash(MMRHashBackend backend, const bytes32 *left, const bytes32 *right, bytes32 *hash)
+{
+    if (backend == MMR_HASH_SHA256) return merkle_hash(left, right, hash);
+    if (!left || !right || !hash) return false;
+
+    merkle64 buff;
+    memcpy(buff, *left, SHA256_DIGEST_LENGTH);
+    memcpy(buff + SHA256_DIGEST_LENGTH, *right, SHA256_DIGEST_LENGTH);
+
+    return hash_bytes(backend, buff, sizeof(buff), hash);
+}
+
+/**
+ * Hash adjacent pairs of a level of node hashes into the level above
+ * Output may alias input, since each pair is read before its parent is written
+ * @param backend Hash backend to use
+ * @param in Array of 2 * pairs child hashes
+ * @param pairs Number of parent hashes to compute
+ * @param out Output array of pairs parent hashes
+ */
+static void merkle_hash_level(MMRHashBackend backend, const bytes32 *in, size_t pairs, bytes32 *out)
+{
+    for (size_t i = 0; i < pairs; ++i)
+    {
+        node_hash(backend, &in[2 * i], &in[2 * i + 1], &out[i]);
+    }
+}
+
 /**
  * Compare two hash values for equality
  * @param a First hash to compare
@@ -83,6 +369,70 @@ static inline void mmr_tr_init(MMRTracker *tracker)
     tracker->items = calloc(tracker->capacity, sizeof(MMRItem *));
 }
 
+/**
+ * Free a tracker item together with its node and cached witness data
+ * @param item Item to free (must already be unlinked or its bucket discarded)
+ */
+static void mmr_tr_free_item(MMRItem *item)
+{
+    if (item->node)
+    {
+        free(item->node);
+        item->node = NULL;
+    }
+
+    if (item->witness.siblings)
+    {
+        free(item->witness.siblings);
+        item->witness.siblings = NULL;
+    }
+
+    free(item->encoded);
+    item->encoded = NULL;
+
+    // Clear stale witness data
+    memset(item->witness.hash, 0, sizeof(bytes32));
+    item->witness.n_siblings = 0;
+    item->witness.path = 0;
+
+    free(item);
+}
+
+/**
+ * Free tracked items bucket by bucket until a budget is used up
+ * Lets very large trackers be torn down in bounded steps rather than all at once
+ * The hash table array itself is left in place for mmr_tr_destroy()
+ * @param tracker Pointer to tracker whose items are being freed
+ * @param bucket In/out index of the next bucket to free, start at 0
+ * @param budget Maximum number of items to free in this step
+ * @return true once every bucket is empty, false if more work remains
+ */
+static bool mmr_tr_free_step(MMRTracker *tracker, size_t *bucket, size_t budget)
+{
+    if (!tracker || !tracker->items) return true;
+
+    size_t freed = 0;
+    while (*bucket < tracker->capacity)
+    {
+        // Clean up the linked list in this bucket
+        MMRItem **head = &tracker->items[*bucket];
+        while (*head)
+        {
+            if (freed == budget) return false;
+
+            MMRItem *item = *head;
+            *head = item->next;
+
+            mmr_tr_free_item(item);
+            ++freed;
+        }
+
+        ++*bucket;
+    }
+
+    return true;
+}
+
 /**
  * Destroy MMR tracker and free all associated memory
  * Walks through all hash table buckets and cleans up nodes, witnesses, and items
@@ -96,35 +446,8 @@ static inline void mmr_tr_destroy(MMRTracker *tracker)
 
     if (tracker->items)
     {
-        for (size_t i = 0; i < tracker->capacity; ++i)
-        {
-            // Clean up the linked list in this bucket
-            MMRItem *item = tracker->items[i];
-            while (item)
-            {
-                MMRItem *next = item->next;
-
-                if (item->node)
-                {
-                    free(item->node);
-                    item->node = NULL;
-                }
-
-                if (item->witness.siblings)
-                {
-                    free(item->witness.siblings);
-                    item->witness.siblings = NULL;
-                }
-
-                // Clear stale witness data
-                memset(item->witness.hash, 0, sizeof(bytes32));
-                item->witness.n_siblings = 0;
-                item->witness.path = 0;
-
-                free(item);
-                item = next;
-            }
-        }
+        size_t bucket = 0;
+        mmr_tr_free_step(tracker, &bucket, SIZE_MAX);
 
         free(tracker->items);
         tracker->items = NULL;
@@ -157,22 +480,13 @@ static inline size_t mmr_tr_hash(const bytes32 *hash, size_t capacity)
 }
 
 /**
- * Resize the MMR tracker hash table when load factor exceeds threshold
- * Doubles the capacity and rehashes all existing items to new positions
- * @param tracker Pointer to tracker to resize
+ * Move every tracked item into a freshly allocated table of the given size
+ * @param tracker Pointer to tracker to rehash
+ * @param new_capacity Number of buckets in the new table
  * @return true on success, false on memory allocation failure
  */
-static bool mmr_tr_resize(MMRTracker *tracker)
+static bool mmr_tr_rehash(MMRTracker *tracker, size_t new_capacity)
 {
-    if (!tracker || !tracker->items) return false;
-
-    // Check if resizing is actually needed
-    if (tracker->count <= tracker->capacity * TRACKER_LOAD_THRESH)
-    {
-        return true;
-    }
-
-    size_t new_capacity = tracker->capacity * 2;
     MMRItem **temp = calloc(new_capacity, sizeof(MMRItem *));
     if (!temp) return false;
 
@@ -201,6 +515,49 @@ static bool mmr_tr_resize(MMRTracker *tracker)
     return true;
 }
 
+/**
+ * Resize the MMR tracker hash table when load factor exceeds threshold
+ * Doubles the capacity and rehashes all existing items to new positions
+ * @param tracker Pointer to tracker to resize
+ * @return true on success, false on memory allocation failure
+ */
+static bool mmr_tr_resize(MMRTracker *tracker)
+{
+    if (!tracker || !tracker->items) return false;
+
+    // Check if resizing is actually needed
+    if (tracker->count <= tracker->capacity * TRACKER_LOAD_THRESH)
+    {
+        return true;
+    }
+
+    return mmr_tr_rehash(tracker, tracker->capacity * 2);
+}
+
+/**
+ * Grow the tracker up front so that a number of further insertions
+ * can be made without crossing the load threshold
+ * Replaces the repeated doubling a large batch would otherwise trigger
+ * with a single rehash
+ * @param tracker Pointer to tracker to grow
+ * @param extra Number of items about to be inserted
+ * @return true on success, false on memory allocation failure
+ */
+static bool mmr_tr_reserve(MMRTracker *tracker, size_t extra)
+{
+    if (!tracker || !tracker->items) return false;
+
+    size_t capacity = tracker->capacity;
+    while (tracker->count + extra > capacity * TRACKER_LOAD_THRESH)
+    {
+        capacity *= 2;
+    }
+
+    if (capacity == tracker->capacity) return true;
+
+    return mmr_tr_rehash(tracker, capacity);
+}
+
 /**
  * Look up an MMR item by its hash value in the tracker
  * Searches the appropriate hash table bucket for a matching node
@@ -259,6 +616,31 @@ static bool mmr_tr_has_root(const MMRAccumulator *acc, const bytes32 *hash)
     return false;
 }
 
+/**
+ * Find the tracker item holding a specific MMR node pointer
+ * Searches for the exact pointer value, not just hash equality
+ * @param tracker Pointer to tracker to search in
+ * @param node Pointer to the node to search for
+ * @return The item holding node, or NULL if it is not tracked
+ */
+static MMRItem *mmr_tr_item(const MMRTracker *tracker, const MMRNode *node)
+{
+    if (!tracker || !tracker->items) return NULL;
+
+    MMRItem *cur = tracker->items[mmr_tr_hash(&node->hash, tracker->capacity)];
+    while (cur)
+    {
+        if (node == cur->node)
+        {
+            return cur;
+        }
+
+        cur = cur->next;
+    }
+
+    return NULL;
+}
+
 /**
  * Check if the tracker contains a specific MMR node pointer
  * Searches for the exact pointer value, not just hash equality
@@ -268,18 +650,35 @@ static bool mmr_tr_has_root(const MMRAccumulator *acc, const bytes32 *hash)
  */
 static bool mmr_tr_has_ptr(const MMRTracker *tracker, const MMRNode *node)
 {
+    return mmr_tr_item(tracker, node) != NULL;
+}
 
-    if (!tracker || !tracker->items) return false;
+/**
+ * Remove a node from the tracker and free it along with its item
+ * MEMORY OWNERSHIP: The node pointer is invalid after this call
+ * @param tracker Pointer to tracker to remove from
+ * @param node Pointer to the node to remove (must be tracker-owned)
+ * @return true if the node was found and freed, false otherwise
+ */
+static bool mmr_tr_remove(MMRTracker *tracker, MMRNode *node)
+{
+    if (!tracker || !tracker->items || !node) return false;
 
-    MMRItem *cur = tracker->items[mmr_tr_hash(&node->hash, tracker->capacity)];
-    while (cur)
+    MMRItem **cur = &tracker->items[mmr_tr_hash(&node->hash, tracker->capacity)];
+    while (*cur)
     {
-        if (node == cur->node)
+        if ((*cur)->node == node)
         {
+            MMRItem *item = *cur;
+            *cur = item->next;
+
+            mmr_tr_free_item(item);
+            --tracker->count;
+
             return true;
         }
 
-        cur = cur->next;
+        cur = &(*cur)->next;
     }
 
     return false;
@@ -312,6 +711,9 @@ static bool mmr_tr_insert(MMRTracker *tracker, MMRNode *node)
     memset(&item->witness, 0, sizeof(MMRWitness));
     item->witness.siblings = NULL;
 
+    item->encoded = NULL;
+    item->encoded_len = 0;
+
     size_t key = mmr_tr_hash(&node->hash, tracker->capacity);
     if (!tracker->items[key])
     {
@@ -328,32 +730,64 @@ static bool mmr_tr_insert(MMRTracker *tracker, MMRNode *node)
     return true;
 }
 
-// --------------------------- MMR FOREST -----------------------------------
-
 /**
- * Create leaf node from element data
- * Computes the hash of the element and creates a new leaf node in the MMR
- * MEMORY OWNERSHIP: The created node is owned by the tracker after successful insertion
- * Caller receives a pointer for convenience but must NOT free the node
- * @param tracker Pointer to tracker to register the new node with (takes ownership)
- * @param e Element data to create leaf for
- * @param n Size of element data in bytes
- * @param leaf Output pointer to store the created leaf node (tracker owns the memory)
- * @return true on success, false on failure
+ * Move every item of one tracker into another, leaving the source empty
+ * Items keep their allocations, only the bucket links are rewritten
+ * @param tracker Pointer to tracker taking ownership of the items
+ * @param from Pointer to tracker to empty, left without a hash table
+ * @return true on success, false on memory allocation failure (nothing is moved)
  */
-static bool create_leaf(MMRTracker *tracker, const uint8_t *e, size_t n, MMRNode **leaf)
+static bool mmr_tr_absorb(MMRTracker *tracker, MMRTracker *from)
 {
-    if (!tracker || !leaf || !e || n < 1) return false;
+    if (!tracker || !from || !from->items) return false;
+    if (!mmr_tr_reserve(tracker, from->count)) return false;
 
-    MMRNode *node = malloc(sizeof(MMRNode));
-    if (!node) return false;
-
-    if (!sha256(e, n, &node->hash))
+    for (size_t i = 0; i < from->capacity; ++i)
     {
-        free(node);
-        return false;
+        MMRItem *item = from->items[i];
+        while (item)
+        {
+            MMRItem *next = item->next;
+
+            size_t key = mmr_tr_hash(&item->node->hash, tracker->capacity);
+
+            item->next = tracker->items[key];
+            tracker->items[key] = item;
+
+            item = next;
+        }
     }
 
+    tracker->count += from->count;
+
+    free(from->items);
+    from->items = NULL;
+    from->capacity = 0;
+    from->count = 0;
+
+    return true;
+}
+
+// --------------------------- MMR FOREST -----------------------------------
+
+/**
+ * Create leaf node from a precomputed element hash
+ * MEMORY OWNERSHIP: The created node is owned by the tracker after successful insertion
+ * Caller receives a pointer for convenience but must NOT free the node
+ * @param tracker Pointer to tracker to register the new node with (takes ownership)
+ * @param hash Hash of the element the leaf represents
+ * @param leaf Output pointer to store the created leaf node (tracker owns the memory)
+ * @return true on success, false on failure
+ */
+static bool create_leaf(MMRTracker *tracker, const bytes32 *hash, MMRNode **leaf)
+{
+    if (!tracker || !leaf || !hash) return false;
+
+    MMRNode *node = malloc(sizeof(MMRNode));
+    if (!node) return false;
+
+    memcpy(node->hash, *hash, sizeof(bytes32));
+
     if (!mmr_tr_insert(tracker, node))
     {
         free(node);
@@ -377,12 +811,14 @@ static bool create_leaf(MMRTracker *tracker, const uint8_t *e, size_t n, MMRNode
  * MEMORY OWNERSHIP: The created parent node is owned by the tracker after successful insertion
  * Child nodes remain owned by tracker, caller receives parent pointer but must NOT free it
  * @param tracker Pointer to tracker to register the new parent node with (takes ownership)
+ * @param backend Hash backend of the accumulator
  * @param left Left child node to merge (must be tracker-owned)
  * @param right Right child node to merge (must be tracker-owned)
  * @param parent Output pointer to store the created parent node (tracker owns the memory)
  * @return true on success, false on failure
  */
-static bool merge_nodes(MMRTracker *tracker, MMRNode *left, MMRNode *right, MMRNode **parent)
+static bool merge_nodes(MMRTracker *tracker, MMRHashBackend backend, MMRNode *left, MMRNode *right,
+                        MMRNode **parent)
 {
     if (!tracker || !parent || !left || !right) return false;
     if (left->n_leaves != right->n_leaves) return false;
@@ -390,7 +826,7 @@ static bool merge_nodes(MMRTracker *tracker, MMRNode *left, MMRNode *right, MMRN
     MMRNode *result = malloc(sizeof(MMRNode));
     if (!result) return false;
 
-    if (!merkle_hash(&left->hash, &right->hash, &result->hash))
+    if (!node_hash(backend, &left->hash, &right->hash, &result->hash))
     {
         free(result);
         return false;
@@ -423,189 +859,157 @@ static bool merge_nodes(MMRTracker *tracker, MMRNode *left, MMRNode *right, MMRN
     return true;
 }
 
-// ------------------------ MMR ACCUMULATOR ---------------------------------
-
 /**
- * Initialize an empty MMR accumulator
- * Sets up the root list and internal node tracker
- * @param acc Pointer to accumulator to initialize
+ * Check whether a node is the root of a collapsed subtree
+ * Collapsed subtrees keep only their root and leaves: the root's left and
+ * right point at the first and last leaf, and the leaves are chained in
+ * order through their next pointers
+ * @param node Node to check
+ * @return true if the levels between node and its leaves are not stored
  */
-void mmr_init(MMRAccumulator *acc)
+static inline bool node_collapsed(const MMRNode *node)
 {
-    if (!acc) return;
-
-    acc->head = NULL;
-    mmr_tr_init(&acc->tracker);
+    return node->left && node->n_leaves > 2 && node->left->n_leaves == 1;
 }
 
 /**
- * Destroy MMR accumulator and free all memory
- * Cleans up all nodes, witnesses, and internal data structures
- * MEMORY OWNERSHIP: This function frees ALL memory associated with the accumulator
- * including all MMR nodes, witnesses, and tracker data - no manual cleanup required
- * @param acc Pointer to accumulator to destroy
+ * Drop the interior levels of a freshly completed subtree
+ * Frees every node strictly between the subtree root and its leaves and
+ * relinks the leaves directly beneath the root, chained in order
+ * Leaves lose any cached witness, since its root may have been freed
+ * @param tracker Pointer to tracker owning the subtree
+ * @param root Root of a complete subtree with up to 2^MMR_MAX_SPARSE_HEIGHT leaves
  */
-void mmr_destroy(MMRAccumulator *acc)
+static void collapse_subtree(MMRTracker *tracker, MMRNode *root)
 {
-    if (!acc) return;
+    if (root->n_leaves > (1 << MMR_MAX_SPARSE_HEIGHT) || node_collapsed(root)) return;
 
-    acc->head = NULL;
-    mmr_tr_destroy(&acc->tracker);
-}
+    MMRNode *stack[MMR_MAX_SPARSE_HEIGHT + 1];
+    MMRNode *leaves[1 << MMR_MAX_SPARSE_HEIGHT];
+    size_t depth = 0;
+    size_t n_leaves = 0;
 
-/**
- * Add element to MMR accumulator
- * Creates a leaf node and merges it with existing roots of the same size
- * @param acc Pointer to accumulator
- * @param e Element data to add
- * @param n Size of element data in bytes
- * @return true on success, false on failure
- */
-bool mmr_add(MMRAccumulator *acc, const uint8_t *e, size_t n)
-{
-    if (!acc || !e || n < 1) return false;
+    // Depth-first walk, pushing right before left so leaves come out in order
+    // Interior nodes are freed as soon as their children have been pushed
+    stack[depth++] = root->right;
+    stack[depth++] = root->left;
 
-    MMRNode *node;
-    if (!create_leaf(&acc->tracker, e, n, &node))
+    while (depth > 0)
     {
-        return false;
-    }
-
-    MMRNode **cur = &acc->head;
+        MMRNode *node = stack[--depth];
 
-    // Merge with existing roots of same size
-    while (*cur && (*cur)->n_leaves == node->n_leaves)
-    {
-        MMRNode *next = (*cur)->next;
-        MMRNode *parent;
-        if (!merge_nodes(&acc->tracker, *cur, node, &parent))
+        if (node->n_leaves == 1)
         {
-            return false;
+            leaves[n_leaves++] = node;
+            continue;
         }
 
-        node = parent;
-        *cur = next;
-    }
-
-    node->next = *cur;
-    *cur = node;
-
-    return true;
-}
-
-/**
- * TODO Remove element from MMR accumulator using witness
- * @param acc Pointer to accumulator
- * @param w Witness for element removal
- * @return true on success, false on failure
- */
-// bool mmr_remove(MMRAccumulator *acc, const MMRWitness *w)
-// {
-//     if (!acc || !w) return false;
-//     return false;
-// }
-
-/**
- * Verify witness against MMR accumulator
- * Reconstructs the root hash from the witness path and checks if it matches
- * any root in the accumulator's current state
- * @param acc Pointer to accumulator
- * @param w Witness to verify
- * @return true if proof is valid, false otherwise
- */
-bool mmr_verify(const MMRAccumulator *acc, const MMRWitness *w)
-{
-    if (!acc || !w) return false;
-    if (w->n_siblings > 0 && !w->siblings) return false;
-    if (w->n_siblings > WITNESS_MAX_SIBLINGS) return false;
-    if (w->path >= (1ULL << w->n_siblings)) return false;
+        stack[depth++] = node->right;
+        stack[depth++] = node->left;
 
-    bytes32 hash;
-    memcpy(hash, w->hash, sizeof(bytes32));
+        mmr_tr_remove(tracker, node);
+    }
 
-    // Reconstruct the root hash by following the witness path
-    for (uint16_t i = 0; i < w->n_siblings; ++i)
+    for (size_t i = 0; i < n_leaves; ++i)
     {
-        // Extract the bit at position i to determine sibling order
-        int sibling_order = (w->path >> i) & 1;
-        if (sibling_order == MMR_SIBLING_RIGHT)
-        {
-            if (!merkle_hash(&hash, &w->siblings[i], &hash))
-            {
-                return false;
-            }
-        }
-        else
-        {
-            if (!merkle_hash(&w->siblings[i], &hash, &hash))
-            {
-                return false;
-            }
-        }
+        leaves[i]->parent = root;
+        leaves[i]->next = i + 1 < n_leaves ? leaves[i + 1] : NULL;
 
-        if (mmr_tr_has_root(acc, &hash))
-        {
-            return true;
-        }
+        MMRItem *item = mmr_tr_item(tracker, leaves[i]);
+        if (item) item->witness_root = NULL;
     }
 
-    return mmr_tr_has_root(acc, &hash);
+    root->left = leaves[0];
+    root->right = leaves[n_leaves - 1];
 }
 
 /**
- * Create witness for element in MMR accumulator
- * Generates a Merkle proof that demonstrates the element is included
- * in the accumulator by collecting sibling hashes along the path to root
- * MEMORY OWNERSHIP: The witness siblings array is owned by the tracker after creation
- * Caller receives populated witness struct but must NOT free w->siblings manually
- * The siblings array will be freed automatically during mmr_destroy()
- * @param acc Pointer to accumulator
- * @param w Witness structure to populate with proof data (siblings owned by tracker)
- * @param e Element to create witness for
- * @param n Size of element in bytes
- * @return true on success, false on failure
+ * Collect the sibling hashes for a leaf that sits in a collapsed subtree
+ * Rebuilds the unstored levels from the chained leaf digests one level at a time
+ * @param backend Hash backend of the accumulator
+ * @param group Root of the collapsed subtree
+ * @param leaf Leaf inside the subtree whose path is wanted
+ * @param siblings Output sibling array, filled from index *level upwards
+ * @param path In/out witness path bits
+ * @param level In/out number of siblings collected so far
+ * @return true on success, false on invalid structure or allocation failure
  */
-bool mmr_witness(const MMRAccumulator *acc, MMRWitness *w, const uint8_t *e, size_t n)
+static bool collapsed_path(MMRHashBackend backend, const MMRNode *group, const MMRNode *leaf, bytes32 *siblings,
+                           uint64_t *path, uint16_t *level)
 {
-    if (!acc || !w || !e || n < 1) return false;
+    size_t width = group->n_leaves;
+    bytes32 *hashes = malloc(width * sizeof(bytes32));
+    if (!hashes) return false;
 
-    bytes32 hash;
-    if (!sha256(e, n, &hash)) return false;
+    size_t index = width;
+    size_t count = 0;
 
-    MMRItem *item;
-    if (!mmr_tr_get(&acc->tracker, &hash, &item))
+    for (const MMRNode *cur = group->left; cur && count < width; cur = cur->next, ++count)
     {
-        return false;
+        if (cur == leaf) index = count;
+        memcpy(hashes[count], cur->hash, sizeof(bytes32));
     }
 
-    // Cache and re-use unchanged witnesses
-    if (item->witness_root && mmr_tr_has_root(acc, &item->witness_root->hash))
+    if (count != width || index == width)
     {
-        *w = item->witness;
-        return true;
+        free(hashes);
+        return false;
     }
 
-    MMRNode *node = item->node;
+    for (; width > 1; width /= 2)
+    {
+        if (*level >= WITNESS_MAX_SIBLINGS)
+        {
+            free(hashes);
+            return false;
+        }
 
-    memset(w, 0, sizeof(MMRWitness));
+        memcpy(siblings[*level], hashes[index ^ 1], sizeof(bytes32));
 
-    uint64_t path = 0;
-    uint16_t level = 0;
+        // Even index means we are the left child, sibling is on the right
+        if ((index & 1) == 0) *path |= (1ULL << *level);
+        ++*level;
 
-    // Allocate maximum possible space for sibling hashes
-    bytes32 *siblings = calloc(WITNESS_MAX_SIBLINGS, sizeof(bytes32));
+        if (width > 2) merkle_hash_level(backend, hashes, width / 2, hashes);
+        index /= 2;
+    }
+
+    free(hashes);
+
+    return true;
+}
+
+/**
+ * Collect the sibling hashes on the path from a node up to its root
+ * @param backend Hash backend of the accumulator
+ * @param node Node to start from (normally a leaf)
+ * @param siblings Output array with room for WITNESS_MAX_SIBLINGS hashes
+ * @param path Output witness path bits
+ * @param level Output number of siblings collected
+ * @param root Output pointer to the root the path ends at
+ * @return true on success, false on invalid tree structure or too deep a path
+ */
+static bool collect_path(MMRHashBackend backend, const MMRNode *node, bytes32 *siblings, uint64_t *path,
+                         uint16_t *level, MMRNode **root)
+{
+    *path = 0;
+    *level = 0;
 
     while (node->parent)
     {
-        if (level >= WITNESS_MAX_SIBLINGS)
-        {
-            free(siblings);
-            return false;
-        }
+        if (*level >= WITNESS_MAX_SIBLINGS) return false;
 
         MMRNode *parent = node->parent;
         MMRNode *sibling;
 
+        if (node_collapsed(parent))
+        {
+            if (!collapsed_path(backend, parent, node, siblings, path, level)) return false;
+
+            node = parent;
+            continue;
+        }
+
         // Determine which child we are and find our sibling
         if (parent->left == node)
         {
@@ -613,7 +1017,7 @@ bool mmr_witness(const MMRAccumulator *acc, MMRWitness *w, const uint8_t *e, siz
             sibling = parent->right;
 
             // Set bit to indicate right sibling
-            path |= (1ULL << level);
+            *path |= (1ULL << *level);
         }
         else if (parent->right == node)
         {
@@ -624,49 +1028,6464 @@ bool mmr_witness(const MMRAccumulator *acc, MMRWitness *w, const uint8_t *e, siz
         else
         {
             // Invalid tree structure
-            free(siblings);
             return false;
         }
 
-        memcpy(siblings[level], sibling->hash, sizeof(bytes32));
+        memcpy(siblings[*level], sibling->hash, sizeof(bytes32));
 
         node = parent;
-        ++level;
+        ++*level;
     }
 
-    memcpy(w->hash, hash, sizeof(bytes32));
-    w->n_siblings = level;
-    w->path = path;
+    *root = (MMRNode *) node;
 
-    // Check if this is a leaf level proof
-    if (level == 0)
+    return true;
+}
+
+// ----------------------- MMR PERF COUNTERS --------------------------------
+
+/**
+ * Hardware counter group of the calling thread
+ * Opened on first use and closed by the thread key destructor on exit
+ */
+typedef struct
+{
+    int leader;
+    int fds[MMR_PERF_EVENTS];
+
+    // Position of each event in a group read, or -1 if it could not be opened
+    int slot[MMR_PERF_EVENTS];
+    int n_open;
+    uint64_t mask;
+} PerfGroup;
+
+/**
+ * Counter values and start time captured at the beginning of an operation
+ */
+typedef struct
+{
+    bool active;
+    const PerfGroup *group;
+    struct timespec start;
+    uint64_t values[MMR_PERF_EVENTS];
+} PerfSample;
+
+/**
+ * Nanoseconds elapsed on the monotonic clock since a start time
+ * @param start Time previously sampled with clock_gettime(CLOCK_MONOTONIC)
+ * @return Elapsed time in nanoseconds
+ */
+static uint64_t elapsed_ns(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) (now.tv_sec - start->tv_sec) * 1000000000ULL + (uint64_t) (now.tv_nsec - start->tv_nsec);
+}
+
+static pthread_key_t perf_key;
+static pthread_once_t perf_once = PTHREAD_ONCE_INIT;
+static bool perf_key_ok;
+
+// Stored for threads where no event could be opened, so they don't retry
+static PerfGroup perf_unavailable;
+
+/**
+ * Close a thread's counter group
+ * @param arg Group stored under perf_key
+ */
+static void perf_group_close(void *arg)
+{
+    PerfGroup *group = arg;
+    if (!group || group == &perf_unavailable) return;
+
+#ifdef __linux__
+    for (int e = 0; e < MMR_PERF_EVENTS; ++e)
     {
-        free(siblings);
-        siblings = NULL;
+        if (group->fds[e] >= 0) close(group->fds[e]);
     }
-    else
+#endif
+
+    free(group);
+}
+
+/**
+ * Create the thread key that owns the per-thread counter groups
+ */
+static void perf_key_init(void)
+{
+    perf_key_ok = pthread_key_create(&perf_key, perf_group_close) == 0;
+}
+
+#ifdef __linux__
+/**
+ * Open one user-space counter, optionally joining an existing group
+ * @param type perf event type
+ * @param config perf event config
+ * @param group_fd Group leader, or -1 to start a new group
+ * @return File descriptor, or -1 if the event is unavailable
+ */
+static int perf_open_event(uint32_t type, uint64_t config, int group_fd)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.read_format = PERF_FORMAT_GROUP;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    return (int) syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+#endif
+
+/**
+ * Open the counter group for the calling thread
+ * Events are opened one by one so a missing one only drops that event
+ * @return Newly allocated group, or NULL if no event could be opened
+ */
+static PerfGroup *perf_group_open(void)
+{
+#ifdef __linux__
+    static const struct
     {
-        // Shrink the array down if possible to save some memory
-        bytes32 *shrink = realloc(siblings, level * sizeof(bytes32));
-        if (shrink)
-        {
-            siblings = shrink;
-        }
-    }
+        uint32_t type;
+        uint64_t config;
+    } events[MMR_PERF_EVENTS] = {
+        [MMR_PERF_CYCLES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        [MMR_PERF_INSTRUCTIONS] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        [MMR_PERF_LLC_MISSES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+        [MMR_PERF_DTLB_MISSES] = {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                                          (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+        [MMR_PERF_BRANCH_MISSES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    };
 
-    w->siblings = siblings;
+    PerfGroup *group = calloc(1, sizeof(PerfGroup));
+    if (!group) return NULL;
 
-    // If we've previously calculated a witness
-    // for this node, we need to manually free it,
-    // otherwise it'll be overwritten and go untracked
-    if (item->witness.siblings)
+    group->leader = -1;
+
+    for (int e = 0; e < MMR_PERF_EVENTS; ++e)
     {
-        free(item->witness.siblings);
-        item->witness.siblings = NULL;
+        group->fds[e] = perf_open_event(events[e].type, events[e].config, group->leader);
+        group->slot[e] = -1;
+        if (group->fds[e] < 0) continue;
+
+        if (group->leader < 0) group->leader = group->fds[e];
+        group->slot[e] = group->n_open++;
+        group->mask |= 1ULL << e;
     }
 
-    item->witness = *w;
-    item->witness_root = node;
+    if (group->n_open > 0) return group;
+
+    free(group);
+#endif
+
+    return NULL;
+}
+
+/**
+ * Get the calling thread's counter group, opening it on first use
+ * @return The group, or NULL if counters are unavailable on this thread
+ */
+static const PerfGroup *perf_group(void)
+{
+    pthread_once(&perf_once, perf_key_init);
+    if (!perf_key_ok) return NULL;
+
+    PerfGroup *group = pthread_getspecific(perf_key);
+    if (group) return group == &perf_unavailable ? NULL : group;
+
+    group = perf_group_open();
+    pthread_setspecific(perf_key, group ? group : &perf_unavailable);
+
+    return group;
+}
+
+/**
+ * Read all counters of a group in a single system call
+ * @param group Group to read
+ * @param values Output indexed by event, unavailable events are set to 0
+ * @return true on success, false if the read failed
+ */
+static bool perf_read(const PerfGroup *group, uint64_t *values)
+{
+#ifdef __linux__
+    // Group read layout is the event count followed by one value per event
+    uint64_t buf[1 + MMR_PERF_EVENTS];
+    ssize_t len = read(group->leader, buf, sizeof(buf));
+    if (len < (ssize_t) ((1 + group->n_open) * sizeof(uint64_t))) return false;
+
+    for (int e = 0; e < MMR_PERF_EVENTS; ++e)
+    {
+        values[e] = group->slot[e] >= 0 ? buf[1 + group->slot[e]] : 0;
+    }
 
     return true;
+#else
+    (void) group;
+    (void) values;
+    return false;
+#endif
+}
+
+/**
+ * Start sampling an operation if the accumulator collects counters
+ * @param acc Pointer to accumulator the operation runs on
+ * @param sample Sample to start
+ */
+static inline void perf_begin(const MMRAccumulator *acc, PerfSample *sample)
+{
+    sample->active = acc->perf_counters && acc->stats;
+    if (!sample->active) return;
+
+    sample->group = perf_group();
+    if (sample->group && !perf_read(sample->group, sample->values)) sample->group = NULL;
+
+    clock_gettime(CLOCK_MONOTONIC, &sample->start);
+}
+
+/**
+ * Finish sampling an operation and add the deltas to its totals
+ * @param acc Pointer to accumulator the operation ran on
+ * @param op Operation kind (MMR_OP_*)
+ * @param sample Sample started by perf_begin
+ * @param count Number of operations covered by the sample
+ */
+static inline void perf_end(const MMRAccumulator *acc, int op, const PerfSample *sample, uint64_t count)
+{
+    if (!sample->active) return;
+
+    uint64_t ns = elapsed_ns(&sample->start);
+
+    MMRPerfCounters *totals = &acc->stats->perf[op];
+    __atomic_fetch_add(&totals->ops, count, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&totals->ns, ns, __ATOMIC_RELAXED);
+
+    uint64_t values[MMR_PERF_EVENTS];
+    if (!sample->group || !perf_read(sample->group, values)) return;
+
+    for (int e = 0; e < MMR_PERF_EVENTS; ++e)
+    {
+        if (sample->group->slot[e] < 0) continue;
+        __atomic_fetch_add(&totals->events[e], values[e] - sample->values[e], __ATOMIC_RELAXED);
+    }
+
+    __atomic_fetch_or(&acc->stats->perf_events, sample->group->mask, __ATOMIC_RELAXED);
+}
+
+// --------------------------- MMR SYNC -------------------------------------
+
+/**
+ * Locks guarding an accumulator in concurrent mode
+ *
+ * Mountains are locked individually, indexed by peak height. mmr_add only ever
+ * merges the smallest peaks, so a writer write-locks just those heights while
+ * readers of the large, stable mountains hold read locks nobody else wants
+ * The tracker lock covers the hash table and tree linkage; both sides hold it
+ * only for lookups and structural updates, never while building witnesses
+ * The writer mutex serialises writers, and the cache mutex protects witness
+ * cache entries that readers fill in under a shared lock
+ * The spent mutex guards the tombstone bitmap, which readers consult per witness
+ *
+ * Lock order: writer, mountains in ascending height, tracker, spent, cache
+ */
+struct MMRSync
+{
+    pthread_mutex_t writer;
+    pthread_rwlock_t mountains[MMR_MAX_HEIGHT];
+    pthread_rwlock_t tracker;
+    pthread_mutex_t spent;
+    pthread_mutex_t cache;
+};
+
+/**
+ * Allocate and initialise the locks for a concurrent accumulator
+ * The rwlocks prefer writers so a steady stream of readers cannot starve mmr_add
+ * @return Pointer to the new lock set, or NULL on failure
+ */
+static struct MMRSync *mmr_sync_create(void)
+{
+    struct MMRSync *sync = malloc(sizeof(struct MMRSync));
+    if (!sync) return NULL;
+
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+
+    for (size_t i = 0; i < MMR_MAX_HEIGHT; ++i)
+    {
+        pthread_rwlock_init(&sync->mountains[i], &attr);
+    }
+
+    pthread_rwlock_init(&sync->tracker, &attr);
+    pthread_rwlockattr_destroy(&attr);
+
+    pthread_mutex_init(&sync->writer, NULL);
+    pthread_mutex_init(&sync->spent, NULL);
+    pthread_mutex_init(&sync->cache, NULL);
+
+    return sync;
+}
+
+/**
+ * Destroy and free a lock set created by mmr_sync_create
+ * @param sync Lock set to destroy (may be NULL)
+ */
+static void mmr_sync_destroy(struct MMRSync *sync)
+{
+    if (!sync) return;
+
+    for (size_t i = 0; i < MMR_MAX_HEIGHT; ++i)
+    {
+        pthread_rwlock_destroy(&sync->mountains[i]);
+    }
+
+    pthread_rwlock_destroy(&sync->tracker);
+    pthread_mutex_destroy(&sync->writer);
+    pthread_mutex_destroy(&sync->spent);
+    pthread_mutex_destroy(&sync->cache);
+    free(sync);
+}
+
+/**
+ * Acquire a reader/writer lock, counting and timing contended acquisitions
+ * so benchmarks can report the cost of synchronisation separately
+ * @param acc Pointer to accumulator the lock belongs to
+ * @param lock Lock to acquire
+ * @param exclusive true to lock for writing, false to lock for reading
+ */
+static void rwlock_acquire(const MMRAccumulator *acc, pthread_rwlock_t *lock, bool exclusive)
+{
+    // Any failure other than contention (EDEADLK, EAGAIN) is left to the blocking call
+    if ((exclusive ? pthread_rwlock_trywrlock(lock) : pthread_rwlock_tryrdlock(lock)) == 0) return;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (exclusive)
+    {
+        pthread_rwlock_wrlock(lock);
+    }
+    else
+    {
+        pthread_rwlock_rdlock(lock);
+    }
+
+    MMR_STAT_INC(acc, lock_waits);
+    MMR_STAT_ADD(acc, lock_wait_ns, elapsed_ns(&start));
+}
+
+/**
+ * Acquire a mutex, counting and timing contended acquisitions
+ * @param acc Pointer to accumulator the mutex belongs to
+ * @param mutex Mutex to acquire
+ */
+static void mutex_acquire(const MMRAccumulator *acc, pthread_mutex_t *mutex)
+{
+    if (pthread_mutex_trylock(mutex) == 0) return;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    pthread_mutex_lock(mutex);
+
+    MMR_STAT_INC(acc, lock_waits);
+    MMR_STAT_ADD(acc, lock_wait_ns, elapsed_ns(&start));
+}
+
+/**
+ * Height of a mountain from its number of leaves
+ * @param n_leaves Leaves under a peak (a power of two)
+ * @return Height of the peak, 0 for a single leaf
+ */
+static inline unsigned mountain_height(size_t n_leaves)
+{
+    return (unsigned) __builtin_ctzll((unsigned long long) n_leaves);
+}
+
+/**
+ * Lock the tracker for lookups or structural changes
+ * Does nothing for accumulators that were not initialised as concurrent
+ * @param acc Pointer to accumulator to lock
+ * @param exclusive true for structural changes, false for lookups
+ */
+static inline void mmr_lock_tracker(const MMRAccumulator *acc, bool exclusive)
+{
+    if (acc->sync) rwlock_acquire(acc, &acc->sync->tracker, exclusive);
+}
+
+/**
+ * Release the tracker lock taken by mmr_lock_tracker
+ * @param acc Pointer to accumulator to unlock
+ */
+static inline void mmr_unlock_tracker(const MMRAccumulator *acc)
+{
+    if (acc->sync) pthread_rwlock_unlock(&acc->sync->tracker);
+}
+
+/**
+ * Serialise writers against each other
+ * @param acc Pointer to accumulator about to be modified
+ */
+static inline void mmr_write_begin(const MMRAccumulator *acc)
+{
+    if (acc->sync) mutex_acquire(acc, &acc->sync->writer);
+}
+
+/**
+ * Release the writer mutex taken by mmr_write_begin
+ * @param acc Pointer to accumulator that was modified
+ */
+static inline void mmr_write_end(const MMRAccumulator *acc)
+{
+    if (acc->sync) pthread_mutex_unlock(&acc->sync->writer);
+}
+
+/**
+ * Lock exactly the mountains the next appended leaf will merge with
+ * The new leaf cascades through the run of peaks of height 0, 1, 2, ... at
+ * the head of the root list, so only heights 0..k are touched, where k is
+ * the height of the resulting peak. The tracker is then locked exclusively
+ * Caller must hold the writer mutex so the root list cannot change under it
+ * @param acc Pointer to accumulator about to be appended to
+ * @return Height k of the peak the append will produce
+ */
+static unsigned mmr_lock_append(const MMRAccumulator *acc)
+{
+    unsigned k = 0;
+    for (const MMRNode *cur = acc->head; cur && cur->n_leaves == (size_t) 1 << k; cur = cur->next)
+    {
+        ++k;
+    }
+
+    if (!acc->sync) return k;
+
+    for (unsigned h = 0; h <= k && h < MMR_MAX_HEIGHT; ++h)
+    {
+        rwlock_acquire(acc, &acc->sync->mountains[h], true);
+    }
+
+    rwlock_acquire(acc, &acc->sync->tracker, true);
+
+    return k;
+}
+
+/**
+ * Release the locks taken by mmr_lock_append
+ * @param acc Pointer to accumulator that was appended to
+ * @param k Height returned by mmr_lock_append
+ */
+static void mmr_unlock_append(const MMRAccumulator *acc, unsigned k)
+{
+    if (!acc->sync) return;
+
+    pthread_rwlock_unlock(&acc->sync->tracker);
+
+    for (unsigned h = 0; h <= k && h < MMR_MAX_HEIGHT; ++h)
+    {
+        pthread_rwlock_unlock(&acc->sync->mountains[h]);
+    }
+}
+
+/**
+ * Find the peak above a node by following parent pointers
+ * Caller must hold the tracker lock or a lock on the node's mountain
+ * @param node Node to start from
+ * @return The root of the mountain containing node
+ */
+static inline const MMRNode *mountain_root(const MMRNode *node)
+{
+    while (node->parent) node = node->parent;
+    return node;
+}
+
+/**
+ * Look up a leaf and pin the mountain containing it for reading
+ * The tracker is only held for the lookup and the walk to the peak; after that
+ * only the mountain's own lock is held, which the writer takes exclusively
+ * just before merging that mountain into a larger one
+ * MEMORY OWNERSHIP: The item stays owned by the tracker
+ * @param acc Pointer to accumulator to search
+ * @param hash Leaf hash to look up
+ * @param item Output pointer to the leaf's tracker item
+ * @param height Output height of the pinned mountain, pass to mmr_unlock_leaf
+ * @return true if the leaf was found and its mountain is locked, false otherwise
+ */
+static bool mmr_lock_leaf(const MMRAccumulator *acc, const bytes32 *hash, MMRItem **item, unsigned *height)
+{
+    for (;;)
+    {
+        mmr_lock_tracker(acc, false);
+
+        PerfSample lookup;
+        perf_begin(acc, &lookup);
+
+        bool found = mmr_tr_get(&acc->tracker, hash, item);
+
+        perf_end(acc, MMR_OP_TRACKER, &lookup, 1);
+
+        if (!found)
+        {
+            mmr_unlock_tracker(acc);
+            return false;
+        }
+
+        *height = mountain_height(mountain_root((*item)->node)->n_leaves);
+        if (!acc->sync) return true;
+
+        pthread_rwlock_t *mountain = &acc->sync->mountains[*height];
+
+        // Out of lock order, so only try; the peak cannot move while the tracker is held
+        if (pthread_rwlock_tryrdlock(mountain) == 0)
+        {
+            mmr_unlock_tracker(acc);
+            return true;
+        }
+
+        mmr_unlock_tracker(acc);
+
+        // The writer is merging this mountain - wait for it, then look again
+        rwlock_acquire(acc, mountain, false);
+        pthread_rwlock_unlock(mountain);
+    }
+}
+
+/**
+ * Release the mountain pinned by mmr_lock_leaf
+ * @param acc Pointer to accumulator
+ * @param height Height returned by mmr_lock_leaf
+ */
+static inline void mmr_unlock_leaf(const MMRAccumulator *acc, unsigned height)
+{
+    if (acc->sync) pthread_rwlock_unlock(&acc->sync->mountains[height]);
+}
+
+/**
+ * Guard access to witness cache entries while holding a shared lock
+ * @param acc Pointer to accumulator whose cache is being accessed
+ */
+static inline void mmr_cache_lock(const MMRAccumulator *acc)
+{
+    if (acc->sync) pthread_mutex_lock(&acc->sync->cache);
+}
+
+/**
+ * Release the witness cache guard taken by mmr_cache_lock
+ * @param acc Pointer to accumulator whose cache was being accessed
+ */
+static inline void mmr_cache_unlock(const MMRAccumulator *acc)
+{
+    if (acc->sync) pthread_mutex_unlock(&acc->sync->cache);
+}
+
+/**
+ * Guard access to the tombstone bitmap
+ * @param acc Pointer to accumulator whose bitmap is being accessed
+ */
+static inline void mmr_spent_lock(const MMRAccumulator *acc)
+{
+    if (acc->sync) mutex_acquire(acc, &acc->sync->spent);
+}
+
+/**
+ * Release the guard taken by mmr_spent_lock
+ * @param acc Pointer to accumulator whose bitmap was accessed
+ */
+static inline void mmr_spent_unlock(const MMRAccumulator *acc)
+{
+    if (acc->sync) pthread_mutex_unlock(&acc->sync->spent);
+}
+
+// ------------------------- MMR PARALLEL -----------------------------------
+
+/**
+ * Work function run over a half-open index range by parallel_for
+ */
+typedef void (*parallel_fn)(void *ctx, size_t begin, size_t end);
+
+typedef struct
+{
+    parallel_fn fn;
+    void *ctx;
+    size_t begin;
+    size_t end;
+} ParallelChunk;
+
+static void *parallel_worker(void *arg)
+{
+    ParallelChunk *chunk = arg;
+    chunk->fn(chunk->ctx, chunk->begin, chunk->end);
+    return NULL;
+}
+
+/**
+ * Split [0, n) into contiguous chunks and run fn over them on up to n_threads threads
+ * The calling thread processes the first chunk itself; chunks whose thread cannot
+ * be started are run inline, so the work is always completed
+ * @param n Number of items to process
+ * @param n_threads Maximum number of threads to use (0 or 1 runs inline)
+ * @param fn Function to run over each chunk
+ * @param ctx Context pointer passed through to fn
+ */
+static void parallel_for(size_t n, unsigned n_threads, parallel_fn fn, void *ctx)
+{
+    if (n == 0) return;
+    if (n_threads > n) n_threads = (unsigned) n;
+
+    if (n_threads <= 1)
+    {
+        fn(ctx, 0, n);
+        return;
+    }
+
+    ParallelChunk *chunks = malloc(n_threads * sizeof(ParallelChunk));
+    pthread_t *threads = malloc(n_threads * sizeof(pthread_t));
+    bool *started = calloc(n_threads, sizeof(bool));
+
+    if (!chunks || !threads || !started)
+    {
+        free(chunks);
+        free(threads);
+        free(started);
+
+        fn(ctx, 0, n);
+        return;
+    }
+
+    size_t step = n / n_threads;
+    size_t extra = n % n_threads;
+    size_t begin = 0;
+
+    for (unsigned t = 0; t < n_threads; ++t)
+    {
+        size_t len = step + (t < extra ? 1 : 0);
+
+        chunks[t].fn = fn;
+        chunks[t].ctx = ctx;
+        chunks[t].begin = begin;
+        chunks[t].end = begin + len;
+        begin += len;
+
+        if (t > 0) started[t] = pthread_create(&threads[t], NULL, parallel_worker, &chunks[t]) == 0;
+    }
+
+    fn(ctx, chunks[0].begin, chunks[0].end);
+
+    for (unsigned t = 1; t < n_threads; ++t)
+    {
+        if (started[t])
+        {
+            pthread_join(threads[t], NULL);
+        }
+        else
+        {
+            fn(ctx, chunks[t].begin, chunks[t].end);
+        }
+    }
+
+    free(chunks);
+    free(threads);
+    free(started);
+}
+
+/**
+ * Resolve the thread count of a batch call from the accumulator's tuning
+ * MMR_THREADS_AUTO takes the tuned count, and no thread is given fewer than
+ * the tuned minimum of items, below which starting it costs more than it saves
+ * @param acc Pointer to accumulator whose tuning applies, or NULL for the defaults
+ * @param n Number of items the call will spread
+ * @param n_threads Thread count the caller asked for
+ * @return Number of threads to hand to parallel_for
+ */
+static unsigned tuned_threads(const MMRAccumulator *acc, size_t n, unsigned n_threads)
+{
+    unsigned threads = acc ? acc->tuning.threads : 1;
+    size_t min_items = acc ? acc->tuning.parallel_min : 1;
+
+    if (n_threads == MMR_THREADS_AUTO) n_threads = threads;
+
+    size_t most = n / min_items;
+    if (most < n_threads) n_threads = most > 1 ? (unsigned) most : 1;
+
+    return n_threads;
+}
+
+// -------------------------- MMR PREFIXES ----------------------------------
+
+/**
+ * Register a fixed prefix to be hashed in front of elements
+ * @param prefix Prefix state to initialise
+ * @param data Prefix bytes
+ * @param n Length of the prefix in bytes
+ * @return true on success, false on invalid parameters
+ */
+bool mmr_prefix_init(MMRPrefix *prefix, const uint8_t *data, size_t n)
+{
+    if (!prefix || (!data && n > 0)) return false;
+
+    SHA256_Init(&prefix->ctx);
+    if (n > 0) SHA256_Update(&prefix->ctx, data, n);
+
+    prefix->n = n;
+
+    return true;
+}
+
+/**
+ * Register a BIP-340 style tagged hash prefix
+ * The prefix is SHA256(tag) || SHA256(tag), exactly one block long
+ * @param prefix Prefix state to initialise
+ * @param tag Tag bytes
+ * @param n Length of the tag in bytes
+ * @return true on success, false on invalid parameters
+ */
+bool mmr_prefix_init_tag(MMRPrefix *prefix, const uint8_t *tag, size_t n)
+{
+    if (!prefix || (!tag && n > 0)) return false;
+
+    bytes32 tag_hash;
+    SHA256(tag ? tag : (const uint8_t *) "", n, tag_hash);
+
+    uint8_t block[SHA256_BLOCK_BYTES];
+    memcpy(block, tag_hash, sizeof(bytes32));
+    memcpy(block + sizeof(bytes32), tag_hash, sizeof(bytes32));
+
+    return mmr_prefix_init(prefix, block, sizeof(block));
+}
+
+// ------------------------- MMR ENCODING -----------------------------------
+
+/**
+ * Number of bytes needed to store the path bits of a witness
+ * @param n_siblings Number of siblings, one path bit each
+ * @return Path length in bytes
+ */
+static inline size_t witness_path_bytes(uint16_t n_siblings)
+{
+    return (n_siblings + 7) / 8;
+}
+
+/**
+ * Size of a witness in the compact wire encoding
+ * Layout: sibling count (1 byte), leaf hash, path bits (little-endian,
+ * rounded up to whole bytes), then the sibling hashes in path order
+ * @param w Witness to measure
+ * @return Encoded size in bytes, or 0 if the witness is invalid
+ */
+size_t mmr_witness_encoded_size(const MMRWitness *w)
+{
+    if (!w || w->n_siblings > WITNESS_MAX_SIBLINGS) return 0;
+
+    return 1 + sizeof(bytes32) + witness_path_bytes(w->n_siblings) + w->n_siblings * sizeof(bytes32);
+}
+
+/**
+ * Encode a witness into the compact wire encoding
+ * @param w Witness to encode
+ * @param buf Output buffer
+ * @param cap Capacity of the output buffer in bytes
+ * @param len Output for the number of bytes written (or required, if cap is too small)
+ * @return true on success, false if the witness is invalid or the buffer too small
+ */
+bool mmr_witness_encode(const MMRWitness *w, uint8_t *buf, size_t cap, size_t *len)
+{
+    size_t size = mmr_witness_encoded_size(w);
+    if (len) *len = size;
+
+    if (size == 0 || !buf || cap < size) return false;
+    if (w->n_siblings > 0 && !w->siblings) return false;
+
+    uint8_t *out = buf;
+    *out++ = (uint8_t) w->n_siblings;
+
+    memcpy(out, w->hash, sizeof(bytes32));
+    out += sizeof(bytes32);
+
+    uint64_t path = htole64(w->path);
+    memcpy(out, &path, witness_path_bytes(w->n_siblings));
+    out += witness_path_bytes(w->n_siblings);
+
+    if (w->n_siblings > 0) memcpy(out, w->siblings, w->n_siblings * sizeof(bytes32));
+
+    return true;
+}
+
+/**
+ * Decode a witness from the compact wire encoding
+ * @param w Witness to populate, w->siblings is set to siblings
+ * @param siblings Caller owned array with room for WITNESS_MAX_SIBLINGS hashes
+ * @param buf Encoded input
+ * @param len Length of the encoded input in bytes
+ * @param used Optional output for the number of bytes consumed
+ * @return true on success, false if the input is truncated or malformed
+ */
+bool mmr_witness_decode(MMRWitness *w, bytes32 *siblings, const uint8_t *buf, size_t len, size_t *used)
+{
+    if (!w || !siblings || !buf || len < 1 + sizeof(bytes32)) return false;
+
+    uint16_t n_siblings = buf[0];
+    if (n_siblings > WITNESS_MAX_SIBLINGS) return false;
+
+    size_t path_bytes = witness_path_bytes(n_siblings);
+    size_t size = 1 + sizeof(bytes32) + path_bytes + n_siblings * sizeof(bytes32);
+    if (len < size) return false;
+
+    const uint8_t *in = buf + 1;
+
+    memcpy(w->hash, in, sizeof(bytes32));
+    in += sizeof(bytes32);
+
+    uint64_t path = 0;
+    memcpy(&path, in, path_bytes);
+    path = le64toh(path);
+    in += path_bytes;
+
+    // Reject stray bits beyond the last sibling so encodings are canonical
+    if (path >= (1ULL << n_siblings)) return false;
+
+    memcpy(siblings, in, n_siblings * sizeof(bytes32));
+
+    w->path = path;
+    w->n_siblings = n_siblings;
+    w->siblings = siblings;
+
+    if (used) *used = size;
+
+    return true;
+}
+
+// ------------------------- MMR TOMBSTONES ---------------------------------
+
+// Positions per container, a container covers one value of pos >> 16
+#define SPENT_CONTAINER_BITS 16
+#define SPENT_CONTAINER_SIZE (1u << SPENT_CONTAINER_BITS)
+
+// Array containers turn into bitmaps once they would outgrow one (8 KiB)
+#define SPENT_ARRAY_MAX 4096
+#define SPENT_BITMAP_WORDS (SPENT_CONTAINER_SIZE / 64)
+
+/**
+ * One container of the spent bitmap
+ * Sparse containers hold a sorted array of the low 16 bits of each position,
+ * dense ones a plain bitmap, as in roaring bitmaps
+ */
+typedef struct
+{
+    uint64_t key;
+    uint32_t card;
+    uint32_t capacity;
+
+    uint16_t *array;
+    uint64_t *bits;
+} SpentContainer;
+
+/**
+ * Roaring-style set of spent leaf positions
+ * Containers are kept sorted by key so lookups are a binary search
+ */
+struct MMRSpent
+{
+    SpentContainer *containers;
+    size_t count;
+    size_t capacity;
+
+    uint64_t total;
+};
+
+/**
+ * Free a spent bitmap and all its containers
+ * @param spent Bitmap to free (may be NULL)
+ */
+static void spent_free(struct MMRSpent *spent)
+{
+    if (!spent) return;
+
+    for (size_t i = 0; i < spent->count; ++i)
+    {
+        free(spent->containers[i].array);
+        free(spent->containers[i].bits);
+    }
+
+    free(spent->containers);
+    free(spent);
+}
+
+/**
+ * Find the container for a key, or where it would be inserted
+ * @param spent Bitmap to search
+ * @param key Container key (position >> 16)
+ * @param index Output index of the container or of its insertion point
+ * @return true if the container exists
+ */
+static bool spent_find(const struct MMRSpent *spent, uint64_t key, size_t *index)
+{
+    size_t lo = 0;
+    size_t hi = spent->count;
+
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (spent->containers[mid].key < key)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    *index = lo;
+
+    return lo < spent->count && spent->containers[lo].key == key;
+}
+
+/**
+ * Find the first entry of a sorted array container not below a value
+ * @param c Array container
+ * @param low Value to search for
+ * @return Index of the first entry >= low
+ */
+static uint32_t spent_lower(const SpentContainer *c, uint32_t low)
+{
+    uint32_t lo = 0;
+    uint32_t hi = c->card;
+
+    while (lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (c->array[mid] < low)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+/**
+ * Check whether a position is marked spent
+ * @param spent Bitmap to check (may be NULL)
+ * @param pos Leaf position
+ * @return true if the position is spent
+ */
+static bool spent_test(const struct MMRSpent *spent, uint64_t pos)
+{
+    size_t index;
+    if (!spent || !spent_find(spent, pos >> SPENT_CONTAINER_BITS, &index)) return false;
+
+    const SpentContainer *c = &spent->containers[index];
+    uint32_t low = (uint32_t) (pos & (SPENT_CONTAINER_SIZE - 1));
+
+    if (c->bits) return (c->bits[low / 64] >> (low % 64)) & 1;
+
+    uint32_t at = spent_lower(c, low);
+    return at < c->card && c->array[at] == low;
+}
+
+/**
+ * Convert a full array container into a bitmap container
+ * @param c Container to convert
+ * @return true on success, false on allocation failure
+ */
+static bool spent_densify(SpentContainer *c)
+{
+    uint64_t *bits = calloc(SPENT_BITMAP_WORDS, sizeof(uint64_t));
+    if (!bits) return false;
+
+    for (uint32_t i = 0; i < c->card; ++i)
+    {
+        bits[c->array[i] / 64] |= 1ULL << (c->array[i] % 64);
+    }
+
+    free(c->array);
+    c->array = NULL;
+    c->capacity = 0;
+    c->bits = bits;
+
+    return true;
+}
+
+/**
+ * Mark a position as spent
+ * @param spent Bitmap to update
+ * @param pos Leaf position
+ * @return 1 if newly marked, 0 if it was already spent, -1 on allocation failure
+ */
+static int spent_set(struct MMRSpent *spent, uint64_t pos)
+{
+    size_t index;
+    uint64_t key = pos >> SPENT_CONTAINER_BITS;
+
+    if (!spent_find(spent, key, &index))
+    {
+        if (spent->count == spent->capacity)
+        {
+            size_t capacity = spent->capacity ? spent->capacity * 2 : TRACKER_MIN_CAPACITY;
+            SpentContainer *containers = realloc(spent->containers, capacity * sizeof(SpentContainer));
+            if (!containers) return -1;
+
+            spent->containers = containers;
+            spent->capacity = capacity;
+        }
+
+        memmove(&spent->containers[index + 1], &spent->containers[index],
+                (spent->count - index) * sizeof(SpentContainer));
+        memset(&spent->containers[index], 0, sizeof(SpentContainer));
+        spent->containers[index].key = key;
+        ++spent->count;
+    }
+
+    SpentContainer *c = &spent->containers[index];
+    uint32_t low = (uint32_t) (pos & (SPENT_CONTAINER_SIZE - 1));
+
+    if (!c->bits && c->card == SPENT_ARRAY_MAX)
+    {
+        if (spent_test(spent, pos)) return 0;
+        if (!spent_densify(c)) return -1;
+    }
+
+    if (c->bits)
+    {
+        uint64_t mask = 1ULL << (low % 64);
+        if (c->bits[low / 64] & mask) return 0;
+
+        c->bits[low / 64] |= mask;
+    }
+    else
+    {
+        uint32_t at = spent_lower(c, low);
+        if (at < c->card && c->array[at] == low) return 0;
+
+        if (c->card == c->capacity)
+        {
+            uint32_t capacity = c->capacity ? c->capacity * 2 : 4;
+            uint16_t *array = realloc(c->array, capacity * sizeof(uint16_t));
+            if (!array) return -1;
+
+            c->array = array;
+            c->capacity = capacity;
+        }
+
+        memmove(&c->array[at + 1], &c->array[at], (c->card - at) * sizeof(uint16_t));
+        c->array[at] = (uint16_t) low;
+    }
+
+    ++c->card;
+    ++spent->total;
+
+    return 1;
+}
+
+/**
+ * Count the spent positions within one container
+ * @param c Container to count in
+ * @param lo First low position, inclusive
+ * @param hi Last low position, exclusive (at most SPENT_CONTAINER_SIZE)
+ * @return Number of spent positions in [lo, hi)
+ */
+static uint64_t spent_count_container(const SpentContainer *c, uint32_t lo, uint32_t hi)
+{
+    if (lo == 0 && hi == SPENT_CONTAINER_SIZE) return c->card;
+
+    if (!c->bits) return spent_lower(c, hi) - spent_lower(c, lo);
+
+    uint64_t count = 0;
+    for (uint32_t word = lo / 64; word * 64 < hi; ++word)
+    {
+        uint64_t bits = c->bits[word];
+        if (word == lo / 64) bits &= ~0ULL << (lo % 64);
+        if ((word + 1) * 64 > hi) bits &= ~0ULL >> (64 - hi % 64);
+
+        count += (uint64_t) __builtin_popcountll(bits);
+    }
+
+    return count;
+}
+
+/**
+ * Count the spent positions in a range
+ * @param spent Bitmap to count in (may be NULL)
+ * @param start First position of the range
+ * @param len Number of positions in the range
+ * @return Number of spent positions in [start, start + len)
+ */
+static uint64_t spent_count(const struct MMRSpent *spent, uint64_t start, uint64_t len)
+{
+    if (!spent || len == 0) return 0;
+
+    uint64_t end = start + len;
+    uint64_t count = 0;
+
+    size_t index;
+    spent_find(spent, start >> SPENT_CONTAINER_BITS, &index);
+
+    for (; index < spent->count; ++index)
+    {
+        const SpentContainer *c = &spent->containers[index];
+        uint64_t base = c->key << SPENT_CONTAINER_BITS;
+        if (base >= end) break;
+
+        uint32_t lo = start > base ? (uint32_t) (start - base) : 0;
+        uint32_t hi = end - base < SPENT_CONTAINER_SIZE ? (uint32_t) (end - base) : SPENT_CONTAINER_SIZE;
+        count += spent_count_container(c, lo, hi);
+    }
+
+    return count;
+}
+
+/**
+ * Compute the position of a leaf among all leaves of the accumulator
+ * Only nodes on the leaf's own path and the larger peaks to its left are
+ * read, none of which an append can change while the leaf's mountain is held
+ * @param leaf Leaf node
+ * @return Zero-based position in insertion order
+ */
+static uint64_t leaf_position(const MMRNode *leaf)
+{
+    uint64_t pos = 0;
+    const MMRNode *node = leaf;
+
+    while (node->parent)
+    {
+        const MMRNode *parent = node->parent;
+
+        if (node_collapsed(parent))
+        {
+            // Leaves of a collapsed subtree are chained in order beneath its root
+            for (const MMRNode *cur = parent->left; cur && cur != node; cur = cur->next)
+            {
+                ++pos;
+            }
+        }
+        else if (parent->right == node)
+        {
+            pos += parent->left->n_leaves;
+        }
+
+        node = parent;
+    }
+
+    // Root list runs from the smallest peak, so the ones after ours lie to its left
+    for (const MMRNode *cur = node->next; cur; cur = cur->next)
+    {
+        pos += cur->n_leaves;
+    }
+
+    return pos;
+}
+
+/**
+ * Check whether a leaf has been tombstoned
+ * @param acc Pointer to accumulator (caller holds the leaf's mountain lock)
+ * @param leaf Leaf node
+ * @return true if the leaf is spent
+ */
+static bool leaf_spent(const MMRAccumulator *acc, const MMRNode *leaf)
+{
+    if (!acc->spent) return false;
+
+    uint64_t pos = leaf_position(leaf);
+
+    mmr_spent_lock(acc);
+    bool spent = spent_test(acc->spent, pos);
+    mmr_spent_unlock(acc);
+
+    return spent;
+}
+
+/**
+ * Check whether a node is the placeholder left behind by compaction
+ * @param node Node to check
+ * @return true if the node's descendants have been freed
+ */
+static inline bool node_pruned(const MMRNode *node)
+{
+    return node->n_leaves > 1 && !node->left;
+}
+
+/**
+ * Free everything beneath a fully spent subtree, keeping its root as a placeholder
+ * The root's hash still serves as a sibling for the live leaves next to it
+ * @param tracker Pointer to tracker owning the subtree
+ * @param root Root of the subtree
+ * @return Number of nodes freed
+ */
+static size_t prune_subtree(MMRTracker *tracker, MMRNode *root)
+{
+    MMRNode *stack[2 * MMR_MAX_HEIGHT];
+    size_t depth = 0;
+    size_t freed = 0;
+
+    stack[depth++] = root;
+
+    while (depth > 0)
+    {
+        MMRNode *node = stack[--depth];
+
+        if (node_collapsed(node))
+        {
+            for (MMRNode *leaf = node->left; leaf;)
+            {
+                MMRNode *next = leaf->next;
+                mmr_tr_remove(tracker, leaf);
+                ++freed;
+                leaf = next;
+            }
+        }
+        else if (node->left && !node_pruned(node))
+        {
+            stack[depth++] = node->left;
+            stack[depth++] = node->right;
+        }
+
+        if (node == root) continue;
+
+        mmr_tr_remove(tracker, node);
+        ++freed;
+    }
+
+    root->left = NULL;
+    root->right = NULL;
+
+    return freed;
+}
+
+/**
+ * Prune every maximal fully spent subtree beneath a node
+ * In sparse mode subtrees below the sparse height are left alone, since
+ * those are either collapsed already or still waiting to be collapsed
+ * @param acc Pointer to accumulator
+ * @param node Subtree root to scan
+ * @param start Position of the subtree's first leaf
+ * @return Number of nodes freed
+ */
+static size_t compact_subtree(MMRAccumulator *acc, MMRNode *node, uint64_t start)
+{
+    if (node->n_leaves < 2 || node_pruned(node)) return 0;
+    if (acc->sparse_height && node->n_leaves < (size_t) 1 << acc->sparse_height) return 0;
+
+    mmr_spent_lock(acc);
+    uint64_t spent = spent_count(acc->spent, start, node->n_leaves);
+    mmr_spent_unlock(acc);
+
+    if (spent == 0) return 0;
+    if (spent == node->n_leaves) return prune_subtree(&acc->tracker, node);
+    if (node_collapsed(node)) return 0;
+
+    return compact_subtree(acc, node->left, start) + compact_subtree(acc, node->right, start + node->left->n_leaves);
+}
+
+// ------------------------ MMR ACCUMULATOR ---------------------------------
+
+/**
+ * Check that a tuning profile holds usable values
+ * @param t Profile to check
+ * @return true if every setting is within range
+ */
+static bool tuning_valid(const MMRTuning *t)
+{
+    return t->batch_chunk > 0 && t->batch_chunk <= MMR_MAX_BATCH_CHUNK && t->threads > 0 &&
+           t->threads != MMR_THREADS_AUTO && t->parallel_min > 0;
+}
+
+/**
+ * Side index of user keys, such as timestamps or block heights, to leaf positions
+ * Both arrays are non-decreasing; mark i covers the leaves from starts[i]
+ * up to the next mark's start, or to the newest leaf for the last mark
+ */
+struct MMRTimes
+{
+    uint64_t *keys;
+    uint64_t *starts;
+    size_t count;
+    size_t capacity;
+};
+
+/**
+ * Free a time index
+ * @param times Index to free (may be NULL)
+ */
+static void times_free(struct MMRTimes *times)
+{
+    if (!times) return;
+
+    free(times->keys);
+    free(times->starts);
+    free(times);
+}
+
+/**
+ * Make room for a number of marks in a time index
+ * @param times Index to grow
+ * @param count Number of marks it must be able to hold
+ * @return true on success, false on allocation failure
+ */
+static bool times_reserve(struct MMRTimes *times, size_t count)
+{
+    if (count <= times->capacity) return true;
+
+    size_t capacity = times->capacity ? times->capacity : TRACKER_MIN_CAPACITY;
+    while (capacity < count) capacity *= 2;
+
+    uint64_t *keys = realloc(times->keys, capacity * sizeof(uint64_t));
+    if (!keys) return false;
+    times->keys = keys;
+
+    uint64_t *starts = realloc(times->starts, capacity * sizeof(uint64_t));
+    if (!starts) return false;
+    times->starts = starts;
+
+    times->capacity = capacity;
+    return true;
+}
+
+/**
+ * Initialize an empty MMR accumulator
+ * Sets up the root list and internal node tracker
+ * @param acc Pointer to accumulator to initialize
+ */
+void mmr_init(MMRAccumulator *acc)
+{
+    mmr_init_config(acc, NULL);
+}
+
+/**
+ * Initialize an empty MMR accumulator with optional behaviour
+ * Sets up the root list, internal node tracker and any requested locks
+ * @param acc Pointer to accumulator to initialize
+ * @param cfg Configuration to apply, or NULL for defaults
+ * @return true on success, false if the requested configuration could not be set up
+ */
+bool mmr_init_config(MMRAccumulator *acc, const MMRConfig *cfg)
+{
+    if (!acc) return false;
+
+    if (cfg && cfg->sparse_height > MMR_MAX_SPARSE_HEIGHT) return false;
+    if (cfg && !hash_supported(cfg->hash_backend)) return false;
+    if (cfg && cfg->tuning && !tuning_valid(cfg->tuning)) return false;
+
+    acc->head = NULL;
+    acc->sync = NULL;
+    acc->spent = NULL;
+    acc->compactor = NULL;
+    acc->warmer = NULL;
+    acc->times = NULL;
+    acc->sparse_height = cfg && cfg->sparse_height > 1 ? cfg->sparse_height : 0;
+    acc->perf_counters = cfg && cfg->perf_counters;
+    acc->hash_backend = cfg ? cfg->hash_backend : MMR_HASH_SHA256;
+
+    if (cfg && cfg->tuning)
+    {
+        acc->tuning = *cfg->tuning;
+    }
+    else
+    {
+        mmr_tuning_default(&acc->tuning);
+    }
+
+    mmr_tr_init(&acc->tracker);
+
+    // Counters are optional - operations skip them if this fails
+    acc->stats = calloc(1, sizeof(MMRStats));
+
+    if (cfg && cfg->tombstones)
+    {
+        acc->spent = calloc(1, sizeof(struct MMRSpent));
+        if (!acc->spent)
+        {
+            mmr_destroy(acc);
+            return false;
+        }
+    }
+
+    if (cfg && cfg->time_index)
+    {
+        acc->times = calloc(1, sizeof(struct MMRTimes));
+        if (!acc->times)
+        {
+            mmr_destroy(acc);
+            return false;
+        }
+    }
+
+    if (cfg && cfg->concurrent)
+    {
+        acc->sync = mmr_sync_create();
+        if (!acc->sync)
+        {
+            mmr_destroy(acc);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Destroy MMR accumulator and free all memory
+ * Cleans up all nodes, witnesses, and internal data structures
+ * MEMORY OWNERSHIP: This function frees ALL memory associated with the accumulator
+ * including all MMR nodes, witnesses, and tracker data - no manual cleanup required
+ * @param acc Pointer to accumulator to destroy
+ */
+void mmr_destroy(MMRAccumulator *acc)
+{
+    if (!acc) return;
+
+    mmr_compact_stop(acc);
+    mmr_warm_stop(acc, false);
+
+    acc->head = NULL;
+    mmr_tr_destroy(&acc->tracker);
+
+    free(acc->stats);
+    acc->stats = NULL;
+
+    spent_free(acc->spent);
+    acc->spent = NULL;
+
+    times_free(acc->times);
+    acc->times = NULL;
+
+    mmr_sync_destroy(acc->sync);
+    acc->sync = NULL;
+}
+
+/**
+ * State detached from an accumulator by mmr_destroy_deferred
+ */
+typedef struct
+{
+    MMRTracker tracker;
+    MMRStats *stats;
+    struct MMRSpent *spent;
+    struct MMRTimes *times;
+} MMRGarbage;
+
+/**
+ * Background teardown of a detached accumulator
+ * Frees items in bounded steps and yields in between so the thread
+ * never holds the allocator or a core for long stretches
+ * @param arg Pointer to the MMRGarbage to free
+ * @return Always NULL
+ */
+static void *deferred_destroy_worker(void *arg)
+{
+    MMRGarbage *garbage = arg;
+
+    size_t bucket = 0;
+    while (!mmr_tr_free_step(&garbage->tracker, &bucket, DESTROY_STEP_ITEMS))
+    {
+        sched_yield();
+    }
+
+    mmr_tr_destroy(&garbage->tracker);
+    spent_free(garbage->spent);
+    times_free(garbage->times);
+    free(garbage->stats);
+    free(garbage);
+
+    return NULL;
+}
+
+/**
+ * Destroy MMR accumulator on a background thread
+ * Detaches all nodes, witnesses and tracker data from the accumulator
+ * immediately and frees them incrementally on a detached thread
+ * @param acc Pointer to accumulator to destroy
+ * @return true if teardown was deferred, false if it had to run synchronously
+ */
+bool mmr_destroy_deferred(MMRAccumulator *acc)
+{
+    if (!acc) return false;
+
+    mmr_compact_stop(acc);
+    mmr_warm_stop(acc, false);
+
+    MMRGarbage *garbage = malloc(sizeof(MMRGarbage));
+    if (!garbage)
+    {
+        mmr_destroy(acc);
+        return false;
+    }
+
+    garbage->tracker = acc->tracker;
+    garbage->stats = acc->stats;
+    garbage->spent = acc->spent;
+    garbage->times = acc->times;
+
+    // The locks have no users left and are cheap to release here
+    mmr_sync_destroy(acc->sync);
+
+    acc->head = NULL;
+    acc->stats = NULL;
+    acc->spent = NULL;
+    acc->times = NULL;
+    acc->sync = NULL;
+    memset(&acc->tracker, 0, sizeof(MMRTracker));
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    pthread_t thread;
+    bool deferred = pthread_create(&thread, &attr, deferred_destroy_worker, garbage) == 0;
+    pthread_attr_destroy(&attr);
+
+    if (!deferred) deferred_destroy_worker(garbage);
+
+    return deferred;
+}
+
+/**
+ * Append a tracked subtree as the newest part of the accumulator
+ * Merges it with existing roots of the same size, exactly as appending its
+ * leaves one at a time would, so the leaf count must be a multiple of its size
+ * @param acc Pointer to accumulator (caller holds the locks for every merged height)
+ * @param node Root of a complete subtree owned by the accumulator's tracker
+ * @return true on success, false on failure
+ */
+static bool append_node(MMRAccumulator *acc, MMRNode *node)
+{
+    MMRNode **cur = &acc->head;
+
+    // Merge with existing roots of same size
+    while (*cur && (*cur)->n_leaves == node->n_leaves)
+    {
+        MMRNode *next = (*cur)->next;
+        MMRNode *parent;
+        if (!merge_nodes(&acc->tracker, acc->hash_backend, *cur, node, &parent))
+        {
+            return false;
+        }
+
+        // Sparse storage keeps only the top and bottom of each completed subtree
+        if (acc->sparse_height && parent->n_leaves == (size_t) 1 << acc->sparse_height)
+        {
+            collapse_subtree(&acc->tracker, parent);
+        }
+
+        node = parent;
+        *cur = next;
+    }
+
+    node->next = *cur;
+    *cur = node;
+
+    return true;
+}
+
+/**
+ * Append a leaf for an already hashed element without taking any locks
+ * Creates a leaf node and merges it with existing roots of the same size
+ * @param acc Pointer to accumulator (caller holds the locks from mmr_lock_append)
+ * @param hash Hash of the element to add
+ * @param leaf Optional output for the new leaf node
+ * @return true on success, false on failure
+ */
+static bool append_leaf(MMRAccumulator *acc, const bytes32 *hash, MMRNode **leaf)
+{
+    MMRNode *node;
+    if (!create_leaf(&acc->tracker, hash, &node))
+    {
+        return false;
+    }
+
+    if (leaf) *leaf = node;
+
+    if (!append_node(acc, node)) return false;
+
+    MMR_STAT_INC(acc, adds);
+
+    return true;
+}
+
+/**
+ * Append a chunk of already hashed elements
+ * @param acc Pointer to accumulator (caller holds the writer mutex)
+ * @param hashes Leaf hashes to append, in order
+ * @param len Number of hashes
+ * @param leaves Optional output array of len new leaf nodes
+ * @return true on success, false on failure
+ */
+static bool append_chunk(MMRAccumulator *acc, const bytes32 *hashes, size_t len, MMRNode **leaves)
+{
+    // Each leaf adds at most two nodes to the tracker on average
+    mmr_lock_tracker(acc, true);
+    bool ok = mmr_tr_reserve(&acc->tracker, len * 2);
+    mmr_unlock_tracker(acc);
+
+    // Lock per leaf so readers of untouched mountains keep running
+    for (size_t i = 0; ok && i < len; ++i)
+    {
+        unsigned height = mmr_lock_append(acc);
+        ok = append_leaf(acc, &hashes[i], leaves ? &leaves[i] : NULL);
+        mmr_unlock_append(acc, height);
+    }
+
+    return ok;
+}
+
+/**
+ * Count the leaves of the accumulator by summing its peaks
+ * @param acc Pointer to accumulator (caller holds the writer mutex)
+ * @return Number of leaves added so far
+ */
+static size_t leaf_count(const MMRAccumulator *acc)
+{
+    size_t count = 0;
+    for (const MMRNode *cur = acc->head; cur; cur = cur->next)
+    {
+        count += cur->n_leaves;
+    }
+
+    return count;
+}
+
+/**
+ * Total witness length of the last count leaves of an accumulator
+ * Each leaf's witness is as long as the height of the mountain it ends up in
+ * @param before Number of leaves before the batch
+ * @param count Number of leaves in the batch
+ * @return Number of sibling hashes needed for all of the batch's witnesses
+ */
+static size_t batch_witness_siblings(size_t before, size_t count)
+{
+    size_t total = before + count;
+    size_t start = 0;
+    size_t siblings = 0;
+
+    // Mountains run from the largest on the left to the smallest on the right
+    for (int h = (int) (sizeof(size_t) * 8) - 1; h >= 0; --h)
+    {
+        size_t size = (size_t) 1 << h;
+        if (!(total & size)) continue;
+
+        size_t lo = start > before ? start : before;
+        size_t hi = start + size;
+        if (hi > lo) siblings += (hi - lo) * (size_t) h;
+
+        start = hi;
+    }
+
+    return siblings;
+}
+
+/**
+ * Add element to MMR accumulator
+ * Creates a leaf node and merges it with existing roots of the same size
+ * @param acc Pointer to accumulator
+ * @param e Element data to add
+ * @param n Size of element data in bytes
+ * @return true on success, false on failure
+ */
+bool mmr_add(MMRAccumulator *acc, const uint8_t *e, size_t n)
+{
+    return mmr_add_tagged(acc, NULL, e, n);
+}
+
+/**
+ * Add element to MMR accumulator under a registered hash prefix
+ * @param acc Pointer to accumulator
+ * @param prefix Prefix midstate to hash the element under, or NULL for none
+ * @param e Element data to add
+ * @param n Size of element data in bytes
+ * @return true on success, false on failure
+ */
+bool mmr_add_tagged(MMRAccumulator *acc, const MMRPrefix *prefix, const uint8_t *e, size_t n)
+{
+    if (!acc || !e || n < 1) return false;
+
+    PerfSample sample;
+    perf_begin(acc, &sample);
+
+    bytes32 hash;
+    bool ok = leaf_hash(acc->hash_backend, prefix, e, n, &hash);
+
+    if (ok)
+    {
+        mmr_write_begin(acc);
+
+        unsigned height = mmr_lock_append(acc);
+        ok = append_leaf(acc, &hash, NULL);
+        mmr_unlock_append(acc, height);
+
+        mmr_write_end(acc);
+    }
+
+    perf_end(acc, MMR_OP_ADD, &sample, 1);
+
+    return ok;
+}
+
+/**
+ * Add a batch of elements to MMR accumulator
+ * Hashes the elements a chunk at a time outside any lock, then appends the
+ * chunk with the tracker pre-sized for it
+ * @param acc Pointer to accumulator
+ * @param elems Elements to add, in order
+ * @param count Number of elements
+ * @return true on success, false on failure or invalid parameters
+ */
+bool mmr_add_batch(MMRAccumulator *acc, const MMRElement *elems, size_t count)
+{
+    return mmr_add_batch_tagged(acc, NULL, elems, count);
+}
+
+/**
+ * Add a batch of elements to MMR accumulator under a registered hash prefix
+ * @param acc Pointer to accumulator
+ * @param prefix Prefix midstate to hash the elements under, or NULL for none
+ * @param elems Elements to add, in order
+ * @param count Number of elements
+ * @return true on success, false on failure or invalid parameters
+ */
+bool mmr_add_batch_tagged(MMRAccumulator *acc, const MMRPrefix *prefix, const MMRElement *elems, size_t count)
+{
+    if (!acc || (!elems && count > 0) || !prefix_supported(acc, prefix)) return false;
+
+    // Reject the whole batch up front rather than adding part of it
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (!elems[i].data || elems[i].n < 1) return false;
+    }
+
+    bytes32 hashes[MMR_MAX_BATCH_CHUNK];
+    size_t chunk = acc->tuning.batch_chunk;
+
+    for (size_t done = 0; done < count;)
+    {
+        size_t len = count - done < chunk ? count - done : chunk;
+
+        PerfSample sample;
+        perf_begin(acc, &sample);
+
+        leaf_hash_batch(acc->hash_backend, prefix, elems + done, len, hashes);
+
+        mmr_write_begin(acc);
+        bool ok = append_chunk(acc, hashes, len, NULL);
+        mmr_write_end(acc);
+
+        perf_end(acc, MMR_OP_ADD, &sample, len);
+
+        if (!ok) return false;
+        done += len;
+    }
+
+    return true;
+}
+
+/**
+ * Get the number of sibling hashes mmr_add_batch_witness needs for a batch
+ * @param acc Pointer to accumulator
+ * @param count Number of elements that will be added
+ * @return Required sibling capacity
+ */
+size_t mmr_add_batch_witness_size(const MMRAccumulator *acc, size_t count)
+{
+    if (!acc) return 0;
+
+    mmr_write_begin(acc);
+    size_t siblings = batch_witness_siblings(leaf_count(acc), count);
+    mmr_write_end(acc);
+
+    return siblings;
+}
+
+/**
+ * Add a batch of elements and write witnesses for all of them
+ * Leaf nodes are recorded while appending and their paths are read straight
+ * off the freshly merged tree, so no element is hashed twice and the witness
+ * cache is left alone. The writer mutex is held for the whole batch so the
+ * witnesses all describe the state right after it
+ * @param acc Pointer to accumulator
+ * @param prefix Prefix midstate to hash the elements under, or NULL for none
+ * @param elems Elements to add, in order
+ * @param count Number of elements
+ * @param witnesses Output array of count witnesses
+ * @param siblings Output storage the witnesses' siblings are packed into
+ * @param cap Capacity of siblings in hashes
+ * @return true on success, false on failure, invalid parameters or too small a buffer
+ */
+bool mmr_add_batch_witness(MMRAccumulator *acc, const MMRPrefix *prefix, const MMRElement *elems, size_t count,
+                           MMRWitness *witnesses, bytes32 *siblings, size_t cap)
+{
+    if (!acc || (!elems && count > 0) || (!witnesses && count > 0)) return false;
+    if (!prefix_supported(acc, prefix)) return false;
+
+    // Reject the whole batch up front rather than adding part of it
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (!elems[i].data || elems[i].n < 1) return false;
+    }
+
+    if (count == 0) return true;
+
+    MMRNode **leaves = malloc(count * sizeof(MMRNode *));
+    bytes32 *hashes = malloc(count * sizeof(bytes32));
+    if (!leaves || !hashes)
+    {
+        free(leaves);
+        free(hashes);
+        return false;
+    }
+
+    PerfSample sample;
+    perf_begin(acc, &sample);
+
+    // Hash before taking the writer mutex, which the batch then holds only
+    // long enough to append contiguously and read the paths off the tree
+    size_t chunk = acc->tuning.batch_chunk;
+    for (size_t done = 0; done < count; done += chunk)
+    {
+        size_t len = count - done < chunk ? count - done : chunk;
+        leaf_hash_batch(acc->hash_backend, prefix, elems + done, len, hashes + done);
+    }
+
+    mmr_write_begin(acc);
+
+    bool ok = batch_witness_siblings(leaf_count(acc), count) <= cap && (siblings || cap == 0);
+
+    for (size_t done = 0; ok && done < count; done += chunk)
+    {
+        size_t len = count - done < chunk ? count - done : chunk;
+        ok = append_chunk(acc, hashes + done, len, leaves + done);
+    }
+
+    // Only writers change the tree, so holding the writer mutex keeps it still
+    bytes32 *out = siblings;
+    for (size_t i = 0; ok && i < count; ++i)
+    {
+        MMRWitness *w = &witnesses[i];
+        MMRNode *root;
+
+        ok = collect_path(acc->hash_backend, leaves[i], out, &w->path, &w->n_siblings, &root);
+
+        memcpy(w->hash, leaves[i]->hash, sizeof(bytes32));
+        w->siblings = w->n_siblings > 0 ? out : NULL;
+        out += w->n_siblings;
+    }
+
+    mmr_write_end(acc);
+
+    perf_end(acc, MMR_OP_ADD, &sample, count);
+
+    free(hashes);
+    free(leaves);
+
+    return ok;
+}
+
+/**
+ * Fold a witness into the hash of every node on its path
+ * @param backend Hash backend the witness was built with
+ * @param w Witness to fold (already validated)
+ * @param levels Output array of n_siblings + 1 hashes, levels[0] is the leaf
+ * @return true on success, false if hashing fails
+ */
+static bool fold_witness(MMRHashBackend backend, const MMRWitness *w, bytes32 *levels)
+{
+    memcpy(levels[0], w->hash, sizeof(bytes32));
+
+    // Reconstruct the root hash by following the witness path
+    for (uint16_t i = 0; i < w->n_siblings; ++i)
+    {
+        // Extract the bit at position i to determine sibling order
+        int sibling_order = (w->path >> i) & 1;
+        if (sibling_order == MMR_SIBLING_RIGHT)
+        {
+            if (!node_hash(backend, &levels[i], &w->siblings[i], &levels[i + 1]))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            if (!node_hash(backend, &w->siblings[i], &levels[i], &levels[i + 1]))
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Verify witness against MMR accumulator
+ * All hashing happens before the tracker is locked, which is then held
+ * only for the root lookups
+ * @param acc Pointer to accumulator
+ * @param w Witness to verify
+ * @return true if proof is valid, false otherwise
+ */
+static bool verify_witness(const MMRAccumulator *acc, const MMRWitness *w)
+{
+    if (w->n_siblings > 0 && !w->siblings) return false;
+    if (w->n_siblings > WITNESS_MAX_SIBLINGS) return false;
+    if (w->path >= (1ULL << w->n_siblings)) return false;
+
+    MMR_STAT_INC(acc, verifies);
+
+    PerfSample sample;
+    perf_begin(acc, &sample);
+
+    bytes32 levels[WITNESS_MAX_SIBLINGS + 1];
+    bool ok = false;
+
+    if (fold_witness(acc->hash_backend, w, levels))
+    {
+        mmr_lock_tracker(acc, false);
+
+        PerfSample lookup;
+        perf_begin(acc, &lookup);
+
+        // Any node on the path may be a root, the leaf itself only without siblings
+        for (uint16_t i = w->n_siblings > 0 ? 1 : 0; !ok && i <= w->n_siblings; ++i)
+        {
+            ok = mmr_tr_has_root(acc, &levels[i]);
+        }
+
+        perf_end(acc, MMR_OP_TRACKER, &lookup, 1);
+
+        mmr_unlock_tracker(acc);
+    }
+
+    perf_end(acc, MMR_OP_VERIFY, &sample, 1);
+
+    return ok;
+}
+
+/**
+ * Verify witness against MMR accumulator
+ * Reconstructs the root hash from the witness path and checks if it matches
+ * any root in the accumulator's current state
+ * @param acc Pointer to accumulator
+ * @param w Witness to verify
+ * @return true if proof is valid, false otherwise
+ */
+bool mmr_verify(const MMRAccumulator *acc, const MMRWitness *w)
+{
+    if (!acc || !w) return false;
+
+    return verify_witness(acc, w);
+}
+
+/**
+ * Tombstone the leaf with the given hash
+ * @param acc Pointer to accumulator in tombstone mode
+ * @param hash Leaf hash
+ * @return true if the leaf was newly marked spent, false otherwise
+ */
+static bool spend_hash(MMRAccumulator *acc, const bytes32 *hash)
+{
+    MMRItem *item;
+    unsigned height;
+    if (!mmr_lock_leaf(acc, hash, &item, &height)) return false;
+
+    // Only leaves carry positions, interior nodes share the hash table
+    bool ok = item->node->n_leaves == 1;
+    if (ok)
+    {
+        uint64_t pos = leaf_position(item->node);
+
+        mmr_spent_lock(acc);
+        ok = spent_set(acc->spent, pos) == 1;
+        mmr_spent_unlock(acc);
+    }
+
+    mmr_unlock_leaf(acc, height);
+
+    return ok;
+}
+
+/**
+ * Remove element from MMR accumulator using witness
+ * Marks the leaf spent in the tombstone bitmap once the witness verifies,
+ * leaving the trees untouched until the compactor reclaims them
+ * @param acc Pointer to accumulator
+ * @param w Witness for element removal
+ * @return true on success, false on failure
+ */
+bool mmr_remove(MMRAccumulator *acc, const MMRWitness *w)
+{
+    if (!acc || !w || !acc->spent) return false;
+    if (!verify_witness(acc, w)) return false;
+
+    return spend_hash(acc, &w->hash);
+}
+
+/**
+ * Mark an element as spent without a witness
+ * @param acc Pointer to accumulator
+ * @param e Element data
+ * @param n Size of element data in bytes
+ * @return true if the element was newly marked spent, false otherwise
+ */
+bool mmr_spend(MMRAccumulator *acc, const uint8_t *e, size_t n)
+{
+    if (!acc || !e || n < 1 || !acc->spent) return false;
+
+    bytes32 hash;
+    if (!leaf_hash(acc->hash_backend, NULL, e, n, &hash)) return false;
+
+    return spend_hash(acc, &hash);
+}
+
+/**
+ * Count the leaves marked spent so far
+ * @param acc Pointer to accumulator
+ * @return Number of tombstoned leaves
+ */
+uint64_t mmr_spent_count(const MMRAccumulator *acc)
+{
+    if (!acc || !acc->spent) return 0;
+
+    mmr_spent_lock(acc);
+    uint64_t total = acc->spent->total;
+    mmr_spent_unlock(acc);
+
+    return total;
+}
+
+/**
+ * Count the leaves added so far
+ * @param acc Pointer to accumulator
+ * @return Number of leaves, spent or not
+ */
+uint64_t mmr_leaf_count(const MMRAccumulator *acc)
+{
+    if (!acc) return 0;
+
+    mmr_write_begin(acc);
+    uint64_t count = leaf_count(acc);
+    mmr_write_end(acc);
+
+    return count;
+}
+
+/**
+ * Reclaim the nodes of every fully spent subtree
+ * Mountains are compacted one at a time from the smallest, each under its
+ * own write lock, so readers of other mountains carry on meanwhile
+ * @param acc Pointer to accumulator
+ * @return Number of nodes freed
+ */
+size_t mmr_compact(MMRAccumulator *acc)
+{
+    if (!acc || !acc->spent) return 0;
+
+    // Adds are held off for the pass so the root list and positions stay put
+    mmr_write_begin(acc);
+
+    uint64_t end = leaf_count(acc);
+    size_t freed = 0;
+
+    for (MMRNode *root = acc->head; root; root = root->next)
+    {
+        uint64_t start = end - root->n_leaves;
+        unsigned height = mountain_height(root->n_leaves);
+
+        if (acc->sync) rwlock_acquire(acc, &acc->sync->mountains[height], true);
+        mmr_lock_tracker(acc, true);
+
+        freed += compact_subtree(acc, root, start);
+
+        mmr_unlock_tracker(acc);
+        if (acc->sync) pthread_rwlock_unlock(&acc->sync->mountains[height]);
+
+        end = start;
+    }
+
+    mmr_write_end(acc);
+
+    return freed;
+}
+
+/**
+ * State of a background compaction thread
+ */
+struct MMRCompactor
+{
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+
+    MMRAccumulator *acc;
+    unsigned interval_ms;
+    bool stop;
+};
+
+/**
+ * Background compaction loop
+ * Sleeps for the interval, then runs a compaction pass, until stopped
+ * @param arg The compactor
+ * @return NULL
+ */
+static void *compactor_worker(void *arg)
+{
+    struct MMRCompactor *compactor = arg;
+
+    pthread_mutex_lock(&compactor->lock);
+
+    while (!compactor->stop)
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += compactor->interval_ms / 1000;
+        deadline.tv_nsec += (long) (compactor->interval_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec += 1;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        while (!compactor->stop && pthread_cond_timedwait(&compactor->wake, &compactor->lock, &deadline) != ETIMEDOUT)
+        {
+        }
+
+        if (compactor->stop) break;
+
+        pthread_mutex_unlock(&compactor->lock);
+        mmr_compact(compactor->acc);
+        pthread_mutex_lock(&compactor->lock);
+    }
+
+    pthread_mutex_unlock(&compactor->lock);
+
+    return NULL;
+}
+
+/**
+ * Start compacting spent subtrees periodically on a background thread
+ * @param acc Pointer to a concurrent accumulator in tombstone mode
+ * @param interval_ms Time between compaction passes in milliseconds
+ * @return true if the thread was started, false otherwise
+ */
+bool mmr_compact_start(MMRAccumulator *acc, unsigned interval_ms)
+{
+    if (!acc || !acc->spent || !acc->sync || acc->compactor || interval_ms == 0) return false;
+
+    struct MMRCompactor *compactor = calloc(1, sizeof(struct MMRCompactor));
+    if (!compactor) return false;
+
+    compactor->acc = acc;
+    compactor->interval_ms = interval_ms;
+    pthread_mutex_init(&compactor->lock, NULL);
+    pthread_cond_init(&compactor->wake, NULL);
+
+    if (pthread_create(&compactor->thread, NULL, compactor_worker, compactor) != 0)
+    {
+        pthread_cond_destroy(&compactor->wake);
+        pthread_mutex_destroy(&compactor->lock);
+        free(compactor);
+        return false;
+    }
+
+    acc->compactor = compactor;
+
+    return true;
+}
+
+/**
+ * Stop the background compaction thread, waiting for a running pass to finish
+ * @param acc Pointer to accumulator
+ */
+void mmr_compact_stop(MMRAccumulator *acc)
+{
+    if (!acc || !acc->compactor) return;
+
+    struct MMRCompactor *compactor = acc->compactor;
+
+    pthread_mutex_lock(&compactor->lock);
+    compactor->stop = true;
+    pthread_cond_signal(&compactor->wake);
+    pthread_mutex_unlock(&compactor->lock);
+
+    pthread_join(compactor->thread, NULL);
+
+    pthread_cond_destroy(&compactor->wake);
+    pthread_mutex_destroy(&compactor->lock);
+    free(compactor);
+
+    acc->compactor = NULL;
+}
+
+/**
+ * Batch verification request ordering entry
+ * Requests are sorted by target so runs against one accumulator stay together
+ */
+typedef struct
+{
+    uintptr_t acc;
+    size_t index;
+} VerifyOrder;
+
+typedef struct
+{
+    const MMRVerifyRequest *reqs;
+    const VerifyOrder *order;
+    bool *results;
+    size_t valid;
+} VerifyBatch;
+
+static int verify_order_cmp(const void *a, const void *b)
+{
+    const VerifyOrder *x = a;
+    const VerifyOrder *y = b;
+
+    if (x->acc != y->acc) return x->acc < y->acc ? -1 : 1;
+    if (x->index != y->index) return x->index < y->index ? -1 : 1;
+
+    return 0;
+}
+
+/**
+ * Verify a range of sorted batch requests
+ * Requests against the same target are adjacent, but each one takes the
+ * target's tracker read lock for its own root lookup, as mmr_verify() does
+ * @param ctx Pointer to the VerifyBatch being processed
+ * @param begin First position in the sorted order to verify
+ * @param end One past the last position to verify
+ */
+static void verify_batch_range(void *ctx, size_t begin, size_t end)
+{
+    VerifyBatch *batch = ctx;
+    size_t valid = 0;
+
+    for (size_t i = begin; i < end; ++i)
+    {
+        const MMRAccumulator *acc = (const MMRAccumulator *) batch->order[i].acc;
+        const MMRWitness *w = batch->reqs[batch->order[i].index].witness;
+
+        bool ok = acc && w && verify_witness(acc, w);
+        if (batch->results) batch->results[batch->order[i].index] = ok;
+        if (ok) ++valid;
+    }
+
+    __atomic_fetch_add(&batch->valid, valid, __ATOMIC_RELAXED);
+}
+
+/**
+ * Check whether an item's cached witness still ends at a current root
+ * Caller must hold the lock on the leaf's mountain (see mmr_lock_leaf)
+ * @param item Tracker item of the leaf
+ * @return true if the cached witness can be handed out unchanged
+ */
+static inline bool witness_cached(const MMRItem *item)
+{
+    return item->witness_root && item->witness_root->parent == NULL;
+}
+
+/**
+ * Create witness for a tracked leaf, re-using its cached witness when valid
+ * Cache entries are guarded since other readers of the mountain may race on them
+ * Spent leaves are refused before the cache is even looked at
+ * @param acc Pointer to accumulator (caller holds the leaf's mountain lock)
+ * @param w Witness structure to populate with proof data (siblings owned by tracker)
+ * @param item Tracker item of the leaf
+ * @return true on success, false on failure
+ */
+static bool witness_for_item(const MMRAccumulator *acc, MMRWitness *w, MMRItem *item)
+{
+    // Tombstoned leaves no longer get proofs
+    if (leaf_spent(acc, item->node)) return false;
+
+    // Cache and re-use unchanged witnesses
+    mmr_cache_lock(acc);
+
+    bool cached = witness_cached(item);
+    bool stale = !cached && item->witness_root;
+    if (cached) *w = item->witness;
+
+    mmr_cache_unlock(acc);
+
+    if (cached)
+    {
+        MMR_STAT_INC(acc, witness_hits);
+        return true;
+    }
+
+    MMR_STAT_INC(acc, witness_misses);
+    if (stale) MMR_STAT_INC(acc, witness_stale);
+
+    MMRNode *node = item->node;
+
+    memset(w, 0, sizeof(MMRWitness));
+
+    uint64_t path = 0;
+    uint16_t level = 0;
+
+    // Allocate maximum possible space for sibling hashes
+    bytes32 *siblings = calloc(WITNESS_MAX_SIBLINGS, sizeof(bytes32));
+    if (!siblings) return false;
+
+    if (!collect_path(acc->hash_backend, node, siblings, &path, &level, &node))
+    {
+        free(siblings);
+        return false;
+    }
+
+    memcpy(w->hash, item->node->hash, sizeof(bytes32));
+    w->n_siblings = level;
+    w->path = path;
+
+    // Check if this is a leaf level proof
+    if (level == 0)
+    {
+        free(siblings);
+        siblings = NULL;
+    }
+    else
+    {
+        // Shrink the array down if possible to save some memory
+        bytes32 *shrink = realloc(siblings, level * sizeof(bytes32));
+        if (shrink)
+        {
+            siblings = shrink;
+        }
+    }
+
+    w->siblings = siblings;
+
+    mmr_cache_lock(acc);
+
+    if (witness_cached(item))
+    {
+        // Another reader filled the cache while we were walking the
+        // tree, hand out its copy so earlier callers keep a live array
+        free(siblings);
+        *w = item->witness;
+    }
+    else
+    {
+        // If we've previously calculated a witness
+        // for this node, we need to manually free it,
+        // otherwise it'll be overwritten and go untracked
+        if (item->witness.siblings)
+        {
+            free(item->witness.siblings);
+            item->witness.siblings = NULL;
+        }
+
+        // Any pre-encoded copy belongs to the replaced witness
+        free(item->encoded);
+        item->encoded = NULL;
+        item->encoded_len = 0;
+
+        item->witness = *w;
+        item->witness_root = node;
+    }
+
+    mmr_cache_unlock(acc);
+
+    return true;
+}
+
+/**
+ * Create witness for a leaf hash, locking only the mountain that contains it
+ * @param acc Pointer to accumulator
+ * @param w Witness structure to populate with proof data
+ * @param hash Leaf hash to create witness for
+ * @param copy Optional caller array of WITNESS_MAX_SIBLINGS hashes; when given
+ *             the siblings are copied there before the mountain is released
+ * @return true on success, false on failure
+ */
+static bool witness_for_hash(const MMRAccumulator *acc, MMRWitness *w, const bytes32 *hash, bytes32 *copy)
+{
+    MMRItem *item;
+    unsigned height;
+    if (!mmr_lock_leaf(acc, hash, &item, &height)) return false;
+
+    bool ok = witness_for_item(acc, w, item);
+
+    // The cached array cannot be replaced while its mountain is pinned
+    if (ok && copy)
+    {
+        if (w->n_siblings > 0) memcpy(copy, w->siblings, w->n_siblings * sizeof(bytes32));
+        w->siblings = copy;
+    }
+
+    mmr_unlock_leaf(acc, height);
+
+    return ok;
+}
+
+/**
+ * Create witness for element
+ * @param acc Pointer to accumulator
+ * @param w Witness structure to populate with proof data (siblings owned by tracker)
+ * @param e Element to create witness for
+ * @param n Size of element in bytes
+ * @return true on success, false on failure
+ */
+static bool create_witness(const MMRAccumulator *acc, MMRWitness *w, const uint8_t *e, size_t n)
+{
+    bytes32 hash;
+    if (!leaf_hash(acc->hash_backend, NULL, e, n, &hash)) return false;
+
+    return witness_for_hash(acc, w, &hash, NULL);
+}
+
+/**
+ * Verify many witnesses against one or more accumulators in a single call
+ * Groups requests by target accumulator and spreads the work over threads
+ * @param reqs Array of (accumulator, witness) pairs to verify
+ * @param n Number of requests
+ * @param results Optional output array of n flags, one per request
+ * @param n_threads Maximum number of threads to use (0 or 1 verifies inline, MMR_THREADS_AUTO as tuned,
+ *                  taking the fewest threads any target's tuning allows)
+ * @return Number of requests whose witness verified
+ */
+size_t mmr_verify_batch(const MMRVerifyRequest *reqs, size_t n, bool *results, unsigned n_threads)
+{
+    if (!reqs || n < 1) return 0;
+
+    VerifyOrder *order = malloc(n * sizeof(VerifyOrder));
+    if (!order) return 0;
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        order[i].acc = (uintptr_t) reqs[i].acc;
+        order[i].index = i;
+    }
+
+    qsort(order, n, sizeof(VerifyOrder), verify_order_cmp);
+
+    // Targets may be tuned differently, so follow the most conservative of them
+    unsigned threads = tuned_threads(reqs[order[0].index].acc, n, n_threads);
+    for (size_t i = 1; i < n; ++i)
+    {
+        if (order[i].acc == order[i - 1].acc) continue;
+
+        unsigned t = tuned_threads(reqs[order[i].index].acc, n, n_threads);
+        if (t < threads) threads = t;
+    }
+
+    VerifyBatch batch = {.reqs = reqs, .order = order, .results = results, .valid = 0};
+    parallel_for(n, threads, verify_batch_range, &batch);
+
+    free(order);
+
+    return batch.valid;
+}
+
+/**
+ * Shared state of a block being applied
+ * Inputs and outputs share one index space, inputs first, so a single
+ * parallel pass verifies the one and hashes the other
+ */
+typedef struct
+{
+    const MMRAccumulator *acc;
+    const MMRWitness *inputs;
+    size_t n_inputs;
+
+    const MMRPrefix *prefix;
+    const MMRElement *outputs;
+    bytes32 *hashes;
+
+    bool *results;
+    bool failed;
+} BlockApply;
+
+/**
+ * Verify the inputs and hash the outputs of one range of a block
+ * Once any input has failed the rest of the work is skipped, unless the
+ * caller asked for a result per input
+ * @param ctx Pointer to the BlockApply being processed
+ * @param begin First index to process
+ * @param end One past the last index to process
+ */
+static void apply_block_range(void *ctx, size_t begin, size_t end)
+{
+    BlockApply *block = ctx;
+    size_t split = end < block->n_inputs ? end : block->n_inputs;
+
+    for (size_t i = begin; i < split; ++i)
+    {
+        if (!block->results && __atomic_load_n(&block->failed, __ATOMIC_RELAXED)) return;
+
+        bool ok = verify_witness(block->acc, &block->inputs[i]);
+        if (block->results) block->results[i] = ok;
+        if (!ok) __atomic_store_n(&block->failed, true, __ATOMIC_RELAXED);
+    }
+
+    if (split < begin) split = begin;
+    if (split >= end || __atomic_load_n(&block->failed, __ATOMIC_RELAXED)) return;
+
+    size_t first = split - block->n_inputs;
+    leaf_hash_batch(block->acc->hash_backend, block->prefix, block->outputs + first, end - split,
+                    block->hashes + first);
+}
+
+/**
+ * Build the outputs of a block into complete subtrees of a private accumulator
+ * The outputs are cut into power-of-two runs aligned to the positions they
+ * will take, each built from an empty root list, so grafting the run peaks in
+ * order merges exactly as appending the leaves one at a time would
+ * @param part Empty private accumulator configured like the target, left owning the built nodes
+ * @param hashes Leaf hashes of the outputs, in order
+ * @param n Number of outputs
+ * @param before Leaf count of the target before the block
+ * @param peaks Output run peaks, oldest first
+ * @param n_peaks Output number of run peaks
+ * @return true on success, false on allocation failure
+ */
+static bool apply_block_build(MMRAccumulator *part, const bytes32 *hashes, size_t n, uint64_t before,
+                              MMRNode **peaks, unsigned *n_peaks)
+{
+    uint64_t pos = before;
+    for (size_t done = 0; done < n;)
+    {
+        // The largest run that starts at pos, no longer than what is left
+        uint64_t size = pos ? pos & (~pos + 1) : UINT64_C(1) << 63;
+        while (size > n - done) size >>= 1;
+
+        if (!append_chunk(part, hashes + done, (size_t) size, NULL)) return false;
+
+        peaks[(*n_peaks)++] = part->head;
+        part->head = NULL;
+
+        pos += size;
+        done += (size_t) size;
+    }
+
+    return true;
+}
+
+/**
+ * Verify a block's inputs and add its outputs as one operation
+ * The writer mutex is held throughout, so every input is checked against the
+ * peaks from before the block. The outputs are then built into subtrees of
+ * their own and grafted with every mountain they merge and the tracker write
+ * locked at once, so readers see either the peaks from before the block or
+ * those after it, and wait only for the graft
+ * @param acc Pointer to accumulator
+ * @param prefix Prefix to hash the outputs under, or NULL for none
+ * @param inputs Witnesses of the elements the block spends
+ * @param n_inputs Number of inputs
+ * @param outputs Elements the block creates, in order
+ * @param n_outputs Number of outputs
+ * @param results Optional output array of n_inputs flags, true where the input verified
+ * @param n_threads Maximum number of threads to use (0 or 1 works on the calling thread,
+ *                  MMR_THREADS_AUTO as tuned)
+ * @return true if every input verified and every output was added, false otherwise
+ */
+bool mmr_apply_block(MMRAccumulator *acc, const MMRPrefix *prefix, const MMRWitness *inputs, size_t n_inputs,
+                     const MMRElement *outputs, size_t n_outputs, bool *results, unsigned n_threads)
+{
+    if (!acc || (!inputs && n_inputs > 0) || (!outputs && n_outputs > 0)) return false;
+    if (!prefix_supported(acc, prefix)) return false;
+
+    for (size_t i = 0; i < n_outputs; ++i)
+    {
+        if (!outputs[i].data || outputs[i].n < 1) return false;
+    }
+
+    BlockApply block = {.acc = acc, .inputs = inputs, .n_inputs = n_inputs, .prefix = prefix, .outputs = outputs};
+    block.results = results;
+    block.hashes = malloc((n_outputs ? n_outputs : 1) * sizeof(bytes32));
+    if (!block.hashes) return false;
+
+    mmr_write_begin(acc);
+
+    size_t n_items = n_inputs + n_outputs;
+    parallel_for(n_items, tuned_threads(acc, n_items, n_threads), apply_block_range, &block);
+
+    bool ok = !__atomic_load_n(&block.failed, __ATOMIC_RELAXED);
+
+    if (ok && n_outputs > 0)
+    {
+        PerfSample sample;
+        perf_begin(acc, &sample);
+
+        // Build the outputs off to the side, so readers are only held off for the graft
+        uint64_t before = leaf_count(acc);
+        MMRConfig cfg = {.sparse_height = acc->sparse_height, .hash_backend = acc->hash_backend};
+        MMRAccumulator part;
+        MMRNode *peaks[MMR_MAX_HEIGHT];
+        unsigned n_peaks = 0;
+
+        bool built = mmr_init_config(&part, &cfg);
+        ok = built && apply_block_build(&part, block.hashes, n_outputs, before, peaks, &n_peaks);
+
+        if (ok)
+        {
+            // The merges touch exactly the heights up to the highest bit the leaf count changes in
+            unsigned top = 63 - (unsigned) __builtin_clzll(before ^ (before + n_outputs));
+
+            if (acc->sync)
+            {
+                for (unsigned h = 0; h <= top; ++h) rwlock_acquire(acc, &acc->sync->mountains[h], true);
+            }
+
+            mmr_lock_tracker(acc, true);
+
+            ok = mmr_tr_reserve(&acc->tracker, part.tracker.count + MMR_MAX_HEIGHT) &&
+                 mmr_tr_absorb(&acc->tracker, &part.tracker);
+            for (unsigned i = 0; ok && i < n_peaks; ++i) ok = append_node(acc, peaks[i]);
+
+            mmr_unlock_tracker(acc);
+
+            if (acc->sync)
+            {
+                for (unsigned h = 0; h <= top; ++h) pthread_rwlock_unlock(&acc->sync->mountains[h]);
+            }
+        }
+
+        // Absorbed nodes now belong to acc, anything not absorbed goes with the part
+        if (built)
+        {
+            part.head = NULL;
+            mmr_destroy(&part);
+        }
+
+        if (ok) MMR_STAT_ADD(acc, adds, n_outputs);
+
+        perf_end(acc, MMR_OP_ADD, &sample, n_outputs);
+    }
+
+    mmr_write_end(acc);
+
+    free(block.hashes);
+
+    return ok;
+}
+
+/**
+ * Create witness for element in MMR accumulator
+ * Generates a Merkle proof that demonstrates the element is included
+ * in the accumulator by collecting sibling hashes along the path to root
+ * MEMORY OWNERSHIP: The witness siblings array is owned by the tracker after creation
+ * Caller receives populated witness struct but must NOT free w->siblings manually
+ * The siblings array will be freed automatically during mmr_destroy()
+ * @param acc Pointer to accumulator
+ * @param w Witness structure to populate with proof data (siblings owned by tracker)
+ * @param e Element to create witness for
+ * @param n Size of element in bytes
+ * @return true on success, false on failure
+ */
+bool mmr_witness(const MMRAccumulator *acc, MMRWitness *w, const uint8_t *e, size_t n)
+{
+    if (!acc || !w || !e || n < 1) return false;
+
+    PerfSample sample;
+    perf_begin(acc, &sample);
+
+    bool ok = create_witness(acc, w, e, n);
+
+    perf_end(acc, MMR_OP_WITNESS, &sample, 1);
+
+    return ok;
+}
+
+/**
+ * Create witness for an element that was added under a hash prefix
+ * @param acc Pointer to accumulator
+ * @param prefix Prefix midstate the element was added under, or NULL for none
+ * @param w Witness structure to populate with proof data (siblings owned by tracker)
+ * @param e Element to create witness for
+ * @param n Size of element in bytes
+ * @return true on success, false on failure
+ */
+bool mmr_witness_tagged(const MMRAccumulator *acc, const MMRPrefix *prefix, MMRWitness *w, const uint8_t *e,
+                        size_t n)
+{
+    if (!acc || !w || !e || n < 1) return false;
+
+    PerfSample sample;
+    perf_begin(acc, &sample);
+
+    bytes32 hash;
+    bool ok = leaf_hash(acc->hash_backend, prefix, e, n, &hash) && witness_for_hash(acc, w, &hash, NULL);
+
+    perf_end(acc, MMR_OP_WITNESS, &sample, 1);
+
+    return ok;
+}
+
+/**
+ * Create witness for element with siblings copied into caller storage
+ * The copy is taken while the leaf's mountain is pinned, so the result stays
+ * valid even if another thread replaces the cached witness straight afterwards
+ * @param acc Pointer to accumulator
+ * @param w Witness structure to populate, w->siblings will point at siblings
+ * @param siblings Caller owned array of at least WITNESS_MAX_SIBLINGS hashes
+ * @param e Element to create witness for
+ * @param n Size of element in bytes
+ * @return true on success, false on failure
+ */
+bool mmr_witness_into(const MMRAccumulator *acc, MMRWitness *w, bytes32 *siblings, const uint8_t *e, size_t n)
+{
+    if (!acc || !w || !siblings || !e || n < 1) return false;
+
+    PerfSample sample;
+    perf_begin(acc, &sample);
+
+    bytes32 hash;
+    bool ok = leaf_hash(acc->hash_backend, NULL, e, n, &hash) && witness_for_hash(acc, w, &hash, siblings);
+
+    perf_end(acc, MMR_OP_WITNESS, &sample, 1);
+
+    return ok;
+}
+
+/**
+ * Create witness for a leaf digest with siblings copied into caller storage
+ * Same as mmr_witness_into(), for leaves known only by the digest a scan yielded
+ * @param acc Pointer to accumulator
+ * @param w Witness structure to populate, w->siblings will point at siblings
+ * @param siblings Caller owned array of at least WITNESS_MAX_SIBLINGS hashes
+ * @param digest Leaf digest to create witness for
+ * @return true on success, false on failure
+ */
+bool mmr_witness_leaf_into(const MMRAccumulator *acc, MMRWitness *w, bytes32 *siblings, const bytes32 *digest)
+{
+    if (!acc || !w || !siblings || !digest) return false;
+
+    PerfSample sample;
+    perf_begin(acc, &sample);
+
+    bool ok = witness_for_hash(acc, w, digest, siblings);
+
+    perf_end(acc, MMR_OP_WITNESS, &sample, 1);
+
+    return ok;
+}
+
+/**
+ * Copy the pre-encoded proof for an element into caller storage
+ * The encoding is produced once per cached witness and kept on the tracker
+ * item, so repeated requests for an unchanged proof are a single copy
+ * @param acc Pointer to accumulator
+ * @param e Element to fetch the proof for
+ * @param n Size of element in bytes
+ * @param buf Output buffer for the encoded proof
+ * @param cap Capacity of the output buffer in bytes
+ * @param len Output for the encoded size (set even if cap is too small)
+ * @return true on success, false if the element is missing or the buffer too small
+ */
+bool mmr_witness_bytes(const MMRAccumulator *acc, const uint8_t *e, size_t n, uint8_t *buf, size_t cap, size_t *len)
+{
+    if (len) *len = 0;
+    if (!acc || !e || n < 1 || !buf) return false;
+
+    PerfSample sample;
+    perf_begin(acc, &sample);
+
+    bytes32 hash;
+    MMRItem *item;
+    unsigned height;
+    if (!leaf_hash(acc->hash_backend, NULL, e, n, &hash) || !mmr_lock_leaf(acc, &hash, &item, &height))
+    {
+        perf_end(acc, MMR_OP_WITNESS, &sample, 1);
+        return false;
+    }
+
+    MMRWitness w;
+    bool ok = witness_for_item(acc, &w, item);
+
+    if (ok)
+    {
+        mmr_cache_lock(acc);
+
+        if (!item->encoded)
+        {
+            size_t size = mmr_witness_encoded_size(&item->witness);
+            uint8_t *encoded = malloc(size);
+
+            if (encoded && mmr_witness_encode(&item->witness, encoded, size, NULL))
+            {
+                item->encoded = encoded;
+                item->encoded_len = size;
+            }
+            else
+            {
+                free(encoded);
+            }
+        }
+
+        if (item->encoded)
+        {
+            if (len) *len = item->encoded_len;
+            ok = cap >= item->encoded_len;
+            if (ok) memcpy(buf, item->encoded, item->encoded_len);
+        }
+        else
+        {
+            // Could not cache the encoding, encode directly instead
+            ok = mmr_witness_encode(&item->witness, buf, cap, len);
+        }
+
+        mmr_cache_unlock(acc);
+    }
+
+    mmr_unlock_leaf(acc, height);
+
+    perf_end(acc, MMR_OP_WITNESS, &sample, 1);
+
+    return ok;
+}
+
+/**
+ * Take a snapshot of the accumulator's operation counters
+ * @param acc Pointer to accumulator
+ * @param stats Output structure to populate
+ */
+void mmr_stats(const MMRAccumulator *acc, MMRStats *stats)
+{
+    if (!stats) return;
+
+    memset(stats, 0, sizeof(MMRStats));
+    if (!acc || !acc->stats) return;
+
+    // Counters may be updated concurrently, read each one atomically
+    const uint64_t *src = (const uint64_t *) acc->stats;
+    uint64_t *dst = (uint64_t *) stats;
+
+    for (size_t i = 0; i < sizeof(MMRStats) / sizeof(uint64_t); ++i)
+    {
+        dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * Reset all operation counters of the accumulator
+ * @param acc Pointer to accumulator
+ */
+void mmr_stats_reset(MMRAccumulator *acc)
+{
+    if (!acc || !acc->stats) return;
+
+    uint64_t *dst = (uint64_t *) acc->stats;
+
+    for (size_t i = 0; i < sizeof(MMRStats) / sizeof(uint64_t); ++i)
+    {
+        __atomic_store_n(&dst[i], 0, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * Write a per-operation report of latency and hardware counters
+ * @param stats Snapshot taken with mmr_stats()
+ * @param out Stream to write the report to
+ */
+void mmr_stats_print(const MMRStats *stats, FILE *out)
+{
+    static const char *ops[MMR_OPS] = {"add", "witness", "verify", "tracker"};
+    static const char *events[MMR_PERF_EVENTS] = {"cycles", "instr", "llc-miss", "dtlb-miss", "br-miss"};
+
+    if (!stats || !out) return;
+
+    fprintf(out, "%-8s %12s %10s", "op", "count", "ns/op");
+    for (int e = 0; e < MMR_PERF_EVENTS; ++e)
+    {
+        fprintf(out, " %10s", events[e]);
+    }
+    fputc('\n', out);
+
+    for (int op = 0; op < MMR_OPS; ++op)
+    {
+        const MMRPerfCounters *c = &stats->perf[op];
+        if (c->ops == 0) continue;
+
+        fprintf(out, "%-8s %12llu %10.1f", ops[op], (unsigned long long) c->ops, (double) c->ns / c->ops);
+        for (int e = 0; e < MMR_PERF_EVENTS; ++e)
+        {
+            if (stats->perf_events & (1ULL << e))
+            {
+                fprintf(out, " %10.1f", (double) c->events[e] / c->ops);
+            }
+            else
+            {
+                fprintf(out, " %10s", "-");
+            }
+        }
+        fputc('\n', out);
+    }
+}
+
+// ------------------------ MMR CACHE FILES ---------------------------------
+
+// Leading bytes of a witness cache file, the last one is the format version
+static const uint8_t cache_file_magic[5] = {'M', 'M', 'R', 'W', 1};
+
+// Largest cache file entry: peak hash followed by an encoded witness
+#define CACHE_ENTRY_MAX_BYTES                                                                                          \
+    (sizeof(bytes32) + 1 + sizeof(bytes32) + sizeof(uint64_t) + WITNESS_MAX_SIBLINGS * sizeof(bytes32))
+
+/**
+ * Write every witness cache entry that still ends at a current peak
+ * Entries are written as the peak hash followed by the encoded witness
+ * @param acc Pointer to accumulator
+ * @param out Stream to write to
+ * @param count Optional output for the number of entries written
+ * @return true on success, false on invalid parameters or a write error
+ */
+bool mmr_cache_save(const MMRAccumulator *acc, FILE *out, size_t *count)
+{
+    if (count) *count = 0;
+    if (!acc || !out) return false;
+
+    if (fwrite(cache_file_magic, sizeof(cache_file_magic), 1, out) != 1) return false;
+
+    // Holding the writer mutex keeps every peak, and so every cache entry's validity, fixed
+    mmr_write_begin(acc);
+    mmr_lock_tracker(acc, false);
+
+    bool ok = true;
+    uint8_t entry[CACHE_ENTRY_MAX_BYTES];
+
+    for (size_t bucket = 0; ok && acc->tracker.items && bucket < acc->tracker.capacity; ++bucket)
+    {
+        for (const MMRItem *item = acc->tracker.items[bucket]; ok && item; item = item->next)
+        {
+            size_t len = 0;
+
+            mmr_cache_lock(acc);
+
+            if (witness_cached(item))
+            {
+                memcpy(entry, item->witness_root->hash, sizeof(bytes32));
+                if (!mmr_witness_encode(&item->witness, entry + sizeof(bytes32), sizeof(entry) - sizeof(bytes32),
+                                        &len))
+                {
+                    len = 0;
+                }
+            }
+
+            mmr_cache_unlock(acc);
+
+            if (len == 0) continue;
+
+            ok = fwrite(entry, sizeof(bytes32) + len, 1, out) == 1;
+            if (ok && count) ++*count;
+        }
+    }
+
+    mmr_unlock_tracker(acc);
+    mmr_write_end(acc);
+
+    return ok;
+}
+
+/**
+ * Install one loaded entry into the witness cache if it is still valid
+ * The entry is kept only if the leaf is tracked, its mountain's peak is the
+ * saved one and folding the witness actually reproduces that peak
+ * @param acc Pointer to accumulator
+ * @param root Peak hash saved with the entry
+ * @param w Decoded witness, siblings in temporary storage
+ * @return true if the entry was installed, false if it was stale or already cached
+ */
+static bool cache_install(const MMRAccumulator *acc, const bytes32 *root, const MMRWitness *w)
+{
+    MMRItem *item;
+    unsigned height;
+    if (!mmr_lock_leaf(acc, &w->hash, &item, &height)) return false;
+
+    MMRNode *peak = (MMRNode *) mountain_root(item->node);
+    bytes32 levels[WITNESS_MAX_SIBLINGS + 1];
+
+    bool ok = item->node->n_leaves == 1 && hashes_equal(root, &peak->hash) &&
+              fold_witness(acc->hash_backend, w, levels) &&
+              hashes_equal(root, &levels[w->n_siblings]);
+
+    bytes32 *siblings = NULL;
+    if (ok && w->n_siblings > 0)
+    {
+        siblings = malloc(w->n_siblings * sizeof(bytes32));
+        ok = siblings != NULL;
+        if (ok) memcpy(siblings, w->siblings, w->n_siblings * sizeof(bytes32));
+    }
+
+    if (ok)
+    {
+        mmr_cache_lock(acc);
+
+        // Keep whatever a live reader cached first
+        ok = !witness_cached(item);
+        if (ok)
+        {
+            free(item->witness.siblings);
+            free(item->encoded);
+            item->encoded = NULL;
+            item->encoded_len = 0;
+
+            item->witness = *w;
+            item->witness.siblings = siblings;
+            item->witness_root = peak;
+        }
+
+        mmr_cache_unlock(acc);
+    }
+
+    mmr_unlock_leaf(acc, height);
+
+    if (!ok) free(siblings);
+
+    return ok;
+}
+
+/**
+ * Load witness cache entries written by mmr_cache_save
+ * Each entry is checked against the current peaks and dropped if stale
+ * @param acc Pointer to accumulator
+ * @param in Stream to read from
+ * @param count Optional output for the number of entries installed
+ * @return true if the whole stream was read, false on invalid parameters or a malformed stream
+ */
+bool mmr_cache_load(const MMRAccumulator *acc, FILE *in, size_t *count)
+{
+    if (count) *count = 0;
+    if (!acc || !in) return false;
+
+    uint8_t magic[sizeof(cache_file_magic)];
+    if (fread(magic, sizeof(magic), 1, in) != 1 || memcmp(magic, cache_file_magic, sizeof(magic)) != 0)
+    {
+        return false;
+    }
+
+    uint8_t entry[CACHE_ENTRY_MAX_BYTES];
+    bytes32 siblings[WITNESS_MAX_SIBLINGS];
+
+    for (;;)
+    {
+        // A clean end of stream falls exactly between two entries
+        size_t got = fread(entry, 1, sizeof(bytes32) + 1, in);
+        if (got == 0) return feof(in) && !ferror(in);
+        if (got != sizeof(bytes32) + 1) return false;
+
+        uint8_t n_siblings = entry[sizeof(bytes32)];
+        if (n_siblings > WITNESS_MAX_SIBLINGS) return false;
+
+        size_t rest = sizeof(bytes32) + witness_path_bytes(n_siblings) + n_siblings * sizeof(bytes32);
+        if (fread(entry + sizeof(bytes32) + 1, rest, 1, in) != 1) return false;
+
+        MMRWitness w;
+        if (!mmr_witness_decode(&w, siblings, entry + sizeof(bytes32), 1 + rest, NULL)) return false;
+
+        if (cache_install(acc, (const bytes32 *) entry, &w) && count) ++*count;
+    }
+}
+
+// ------------------------- MMR HIERARCHY ----------------------------------
+
+/**
+ * A sealed batch of a hierarchy
+ * The inner accumulator never changes after sealing, so its peaks and the
+ * suffix bags over them are computed once and every inner proof stays valid
+ */
+struct MMRBatch
+{
+    MMRAccumulator inner;
+
+    // Peaks from the largest (left) to the smallest (right)
+    bytes32 peaks[MMR_MAX_HEIGHT];
+    unsigned heights[MMR_MAX_HEIGHT];
+
+    // suffix[i] bags peaks i..n_peaks-1, so suffix[0] is the batch root
+    bytes32 suffix[MMR_MAX_HEIGHT];
+    unsigned n_peaks;
+};
+
+/**
+ * Compute a batch's peaks and the bags that join them into one root
+ * Bagging folds from the right: root = H(p0, H(p1, ... H(pk-1, pk)))
+ * @param batch Batch whose inner accumulator is complete
+ * @return true on success, false if hashing fails
+ */
+static bool batch_seal(struct MMRBatch *batch)
+{
+    // The root list runs from the smallest peak, so fill from the right
+    unsigned n = 0;
+    for (const MMRNode *cur = batch->inner.head; cur; cur = cur->next)
+    {
+        ++n;
+    }
+
+    batch->n_peaks = n;
+    for (const MMRNode *cur = batch->inner.head; cur; cur = cur->next)
+    {
+        --n;
+        memcpy(batch->peaks[n], cur->hash, sizeof(bytes32));
+        batch->heights[n] = mountain_height(cur->n_leaves);
+    }
+
+    if (batch->n_peaks == 0) return false;
+
+    unsigned last = batch->n_peaks - 1;
+    memcpy(batch->suffix[last], batch->peaks[last], sizeof(bytes32));
+
+    for (unsigned i = last; i-- > 0;)
+    {
+        if (!node_hash(batch->inner.hash_backend, &batch->peaks[i], &batch->suffix[i + 1], &batch->suffix[i]))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Initialize an empty hierarchy
+ * @param h Pointer to hierarchy to initialize
+ * @param cfg Configuration applied to the outer and every inner accumulator, or NULL
+ * @return true on success, false if the configuration could not be applied
+ */
+bool mmr_hier_init(MMRHierarchy *h, const MMRConfig *cfg)
+{
+    if (!h) return false;
+
+    h->batches = NULL;
+    h->n_batches = 0;
+    h->capacity = 0;
+
+    if (cfg)
+    {
+        h->cfg = *cfg;
+    }
+    else
+    {
+        memset(&h->cfg, 0, sizeof(MMRConfig));
+    }
+
+    // Inner accumulators are created long after the caller's profile may be gone
+    if (h->cfg.tuning)
+    {
+        h->tuning = *h->cfg.tuning;
+        h->cfg.tuning = &h->tuning;
+    }
+
+    return mmr_init_config(&h->outer, cfg);
+}
+
+/**
+ * Destroy a hierarchy and every batch in it
+ * @param h Pointer to hierarchy to destroy
+ */
+void mmr_hier_destroy(MMRHierarchy *h)
+{
+    if (!h) return;
+
+    for (size_t i = 0; i < h->n_batches; ++i)
+    {
+        mmr_destroy(&h->batches[i]->inner);
+        free(h->batches[i]);
+    }
+
+    free(h->batches);
+    h->batches = NULL;
+    h->n_batches = 0;
+    h->capacity = 0;
+
+    mmr_destroy(&h->outer);
+}
+
+/**
+ * Build and seal a batch, then append its root to the outer accumulator
+ * @param h Pointer to hierarchy
+ * @param elems Elements of the batch, in order
+ * @param count Number of elements (at least one)
+ * @param index Optional output for the batch index
+ * @return true on success, false on failure or invalid parameters
+ */
+bool mmr_hier_add_batch(MMRHierarchy *h, const MMRElement *elems, size_t count, size_t *index)
+{
+    if (!h || !elems || count < 1) return false;
+
+    if (h->n_batches == h->capacity)
+    {
+        size_t capacity = h->capacity ? h->capacity * 2 : TRACKER_MIN_CAPACITY;
+        struct MMRBatch **batches = realloc(h->batches, capacity * sizeof(struct MMRBatch *));
+        if (!batches) return false;
+
+        h->batches = batches;
+        h->capacity = capacity;
+    }
+
+    struct MMRBatch *batch = calloc(1, sizeof(struct MMRBatch));
+    if (!batch) return false;
+
+    if (!mmr_init_config(&batch->inner, &h->cfg))
+    {
+        free(batch);
+        return false;
+    }
+
+    if (!mmr_add_batch(&batch->inner, elems, count) || !batch_seal(batch) ||
+        !mmr_add(&h->outer, batch->suffix[0], sizeof(bytes32)))
+    {
+        mmr_destroy(&batch->inner);
+        free(batch);
+        return false;
+    }
+
+    if (index) *index = h->n_batches;
+    h->batches[h->n_batches++] = batch;
+
+    return true;
+}
+
+/**
+ * Get the root a sealed batch was added to the outer accumulator under
+ * @param h Pointer to hierarchy
+ * @param index Batch index
+ * @param root Output for the batch root
+ * @return true on success, false if the batch does not exist
+ */
+bool mmr_hier_batch_root(const MMRHierarchy *h, size_t index, bytes32 *root)
+{
+    if (!h || !root || index >= h->n_batches) return false;
+
+    memcpy(*root, h->batches[index]->suffix[0], sizeof(bytes32));
+
+    return true;
+}
+
+/**
+ * Extend a witness from a leaf to its peak up to the batch root
+ * A peak's first sibling is the bag of everything right of it, then every
+ * peak to its left follows in turn, each on the left
+ * @param batch Sealed batch
+ * @param w Inner witness ending at one of the batch's peaks
+ * @return true on success, false if the peak is unknown or the proof too long
+ */
+static bool batch_extend(const struct MMRBatch *batch, MMRWitness *w)
+{
+    // Peaks have distinct heights, and a witness is as long as its peak is high
+    unsigned peak = 0;
+    while (peak < batch->n_peaks && batch->heights[peak] != w->n_siblings)
+    {
+        ++peak;
+    }
+
+    if (peak == batch->n_peaks) return false;
+
+    unsigned extra = peak + (peak + 1 < batch->n_peaks ? 1 : 0);
+    if (w->n_siblings + extra > WITNESS_MAX_SIBLINGS) return false;
+
+    if (peak + 1 < batch->n_peaks)
+    {
+        memcpy(w->siblings[w->n_siblings], batch->suffix[peak + 1], sizeof(bytes32));
+        w->path |= 1ULL << w->n_siblings;
+        ++w->n_siblings;
+    }
+
+    for (unsigned i = peak; i-- > 0;)
+    {
+        memcpy(w->siblings[w->n_siblings], batch->peaks[i], sizeof(bytes32));
+        ++w->n_siblings;
+    }
+
+    return true;
+}
+
+/**
+ * Refresh the outer part of a combined witness
+ * @param h Pointer to hierarchy
+ * @param w Combined witness with a valid inner part
+ * @param root Batch root the inner part proves against
+ * @return true on success, false if the batch root is not in the outer accumulator
+ */
+static bool hier_outer(const MMRHierarchy *h, MMRHierWitness *w, const bytes32 *root)
+{
+    return w->outer.siblings && mmr_witness_into(&h->outer, &w->outer, w->outer.siblings, *root, sizeof(bytes32));
+}
+
+/**
+ * Create a combined witness for an element of a sealed batch
+ * @param h Pointer to hierarchy
+ * @param index Batch the element was added in
+ * @param w Combined witness to populate
+ * @param siblings Caller owned array of 2 * WITNESS_MAX_SIBLINGS hashes
+ * @param e Element to create the witness for
+ * @param n Size of element in bytes
+ * @return true on success, false on failure
+ */
+bool mmr_hier_witness(const MMRHierarchy *h, size_t index, MMRHierWitness *w, bytes32 *siblings, const uint8_t *e,
+                      size_t n)
+{
+    if (!h || !w || !siblings || !e || n < 1 || index >= h->n_batches) return false;
+
+    const struct MMRBatch *batch = h->batches[index];
+
+    if (!mmr_witness_into(&batch->inner, &w->inner, siblings, e, n)) return false;
+    if (!batch_extend(batch, &w->inner)) return false;
+
+    w->outer.siblings = siblings + WITNESS_MAX_SIBLINGS;
+
+    return hier_outer(h, w, &batch->suffix[0]);
+}
+
+/**
+ * Bring the outer part of a combined witness up to date
+ * @param h Pointer to hierarchy
+ * @param w Combined witness, w->outer.siblings must have room for WITNESS_MAX_SIBLINGS hashes
+ * @return true on success, false if the inner part does not lead to a known batch root
+ */
+bool mmr_hier_refresh(const MMRHierarchy *h, MMRHierWitness *w)
+{
+    if (!h || !w || w->inner.n_siblings > WITNESS_MAX_SIBLINGS) return false;
+    if (w->inner.n_siblings > 0 && !w->inner.siblings) return false;
+
+    bytes32 levels[WITNESS_MAX_SIBLINGS + 1];
+    if (!fold_witness(h->outer.hash_backend, &w->inner, levels)) return false;
+
+    return hier_outer(h, w, &levels[w->inner.n_siblings]);
+}
+
+/**
+ * Verify a combined witness against the hierarchy
+ * The inner part must fold to a batch root whose outer leaf the outer part proves
+ * @param h Pointer to hierarchy
+ * @param w Combined witness to verify
+ * @return true if the proof is valid, false otherwise
+ */
+bool mmr_hier_verify(const MMRHierarchy *h, const MMRHierWitness *w)
+{
+    if (!h || !w) return false;
+
+    const MMRWitness *inner = &w->inner;
+    if (inner->n_siblings > WITNESS_MAX_SIBLINGS || (inner->n_siblings > 0 && !inner->siblings)) return false;
+    if (inner->path >= (1ULL << inner->n_siblings)) return false;
+
+    bytes32 levels[WITNESS_MAX_SIBLINGS + 1];
+    if (!fold_witness(h->outer.hash_backend, inner, levels)) return false;
+
+    // The outer accumulator holds each batch root as an ordinary element
+    bytes32 leaf;
+    if (!leaf_hash(h->outer.hash_backend, NULL, levels[inner->n_siblings], sizeof(bytes32), &leaf)) return false;
+    if (!hashes_equal(&leaf, &w->outer.hash)) return false;
+
+    return mmr_verify(&h->outer, &w->outer);
+}
+
+// -------------------------- MMR PIPELINE ----------------------------------
+
+// Slot stages, stored in the low bits of a slot's stamp next to its sequence number
+#define SLOT_FREE 0
+#define SLOT_FILLED 1
+#define SLOT_HASHED 2
+#define SLOT_MERGED 3
+#define SLOT_STAMP(seq, stage) ((seq) * 4 + (stage))
+
+// Elements a hash worker takes per claim
+#define PIPELINE_HASH_BATCH 16
+
+#define PIPELINE_DEFAULT_SLOTS 1024
+
+// Yields before an idle stage starts sleeping between polls
+#define PIPELINE_SPIN_YIELDS 64
+#define PIPELINE_IDLE_SLEEP_NS 50000
+
+/**
+ * One ring slot, owned in turn by a producer, a hash worker, the merge stage
+ * and the persist stage. The stamp says which sequence number the slot holds
+ * and how far it has got; each stage waits for the stamp it expects
+ */
+typedef struct
+{
+    _Alignas(64) uint64_t stamp;
+
+    size_t n;
+    uint8_t *data;
+    bytes32 hash;
+
+    // Short elements are copied here instead of onto the heap
+    uint8_t inline_data[SHORT_LEAF_MAX_BYTES];
+} PipelineSlot;
+
+/**
+ * Staged ingest pipeline
+ * Producers claim sequence numbers from tail and fill slots; hash workers
+ * claim runs of filled slots from hash_cursor; the merge and persist stages
+ * each walk the ring in sequence order. Cursors sit on separate cache lines
+ */
+struct MMRPipeline
+{
+    _Alignas(64) uint64_t tail;
+    _Alignas(64) uint64_t hash_cursor;
+    _Alignas(64) uint64_t merged;
+    _Alignas(64) uint64_t persisted;
+
+    // Final tail once closed, UINT64_MAX while open
+    _Alignas(64) uint64_t end;
+    uint64_t pushers;
+    bool closed;
+    bool failed;
+
+    MMRAccumulator *acc;
+    const MMRPrefix *prefix;
+    mmr_persist_fn persist;
+    void *persist_ctx;
+
+    PipelineSlot *slots;
+    uint64_t mask;
+
+    pthread_t *workers;
+    unsigned n_workers;
+    pthread_t merger;
+    pthread_t persister;
+
+    MMRPipelineStats stats;
+};
+
+#define PIPELINE_STAT_ADD(p, field, v) __atomic_fetch_add(&(p)->stats.field, (v), __ATOMIC_RELAXED)
+
+/**
+ * Back off while a stage waits, yielding first and sleeping once idle for a while
+ * @param spins Number of times the caller has already waited in a row
+ */
+static void pipeline_backoff(unsigned spins)
+{
+    if (spins < PIPELINE_SPIN_YIELDS)
+    {
+        sched_yield();
+        return;
+    }
+
+    struct timespec idle = {0, PIPELINE_IDLE_SLEEP_NS};
+    nanosleep(&idle, NULL);
+}
+
+/**
+ * Wait until a slot reaches the given stamp
+ * @param slot Slot to watch
+ * @param stamp Stamp to wait for
+ * @return true if the caller had to wait
+ */
+static bool pipeline_await(const PipelineSlot *slot, uint64_t stamp)
+{
+    unsigned spins = 0;
+    while (__atomic_load_n(&slot->stamp, __ATOMIC_ACQUIRE) != stamp)
+    {
+        pipeline_backoff(spins++);
+    }
+
+    return spins > 0;
+}
+
+/**
+ * Hand a slot back to producers for its next lap
+ * @param p Pipeline
+ * @param seq Sequence number the slot held
+ */
+static void pipeline_release(struct MMRPipeline *p, uint64_t seq)
+{
+    PipelineSlot *slot = &p->slots[seq & p->mask];
+
+    if (slot->data != slot->inline_data) free(slot->data);
+    slot->data = NULL;
+
+    __atomic_store_n(&slot->stamp, SLOT_STAMP(seq + p->mask + 1, SLOT_FREE), __ATOMIC_RELEASE);
+}
+
+/**
+ * Hash worker: claims runs of up to PIPELINE_HASH_BATCH pushed elements and hashes them together
+ * @param arg Pipeline
+ * @return NULL
+ */
+static void *pipeline_hash_worker(void *arg)
+{
+    struct MMRPipeline *p = arg;
+
+    MMRElement elems[PIPELINE_HASH_BATCH];
+    bytes32 hashes[PIPELINE_HASH_BATCH];
+    unsigned spins = 0;
+
+    for (;;)
+    {
+        uint64_t cur = __atomic_load_n(&p->hash_cursor, __ATOMIC_ACQUIRE);
+        uint64_t avail = __atomic_load_n(&p->tail, __ATOMIC_ACQUIRE);
+
+        if (cur >= __atomic_load_n(&p->end, __ATOMIC_ACQUIRE)) break;
+
+        if (cur >= avail)
+        {
+            if (spins == 0) PIPELINE_STAT_ADD(p, hash_waits, 1);
+            pipeline_backoff(spins++);
+            continue;
+        }
+
+        // A run longer than the ring would wait on its own slots to come free
+        uint64_t max = p->mask < PIPELINE_HASH_BATCH ? p->mask + 1 : PIPELINE_HASH_BATCH;
+        uint64_t n = avail - cur < max ? avail - cur : max;
+        if (!__atomic_compare_exchange_n(&p->hash_cursor, &cur, cur + n, false, __ATOMIC_ACQ_REL,
+                                         __ATOMIC_ACQUIRE))
+        {
+            continue;
+        }
+
+        spins = 0;
+
+        // Claimed slots may still be in the middle of being filled by their producer
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            const PipelineSlot *slot = &p->slots[(cur + i) & p->mask];
+            pipeline_await(slot, SLOT_STAMP(cur + i, SLOT_FILLED));
+
+            elems[i].data = slot->data;
+            elems[i].n = slot->n;
+        }
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        leaf_hash_batch(p->acc->hash_backend, p->prefix, elems, n, hashes);
+
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            PipelineSlot *slot = &p->slots[(cur + i) & p->mask];
+            memcpy(slot->hash, hashes[i], sizeof(bytes32));
+            __atomic_store_n(&slot->stamp, SLOT_STAMP(cur + i, SLOT_HASHED), __ATOMIC_RELEASE);
+        }
+
+        PIPELINE_STAT_ADD(p, hash_ns, elapsed_ns(&start));
+        PIPELINE_STAT_ADD(p, hashed, n);
+        PIPELINE_STAT_ADD(p, hash_batches, 1);
+    }
+
+    return NULL;
+}
+
+/**
+ * Gather the run of slots from seq onwards that have reached a stage
+ * Blocks for the first one only, then takes whatever follows without waiting
+ * @param p Pipeline
+ * @param seq First sequence number of the run
+ * @param stage Stage the slots must have reached
+ * @param max Longest run to take
+ * @param waits Stage wait counter to bump if the first slot was not ready
+ * @return Length of the run, 0 once the pipeline is closed and drained
+ */
+static size_t pipeline_run(struct MMRPipeline *p, uint64_t seq, int stage, size_t max, uint64_t *waits)
+{
+    unsigned spins = 0;
+
+    while (__atomic_load_n(&p->slots[seq & p->mask].stamp, __ATOMIC_ACQUIRE) != SLOT_STAMP(seq, stage))
+    {
+        if (seq >= __atomic_load_n(&p->end, __ATOMIC_ACQUIRE)) return 0;
+
+        if (spins == 0) __atomic_fetch_add(waits, 1, __ATOMIC_RELAXED);
+        pipeline_backoff(spins++);
+    }
+
+    size_t n = 1;
+    while (n < max && __atomic_load_n(&p->slots[(seq + n) & p->mask].stamp, __ATOMIC_ACQUIRE) ==
+                          SLOT_STAMP(seq + n, stage))
+    {
+        ++n;
+    }
+
+    return n;
+}
+
+/**
+ * Merge stage: appends hashed elements to the accumulator strictly in push order
+ * @param arg Pipeline
+ * @return NULL
+ */
+static void *pipeline_merge_worker(void *arg)
+{
+    struct MMRPipeline *p = arg;
+    MMRAccumulator *acc = p->acc;
+
+    bytes32 hashes[MMR_MAX_BATCH_CHUNK];
+
+    for (uint64_t seq = 0;;)
+    {
+        size_t n = pipeline_run(p, seq, SLOT_HASHED, acc->tuning.batch_chunk, &p->stats.merge_waits);
+        if (n == 0) break;
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            memcpy(hashes[i], p->slots[(seq + i) & p->mask].hash, sizeof(bytes32));
+        }
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        PerfSample sample;
+        perf_begin(acc, &sample);
+
+        mmr_write_begin(acc);
+        bool ok = append_chunk(acc, hashes, n, NULL);
+        mmr_write_end(acc);
+
+        perf_end(acc, MMR_OP_ADD, &sample, n);
+
+        if (!ok) __atomic_store_n(&p->failed, true, __ATOMIC_RELEASE);
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (p->persist)
+            {
+                __atomic_store_n(&p->slots[(seq + i) & p->mask].stamp, SLOT_STAMP(seq + i, SLOT_MERGED),
+                                 __ATOMIC_RELEASE);
+            }
+            else
+            {
+                pipeline_release(p, seq + i);
+            }
+        }
+
+        seq += n;
+        __atomic_store_n(&p->merged, seq, __ATOMIC_RELEASE);
+
+        PIPELINE_STAT_ADD(p, merge_ns, elapsed_ns(&start));
+        PIPELINE_STAT_ADD(p, merge_batches, 1);
+    }
+
+    return NULL;
+}
+
+/**
+ * Persist stage: hands merged elements to the persist callback in push order
+ * @param arg Pipeline
+ * @return NULL
+ */
+static void *pipeline_persist_worker(void *arg)
+{
+    struct MMRPipeline *p = arg;
+
+    MMRElement elems[MMR_MAX_BATCH_CHUNK];
+    bytes32 hashes[MMR_MAX_BATCH_CHUNK];
+
+    for (uint64_t seq = 0;;)
+    {
+        size_t n = pipeline_run(p, seq, SLOT_MERGED, p->acc->tuning.batch_chunk, &p->stats.persist_waits);
+        if (n == 0) break;
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            const PipelineSlot *slot = &p->slots[(seq + i) & p->mask];
+
+            elems[i].data = slot->data;
+            elems[i].n = slot->n;
+            memcpy(hashes[i], slot->hash, sizeof(bytes32));
+        }
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        if (!p->persist(p->persist_ctx, elems, hashes, n))
+        {
+            PIPELINE_STAT_ADD(p, persist_failures, 1);
+            __atomic_store_n(&p->failed, true, __ATOMIC_RELEASE);
+        }
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            pipeline_release(p, seq + i);
+        }
+
+        seq += n;
+        __atomic_store_n(&p->persisted, seq, __ATOMIC_RELEASE);
+
+        PIPELINE_STAT_ADD(p, persist_ns, elapsed_ns(&start));
+        PIPELINE_STAT_ADD(p, persist_batches, 1);
+    }
+
+    return NULL;
+}
+
+/**
+ * Free a pipeline's memory once its threads are gone
+ * @param p Pipeline
+ */
+static void pipeline_free(struct MMRPipeline *p)
+{
+    for (uint64_t i = 0; p->slots && i <= p->mask; ++i)
+    {
+        if (p->slots[i].data != p->slots[i].inline_data) free(p->slots[i].data);
+    }
+
+    free(p->slots);
+    free(p->workers);
+    free(p);
+}
+
+/**
+ * Stop accepting elements and tell every stage where the stream ends
+ * @param p Pipeline
+ */
+static void pipeline_close(struct MMRPipeline *p)
+{
+    __atomic_store_n(&p->closed, true, __ATOMIC_SEQ_CST);
+
+    // Producers that got past the closed check still get their element in
+    unsigned spins = 0;
+    while (__atomic_load_n(&p->pushers, __ATOMIC_SEQ_CST) > 0)
+    {
+        pipeline_backoff(spins++);
+    }
+
+    __atomic_store_n(&p->end, __atomic_load_n(&p->tail, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+}
+
+/**
+ * Start an ingest pipeline feeding an accumulator
+ * @param acc Accumulator to append to, it must outlive the pipeline
+ * @param cfg Pipeline configuration, or NULL for defaults
+ * @return The running pipeline, or NULL on failure
+ */
+struct MMRPipeline *mmr_pipeline_start(MMRAccumulator *acc, const MMRPipelineConfig *cfg)
+{
+    if (!acc || !prefix_supported(acc, cfg ? cfg->prefix : NULL)) return NULL;
+
+    size_t n_slots = cfg && cfg->slots ? cfg->slots : PIPELINE_DEFAULT_SLOTS;
+    if (n_slots & (n_slots - 1)) return NULL;
+
+    struct MMRPipeline *p = aligned_alloc(64, sizeof(struct MMRPipeline));
+    if (!p) return NULL;
+
+    memset(p, 0, sizeof(struct MMRPipeline));
+    p->end = UINT64_MAX;
+    p->acc = acc;
+    p->prefix = cfg ? cfg->prefix : NULL;
+    p->persist = cfg ? cfg->persist : NULL;
+    p->persist_ctx = cfg ? cfg->persist_ctx : NULL;
+    p->mask = n_slots - 1;
+    p->n_workers = cfg && cfg->hash_workers ? cfg->hash_workers : acc->tuning.threads;
+
+    p->slots = aligned_alloc(64, n_slots * sizeof(PipelineSlot));
+    p->workers = calloc(p->n_workers, sizeof(pthread_t));
+    if (!p->slots || !p->workers)
+    {
+        pipeline_free(p);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < n_slots; ++i)
+    {
+        memset(&p->slots[i], 0, sizeof(PipelineSlot));
+        p->slots[i].stamp = SLOT_STAMP(i, SLOT_FREE);
+    }
+
+    // Stages left without input see end == 0 and exit if anything fails below
+    unsigned started = 0;
+    bool ok = pthread_create(&p->merger, NULL, pipeline_merge_worker, p) == 0;
+    bool merger = ok;
+    bool persister = ok && p->persist && pthread_create(&p->persister, NULL, pipeline_persist_worker, p) == 0;
+    ok = ok && (!p->persist || persister);
+
+    while (ok && started < p->n_workers)
+    {
+        ok = pthread_create(&p->workers[started], NULL, pipeline_hash_worker, p) == 0;
+        if (ok) ++started;
+    }
+
+    if (!ok)
+    {
+        pipeline_close(p);
+
+        for (unsigned i = 0; i < started; ++i)
+        {
+            pthread_join(p->workers[i], NULL);
+        }
+        if (merger) pthread_join(p->merger, NULL);
+        if (persister) pthread_join(p->persister, NULL);
+
+        pipeline_free(p);
+        return NULL;
+    }
+
+    return p;
+}
+
+/**
+ * Push one element into the pipeline, copying it
+ * Blocks while the ring is full, which is how slow stages push back
+ * @param p Pipeline
+ * @param e Element data
+ * @param n Size of element data in bytes
+ * @return true if the element was queued, false if the pipeline is closed or on failure
+ */
+bool mmr_pipeline_push(struct MMRPipeline *p, const uint8_t *e, size_t n)
+{
+    if (!p || !e || n < 1) return false;
+
+    __atomic_fetch_add(&p->pushers, 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&p->closed, __ATOMIC_SEQ_CST))
+    {
+        __atomic_fetch_sub(&p->pushers, 1, __ATOMIC_SEQ_CST);
+        return false;
+    }
+
+    uint8_t *data = NULL;
+    if (n > SHORT_LEAF_MAX_BYTES)
+    {
+        data = malloc(n);
+        if (!data)
+        {
+            __atomic_fetch_sub(&p->pushers, 1, __ATOMIC_SEQ_CST);
+            return false;
+        }
+
+        memcpy(data, e, n);
+    }
+
+    uint64_t seq = __atomic_fetch_add(&p->tail, 1, __ATOMIC_ACQ_REL);
+    PipelineSlot *slot = &p->slots[seq & p->mask];
+
+    if (pipeline_await(slot, SLOT_STAMP(seq, SLOT_FREE))) PIPELINE_STAT_ADD(p, push_waits, 1);
+
+    if (!data)
+    {
+        data = slot->inline_data;
+        memcpy(data, e, n);
+    }
+
+    slot->data = data;
+    slot->n = n;
+    __atomic_store_n(&slot->stamp, SLOT_STAMP(seq, SLOT_FILLED), __ATOMIC_RELEASE);
+
+    PIPELINE_STAT_ADD(p, pushed, 1);
+    __atomic_fetch_sub(&p->pushers, 1, __ATOMIC_SEQ_CST);
+
+    return true;
+}
+
+/**
+ * Wait until every element pushed so far has gone through all stages
+ * @param p Pipeline
+ * @return true if no stage has failed so far
+ */
+bool mmr_pipeline_flush(struct MMRPipeline *p)
+{
+    if (!p) return false;
+
+    uint64_t target = __atomic_load_n(&p->tail, __ATOMIC_ACQUIRE);
+    const uint64_t *done = p->persist ? &p->persisted : &p->merged;
+
+    unsigned spins = 0;
+    while (__atomic_load_n(done, __ATOMIC_ACQUIRE) < target)
+    {
+        pipeline_backoff(spins++);
+    }
+
+    return !__atomic_load_n(&p->failed, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Drain the pipeline, stop its threads and free it
+ * @param p Pipeline
+ * @return true if every element was merged and persisted without failure
+ */
+bool mmr_pipeline_finish(struct MMRPipeline *p)
+{
+    if (!p) return false;
+
+    pipeline_close(p);
+
+    for (unsigned i = 0; i < p->n_workers; ++i)
+    {
+        pthread_join(p->workers[i], NULL);
+    }
+
+    pthread_join(p->merger, NULL);
+    if (p->persist) pthread_join(p->persister, NULL);
+
+    bool ok = !p->failed;
+    pipeline_free(p);
+
+    return ok;
+}
+
+/**
+ * Take a snapshot of the pipeline's stage counters
+ * @param p Pipeline
+ * @param stats Output structure to populate
+ */
+void mmr_pipeline_stats(const struct MMRPipeline *p, MMRPipelineStats *stats)
+{
+    if (!stats) return;
+
+    memset(stats, 0, sizeof(MMRPipelineStats));
+    if (!p) return;
+
+    const uint64_t *src = (const uint64_t *) &p->stats;
+    uint64_t *dst = (uint64_t *) stats;
+
+    for (size_t i = 0; i < sizeof(MMRPipelineStats) / sizeof(uint64_t); ++i)
+    {
+        dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+    }
+
+    const uint64_t *done = p->persist ? &p->persisted : &p->merged;
+    stats->in_flight = __atomic_load_n(&p->tail, __ATOMIC_ACQUIRE) - __atomic_load_n(done, __ATOMIC_ACQUIRE);
+    stats->merged = __atomic_load_n(&p->merged, __ATOMIC_ACQUIRE);
+    stats->persisted = __atomic_load_n(&p->persisted, __ATOMIC_ACQUIRE);
+}
+
+// -------------------------- MMR WARM-UP -----------------------------------
+
+// Nodes walked between checks of a background warm-up's stop flag
+#define WARM_STOP_CHECK 4096
+
+/**
+ * State of a background warm-up thread
+ * stop and touched are accessed atomically
+ */
+struct MMRWarmer
+{
+    pthread_t thread;
+
+    MMRAccumulator *acc;
+    unsigned levels;
+
+    bool stop;
+    size_t touched;
+};
+
+/**
+ * Progress of one warm-up walk
+ */
+typedef struct
+{
+    uintptr_t page_size;
+    uintptr_t last_page;
+
+    const bool *stop;
+    size_t touched;
+} WarmWalk;
+
+/**
+ * Ask the kernel to read in the pages under a range, skipping the page advised last
+ * Nodes are allocated in add order, so neighbouring nodes often share a page
+ * @param walk Walk in progress
+ * @param addr Start of the range
+ * @param len Length of the range in bytes
+ */
+static void warm_advise(WarmWalk *walk, const void *addr, size_t len)
+{
+#ifdef __linux__
+    uintptr_t first = (uintptr_t) addr & ~(walk->page_size - 1);
+    uintptr_t last = ((uintptr_t) addr + len - 1) & ~(walk->page_size - 1);
+
+    if (first == walk->last_page)
+    {
+        if (first == last) return;
+        first += walk->page_size;
+    }
+
+    walk->last_page = last;
+
+    // Advice only; memory the kernel cannot advise is simply faulted in by the touch
+    madvise((void *) first, last - first + walk->page_size, MADV_WILLNEED);
+#else
+    (void) walk;
+    (void) addr;
+    (void) len;
+#endif
+}
+
+/**
+ * Fault in a node and start reading the page it sits on
+ * @param walk Walk in progress
+ * @param node Node to warm
+ */
+static inline void warm_node(WarmWalk *walk, const MMRNode *node)
+{
+    warm_advise(walk, node, sizeof(MMRNode));
+
+    (void) *(const volatile uint8_t *) node->hash;
+    (void) *(const volatile uint8_t *) &node->next;
+
+    ++walk->touched;
+}
+
+/**
+ * Check whether a background walk has been asked to stop
+ * Only polled every WARM_STOP_CHECK nodes to keep the walk cheap
+ * @param walk Walk in progress
+ * @return true if the walk should be abandoned
+ */
+static inline bool warm_stopped(const WarmWalk *walk)
+{
+    return walk->stop && walk->touched % WARM_STOP_CHECK == 0 && __atomic_load_n(walk->stop, __ATOMIC_RELAXED);
+}
+
+/**
+ * Warm the nodes of one mountain that lie between two depths below its peak
+ * Levels above the range are walked but not touched again. The unstored
+ * levels of a collapsed subtree count towards depth, so its chained leaves
+ * sit log2(size) levels below its root; pruned placeholders end the descent
+ * @param walk Walk in progress
+ * @param root Peak of the mountain (caller pins its mountain)
+ * @param from First depth to warm, the peak being depth 0
+ * @param to Depth to stop at, exclusive
+ * @return false if the walk was stopped early, true otherwise
+ */
+static bool warm_mountain(WarmWalk *walk, const MMRNode *root, unsigned from, unsigned to)
+{
+    struct
+    {
+        const MMRNode *node;
+        unsigned depth;
+    } stack[2 * MMR_MAX_HEIGHT];
+    size_t top = 0;
+
+    stack[top].node = root;
+    stack[top++].depth = 0;
+
+    while (top > 0)
+    {
+        const MMRNode *node = stack[--top].node;
+        unsigned depth = stack[top].depth;
+
+        if (depth >= from) warm_node(walk, node);
+        if (warm_stopped(walk)) return false;
+
+        if (!node->left || node->n_leaves == 1 || depth + 1 >= to) continue;
+
+        if (node_collapsed(node))
+        {
+            unsigned below = depth + mountain_height(node->n_leaves);
+            if (below < from || below >= to) continue;
+
+            for (const MMRNode *leaf = node->left; leaf; leaf = leaf->next)
+            {
+                warm_node(walk, leaf);
+                if (warm_stopped(walk)) return false;
+            }
+
+            continue;
+        }
+
+        stack[top].node = node->right;
+        stack[top++].depth = depth + 1;
+        stack[top].node = node->left;
+        stack[top++].depth = depth + 1;
+    }
+
+    return true;
+}
+
+/**
+ * Warm one range of depths in every mountain, tallest mountain first
+ * Each mountain is pinned with its read lock for its own walk only, so adds
+ * and readers of other mountains carry on meanwhile. A peak merged away
+ * between walks is skipped; its nodes live on in a taller mountain
+ * @param walk Walk in progress
+ * @param acc Pointer to accumulator
+ * @param from First depth to warm
+ * @param to Depth to stop at, exclusive
+ * @return false if the walk was stopped early, true otherwise
+ */
+static bool warm_levels(WarmWalk *walk, const MMRAccumulator *acc, unsigned from, unsigned to)
+{
+    // The root list, smallest peak first, only changes under the writer mutex
+    unsigned heights[MMR_MAX_HEIGHT];
+    size_t n_peaks = 0;
+
+    mmr_write_begin(acc);
+
+    for (const MMRNode *root = acc->head; root && n_peaks < MMR_MAX_HEIGHT; root = root->next)
+    {
+        heights[n_peaks++] = mountain_height(root->n_leaves);
+    }
+
+    mmr_write_end(acc);
+
+    for (size_t i = n_peaks; i-- > 0;)
+    {
+        mmr_write_begin(acc);
+
+        const MMRNode *root = acc->head;
+        while (root && mountain_height(root->n_leaves) != heights[i]) root = root->next;
+
+        if (root && acc->sync) rwlock_acquire(acc, &acc->sync->mountains[heights[i]], false);
+
+        mmr_write_end(acc);
+
+        if (!root) continue;
+
+        bool done = warm_mountain(walk, root, from, to);
+
+        mmr_unlock_leaf(acc, heights[i]);
+
+        if (!done) return false;
+    }
+
+    return true;
+}
+
+/**
+ * Background warm-up loop, walking every level below the synchronous pass
+ * @param arg The warmer
+ * @return NULL
+ */
+static void *warmer_worker(void *arg)
+{
+    struct MMRWarmer *warmer = arg;
+
+    WarmWalk walk = {0};
+    walk.page_size = (uintptr_t) sysconf(_SC_PAGESIZE);
+    walk.stop = &warmer->stop;
+
+    warm_levels(&walk, warmer->acc, warmer->levels, MMR_MAX_HEIGHT);
+
+    __atomic_store_n(&warmer->touched, walk.touched, __ATOMIC_RELEASE);
+
+    return NULL;
+}
+
+/**
+ * Warm an accumulator's memory for serving, upper levels first
+ * Every witness walks from a leaf up through the top levels of its mountain,
+ * and those levels are scattered among leaf data on the heap, so they are
+ * read in first; the tracker's bucket array is advised along with them
+ * @param acc Pointer to accumulator
+ * @param levels Number of levels below each peak warmed before returning
+ * @param touched Optional output for the number of nodes warmed before returning
+ * @return true if the top levels were warmed and any background pass started
+ */
+bool mmr_warm(MMRAccumulator *acc, unsigned levels, size_t *touched)
+{
+    if (touched) *touched = 0;
+    if (!acc) return false;
+
+    // A warm-up left over from an earlier call would only walk the same nodes
+    mmr_warm_stop(acc, false);
+
+    WarmWalk walk = {0};
+    walk.page_size = (uintptr_t) sysconf(_SC_PAGESIZE);
+
+    mmr_lock_tracker(acc, false);
+
+    if (acc->tracker.items) warm_advise(&walk, acc->tracker.items, acc->tracker.capacity * sizeof(MMRItem *));
+
+    mmr_unlock_tracker(acc);
+
+    warm_levels(&walk, acc, 0, levels);
+
+    if (touched) *touched = walk.touched;
+
+    // Without the mountain locks a background walk would race with adds
+    if (!acc->sync || levels == 0) return true;
+
+    struct MMRWarmer *warmer = calloc(1, sizeof(struct MMRWarmer));
+    if (!warmer) return false;
+
+    warmer->acc = acc;
+    warmer->levels = levels;
+
+    if (pthread_create(&warmer->thread, NULL, warmer_worker, warmer) != 0)
+    {
+        free(warmer);
+        return false;
+    }
+
+    acc->warmer = warmer;
+
+    return true;
+}
+
+/**
+ * Finish the background warm-up started by mmr_warm
+ * @param acc Pointer to accumulator
+ * @param wait true to let the walk reach the leaves, false to abandon it
+ * @return Number of nodes the background pass warmed
+ */
+size_t mmr_warm_stop(MMRAccumulator *acc, bool wait)
+{
+    if (!acc || !acc->warmer) return 0;
+
+    struct MMRWarmer *warmer = acc->warmer;
+
+    if (!wait) __atomic_store_n(&warmer->stop, true, __ATOMIC_RELAXED);
+
+    pthread_join(warmer->thread, NULL);
+
+    size_t touched = __atomic_load_n(&warmer->touched, __ATOMIC_ACQUIRE);
+    free(warmer);
+
+    acc->warmer = NULL;
+
+    return touched;
+}
+
+// ------------------------- MMR ARROW EXPORT -------------------------------
+
+// Rows per record batch when the configuration leaves it open
+#define ARROW_BATCH_ROWS 65536
+
+// Room for one metadata flatbuffer; the schema, the largest, needs under 600 bytes
+#define ARROW_META_MAX 1024
+
+// Arrow format constants: metadata version V5, message headers and field types
+#define ARROW_METADATA_V5 4
+#define ARROW_HEADER_SCHEMA 1
+#define ARROW_HEADER_RECORD_BATCH 3
+#define ARROW_TYPE_INT 2
+#define ARROW_TYPE_FIXED_SIZE_BINARY 15
+
+// Columns of the export: level (uint8), position (uint64), hash (fixed_size_binary[32])
+#define ARROW_COLUMNS 3
+
+// Marks the start of every encapsulated IPC message
+#define ARROW_CONTINUATION 0xFFFFFFFFu
+
+/**
+ * Minimal flatbuffer writer for Arrow's metadata messages
+ * Unlike the reference builder it lays tables out front to back: a parent
+ * is reserved before its children, so every offset points forwards as the
+ * format requires, and each table's vtable sits just before it
+ */
+typedef struct
+{
+    _Alignas(8) uint8_t buf[ARROW_META_MAX];
+    size_t len;
+    bool ok;
+} FbBuilder;
+
+/**
+ * Reserve zeroed space at the end of the buffer
+ * @param b Builder
+ * @param n Number of bytes
+ * @param align Required alignment of the space, a power of two
+ * @return Position of the space, or 0 once the builder has overflowed
+ */
+static size_t fb_reserve(FbBuilder *b, size_t n, size_t align)
+{
+    size_t pos = (b->len + align - 1) & ~(align - 1);
+    if (!b->ok || pos + n > sizeof(b->buf))
+    {
+        b->ok = false;
+        return 0;
+    }
+
+    memset(b->buf + b->len, 0, pos + n - b->len);
+    b->len = pos + n;
+
+    return pos;
+}
+
+static inline void fb_u8(FbBuilder *b, size_t pos, uint8_t v)
+{
+    if (b->ok) b->buf[pos] = v;
+}
+
+static inline void fb_u16(FbBuilder *b, size_t pos, uint16_t v)
+{
+    v = htole16(v);
+    if (b->ok) memcpy(b->buf + pos, &v, sizeof(v));
+}
+
+static inline void fb_u32(FbBuilder *b, size_t pos, uint32_t v)
+{
+    v = htole32(v);
+    if (b->ok) memcpy(b->buf + pos, &v, sizeof(v));
+}
+
+static inline void fb_u64(FbBuilder *b, size_t pos, uint64_t v)
+{
+    v = htole64(v);
+    if (b->ok) memcpy(b->buf + pos, &v, sizeof(v));
+}
+
+/**
+ * Point an offset field at something written after it
+ * @param b Builder
+ * @param pos Position of the offset field
+ * @param target Position of the referenced table, vector or string
+ */
+static inline void fb_ref(FbBuilder *b, size_t pos, size_t target)
+{
+    fb_u32(b, pos, (uint32_t) (target - pos));
+}
+
+/**
+ * Lay out a table, placing its fields in order at their natural alignment
+ * @param b Builder
+ * @param sizes Byte size of each field in schema order, 0 for a field left out
+ * @param n Number of fields
+ * @param offsets Output position of each field (0 if left out)
+ * @return Position of the table
+ */
+static size_t fb_table(FbBuilder *b, const uint8_t *sizes, size_t n, size_t *offsets)
+{
+    uint16_t inline_size = 4;
+    uint16_t slots[8] = {0};
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (!sizes[i]) continue;
+        inline_size = (uint16_t) ((inline_size + sizes[i] - 1) & ~(sizes[i] - 1));
+        slots[i] = inline_size;
+        inline_size = (uint16_t) (inline_size + sizes[i]);
+    }
+
+    size_t vtable = fb_reserve(b, 4 + 2 * n, 2);
+    size_t table = fb_reserve(b, inline_size, 8);
+
+    fb_u16(b, vtable, (uint16_t) (4 + 2 * n));
+    fb_u16(b, vtable + 2, inline_size);
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        fb_u16(b, vtable + 4 + 2 * i, slots[i]);
+        offsets[i] = slots[i] ? table + slots[i] : 0;
+    }
+
+    // The table starts with the signed distance back to its vtable
+    fb_u32(b, table, (uint32_t) (table - vtable));
+
+    return table;
+}
+
+/**
+ * Lay out a vector, its length placed right before the aligned elements
+ * @param b Builder
+ * @param count Number of elements
+ * @param size Byte size of each element
+ * @param align Alignment of the elements
+ * @return Position of the vector (its length field)
+ */
+static size_t fb_vector(FbBuilder *b, size_t count, size_t size, size_t align)
+{
+    size_t data = (b->len + 4 + align - 1) & ~(align - 1);
+
+    fb_reserve(b, data + count * size - b->len, 1);
+    fb_u32(b, data - 4, (uint32_t) count);
+
+    return data - 4;
+}
+
+/**
+ * Lay out a null terminated string
+ * @param b Builder
+ * @param s String to copy
+ * @return Position of the string (its length field)
+ */
+static size_t fb_string(FbBuilder *b, const char *s)
+{
+    size_t n = strlen(s);
+    size_t pos = fb_vector(b, n, 1, 4);
+
+    fb_reserve(b, 1, 1);
+    if (b->ok) memcpy(b->buf + pos + 4, s, n);
+
+    return pos;
+}
+
+/**
+ * Start an IPC message: the root offset and the Message table
+ * @param b Empty builder
+ * @param header_type Kind of header the message carries
+ * @param body_len Length of the body following the metadata
+ * @return Position of the header offset field, to be pointed at the header table
+ */
+static size_t arrow_message(FbBuilder *b, uint8_t header_type, uint64_t body_len)
+{
+    // version, header_type, header, bodyLength
+    static const uint8_t sizes[] = {2, 1, 4, 8};
+    size_t fields[4];
+
+    size_t root = fb_reserve(b, 4, 4);
+    size_t message = fb_table(b, sizes, 4, fields);
+    fb_ref(b, root, message);
+
+    fb_u16(b, fields[0], ARROW_METADATA_V5);
+    fb_u8(b, fields[1], header_type);
+    fb_u64(b, fields[3], body_len);
+
+    return fields[2];
+}
+
+/**
+ * Write one encapsulated message: continuation marker, metadata length, metadata
+ * The metadata is padded so the body that follows starts 8-byte aligned
+ * @param b Finished builder
+ * @param out Stream to write to
+ * @return true on success, false if the builder overflowed or on a write error
+ */
+static bool arrow_write_message(FbBuilder *b, FILE *out)
+{
+    fb_reserve(b, 0, 8);
+    if (!b->ok) return false;
+
+    uint32_t prefix[2] = {htole32(ARROW_CONTINUATION), htole32((uint32_t) b->len)};
+
+    return fwrite(prefix, sizeof(prefix), 1, out) == 1 && fwrite(b->buf, b->len, 1, out) == 1;
+}
+
+/**
+ * Write the schema message: three non-nullable columns with no children
+ * @param out Stream to write to
+ * @return true on success, false on a write error
+ */
+static bool arrow_write_schema(FILE *out)
+{
+    static const char *names[ARROW_COLUMNS] = {"level", "position", "hash"};
+
+    FbBuilder b = {.ok = true};
+    size_t header = arrow_message(&b, ARROW_HEADER_SCHEMA, 0);
+
+    // endianness (little, the default), fields
+    static const uint8_t schema_sizes[] = {0, 4};
+    size_t schema_fields[2];
+    size_t schema = fb_table(&b, schema_sizes, 2, schema_fields);
+    fb_ref(&b, header, schema);
+
+    size_t list = fb_vector(&b, ARROW_COLUMNS, 4, 4);
+    fb_ref(&b, schema_fields[1], list);
+
+    for (size_t i = 0; i < ARROW_COLUMNS; ++i)
+    {
+        // name, nullable, type_type, type, dictionary, children
+        static const uint8_t field_sizes[] = {4, 1, 1, 4, 0, 4};
+        size_t slots[6];
+        size_t field = fb_table(&b, field_sizes, 6, slots);
+        fb_ref(&b, list + 4 + 4 * i, field);
+
+        fb_ref(&b, slots[0], fb_string(&b, names[i]));
+        fb_u8(&b, slots[1], 0);
+
+        size_t type_slots[2];
+        if (i < 2)
+        {
+            // bitWidth, is_signed
+            static const uint8_t int_sizes[] = {4, 1};
+            fb_u8(&b, slots[2], ARROW_TYPE_INT);
+            fb_ref(&b, slots[3], fb_table(&b, int_sizes, 2, type_slots));
+            fb_u32(&b, type_slots[0], i == 0 ? 8 : 64);
+            fb_u8(&b, type_slots[1], 0);
+        }
+        else
+        {
+            // byteWidth
+            static const uint8_t binary_sizes[] = {4};
+            fb_u8(&b, slots[2], ARROW_TYPE_FIXED_SIZE_BINARY);
+            fb_ref(&b, slots[3], fb_table(&b, binary_sizes, 1, type_slots));
+            fb_u32(&b, type_slots[0], sizeof(bytes32));
+        }
+
+        // Readers insist on a children list, even an empty one
+        fb_ref(&b, slots[5], fb_vector(&b, 0, 4, 4));
+    }
+
+    return arrow_write_message(&b, out);
+}
+
+/**
+ * Column buffers of the record batch being filled
+ */
+typedef struct
+{
+    FILE *out;
+    MMRHashBackend backend;
+
+    uint8_t *levels;
+    uint64_t *positions;
+    bytes32 *hashes;
+
+    size_t capacity;
+    size_t rows;
+    size_t total;
+    bool ok;
+
+    // Level being exported, the position to resume it from and the leaf
+    // count when the export started, past which nothing is exported
+    unsigned level;
+    uint64_t next;
+    uint64_t limit;
+} ArrowBatch;
+
+static inline size_t arrow_pad(size_t n)
+{
+    return (n + 7) & ~(size_t) 7;
+}
+
+/**
+ * Write the filled rows as one record batch message and start a new batch
+ * Each column goes out as a single write straight from its buffer
+ * @param batch Batch being filled
+ * @return true on success, false on a write error now or earlier
+ */
+static bool arrow_flush(ArrowBatch *batch)
+{
+    if (!batch->ok || batch->rows == 0) return batch->ok;
+
+    size_t rows = batch->rows;
+    size_t lengths[ARROW_COLUMNS] = {rows, rows * sizeof(uint64_t), rows * sizeof(bytes32)};
+    const void *columns[ARROW_COLUMNS] = {batch->levels, batch->positions, batch->hashes};
+
+    uint64_t body = 0;
+    for (size_t i = 0; i < ARROW_COLUMNS; ++i) body += arrow_pad(lengths[i]);
+
+    FbBuilder b = {.ok = true};
+    size_t header = arrow_message(&b, ARROW_HEADER_RECORD_BATCH, body);
+
+    // length, nodes, buffers
+    static const uint8_t sizes[] = {8, 4, 4};
+    size_t fields[3];
+    size_t record = fb_table(&b, sizes, 3, fields);
+    fb_ref(&b, header, record);
+    fb_u64(&b, fields[0], rows);
+
+    // One FieldNode (length, null count) per column
+    size_t nodes = fb_vector(&b, ARROW_COLUMNS, 16, 8);
+    fb_ref(&b, fields[1], nodes);
+
+    // Two Buffers (offset, length) per column: an empty validity bitmap, then the values
+    size_t buffers = fb_vector(&b, 2 * ARROW_COLUMNS, 16, 8);
+    fb_ref(&b, fields[2], buffers);
+
+    uint64_t offset = 0;
+    for (size_t i = 0; i < ARROW_COLUMNS; ++i)
+    {
+        fb_u64(&b, nodes + 4 + 16 * i, rows);
+
+        size_t values = buffers + 4 + 16 * (2 * i + 1);
+        fb_u64(&b, values - 16, offset);
+        fb_u64(&b, values, offset);
+        fb_u64(&b, values + 8, lengths[i]);
+
+        offset += arrow_pad(lengths[i]);
+    }
+
+    static const uint8_t zeros[8] = {0};
+    bool ok = arrow_write_message(&b, batch->out);
+
+    for (size_t i = 0; ok && i < ARROW_COLUMNS; ++i)
+    {
+        size_t pad = arrow_pad(lengths[i]) - lengths[i];
+        ok = fwrite(columns[i], lengths[i], 1, batch->out) == 1 && (pad == 0 || fwrite(zeros, pad, 1, batch->out) == 1);
+    }
+
+    batch->total += rows;
+    batch->rows = 0;
+    batch->ok = ok;
+
+    return ok;
+}
+
+/**
+ * Append one row of the level being exported, unless it was taken by an
+ * earlier batch or lies past the end of the export
+ * @param batch Batch being filled
+ * @param position Position of the subtree's first leaf
+ * @param hash Leaf digest or node hash
+ * @return true to carry on, false once the batch is full
+ */
+static inline bool arrow_row(ArrowBatch *batch, uint64_t position, const bytes32 *hash)
+{
+    if (position < batch->next || position + ((uint64_t) 1 << batch->level) > batch->limit) return true;
+    if (batch->rows == batch->capacity) return false;
+
+    batch->levels[batch->rows] = (uint8_t) batch->level;
+    batch->positions[batch->rows] = htole64(position);
+    memcpy(batch->hashes[batch->rows], *hash, sizeof(bytes32));
+
+    ++batch->rows;
+    batch->next = position + ((uint64_t) 1 << batch->level);
+
+    return true;
+}
+
+/**
+ * Export one level of a collapsed subtree, rebuilding it from the chained leaves
+ * @param batch Batch being filled
+ * @param group Root of the collapsed subtree
+ * @param start Position of its first leaf
+ * @return true to carry on, false once the batch is full
+ */
+static bool export_collapsed(ArrowBatch *batch, const MMRNode *group, uint64_t start)
+{
+    unsigned level = batch->level;
+
+    bytes32 hashes[1 << MMR_MAX_SPARSE_HEIGHT];
+    size_t count = 0;
+
+    for (const MMRNode *leaf = group->left; leaf && count < group->n_leaves; leaf = leaf->next)
+    {
+        memcpy(hashes[count++], leaf->hash, sizeof(bytes32));
+    }
+
+    for (unsigned l = 0; l < level; ++l)
+    {
+        count /= 2;
+        merkle_hash_level(batch->backend, hashes, count, hashes);
+    }
+
+    bool ok = true;
+    for (size_t i = 0; ok && i < count; ++i)
+    {
+        ok = arrow_row(batch, start + (i << level), &hashes[i]);
+    }
+
+    return ok;
+}
+
+/**
+ * Export the subtree hashes of the batch's level within a mountain, in leaf order
+ * Subtrees wholly before the resume position or past the end are not entered
+ * Placeholders left by compaction end the descent, since nothing below them is stored
+ * @param batch Batch being filled
+ * @param root Peak of the mountain
+ * @param start Position of the mountain's first leaf
+ * @return true to carry on, false once the batch is full
+ */
+static bool export_level(ArrowBatch *batch, const MMRNode *root, uint64_t start)
+{
+    unsigned level = batch->level;
+
+    struct
+    {
+        const MMRNode *node;
+        uint64_t start;
+    } stack[2 * MMR_MAX_HEIGHT];
+    size_t top = 0;
+
+    stack[top].node = root;
+    stack[top++].start = start;
+
+    while (top > 0)
+    {
+        const MMRNode *node = stack[--top].node;
+        uint64_t first = stack[top].start;
+        unsigned height = mountain_height(node->n_leaves);
+
+        if (first + node->n_leaves <= batch->next || first >= batch->limit) continue;
+
+        if (height == level)
+        {
+            if (!arrow_row(batch, first, &node->hash)) return false;
+            continue;
+        }
+
+        if (height < level || !node->left) continue;
+
+        if (node_collapsed(node))
+        {
+            if (!export_collapsed(batch, node, first)) return false;
+            continue;
+        }
+
+        // Right first so the left subtree comes off the stack first
+        stack[top].node = node->right;
+        stack[top++].start = first + node->left->n_leaves;
+        stack[top].node = node->left;
+        stack[top++].start = first;
+    }
+
+    return true;
+}
+
+/**
+ * Fill a batch with the next rows of its level, descending from the current peaks
+ * @param acc Pointer to accumulator (caller holds the writer mutex)
+ * @param batch Batch to fill, resumed from batch->next
+ * @return true once the level is done, false if the batch filled up first
+ */
+static bool export_fill(const MMRAccumulator *acc, ArrowBatch *batch)
+{
+    // The root list runs from the newest peak, so fill from the right
+    const MMRNode *peaks[MMR_MAX_HEIGHT];
+    uint64_t starts[MMR_MAX_HEIGHT];
+    unsigned n = 0;
+
+    for (const MMRNode *cur = acc->head; cur && n < MMR_MAX_HEIGHT; cur = cur->next) ++n;
+
+    uint64_t first = leaf_count(acc);
+    unsigned k = n;
+    for (const MMRNode *cur = acc->head; cur && k > 0; cur = cur->next)
+    {
+        --k;
+        first -= cur->n_leaves;
+        peaks[k] = cur;
+        starts[k] = first;
+    }
+
+    for (unsigned i = 0; i < n && starts[i] < batch->limit; ++i)
+    {
+        if (!export_level(batch, peaks[i], starts[i])) return false;
+    }
+
+    return true;
+}
+
+/**
+ * Export leaf digests, and optionally node hashes, as an Arrow IPC stream
+ * Rows come out level by level and in leaf order within a level. Each batch
+ * is filled under the writer mutex, re-descending from the peaks to where the
+ * last one stopped, and written out after the mutex is released, so a slow
+ * stream holds writers off for one batch at a time. Every aligned subtree
+ * within the leaves present at the start lies in one of the mountains of
+ * that moment, so later adds never change what is exported
+ * @param acc Pointer to accumulator
+ * @param out Stream to write to
+ * @param cfg Export configuration, or NULL for leaves only in default batches
+ * @param rows Optional output for the number of rows written
+ * @return true on success, false on invalid parameters, allocation failure or a write error
+ */
+bool mmr_export_arrow(const MMRAccumulator *acc, FILE *out, const MMRExportConfig *cfg, size_t *rows)
+{
+    if (rows) *rows = 0;
+    if (!acc || !out) return false;
+
+    size_t capacity = cfg && cfg->batch_rows ? cfg->batch_rows : ARROW_BATCH_ROWS;
+    if (capacity > SIZE_MAX / sizeof(bytes32)) return false;
+
+    ArrowBatch batch = {0};
+    batch.out = out;
+    batch.backend = acc->hash_backend;
+    batch.capacity = capacity;
+    batch.levels = malloc(batch.capacity);
+    batch.positions = malloc(batch.capacity * sizeof(uint64_t));
+    batch.hashes = malloc(batch.capacity * sizeof(bytes32));
+    batch.ok = batch.levels && batch.positions && batch.hashes && arrow_write_schema(out);
+
+    // Leaves added from here on are left out
+    mmr_write_begin(acc);
+
+    unsigned top = 0;
+    for (const MMRNode *root = acc->head; root; root = root->next)
+    {
+        unsigned height = mountain_height(root->n_leaves);
+        if (height > top) top = height;
+    }
+
+    batch.limit = leaf_count(acc);
+
+    mmr_write_end(acc);
+
+    unsigned levels = cfg && cfg->nodes ? top + 1 : 1;
+
+    for (unsigned level = 0; batch.ok && level < levels; ++level)
+    {
+        batch.level = level;
+        batch.next = 0;
+
+        bool done = false;
+        while (batch.ok && !done)
+        {
+            mmr_write_begin(acc);
+            done = export_fill(acc, &batch);
+            mmr_write_end(acc);
+
+            arrow_flush(&batch);
+        }
+    }
+
+    // End-of-stream marker: a continuation followed by a zero length
+    uint32_t eos[2] = {htole32(ARROW_CONTINUATION), 0};
+    bool ok = batch.ok && fwrite(eos, sizeof(eos), 1, out) == 1;
+
+    if (rows) *rows = batch.total;
+
+    free(batch.levels);
+    free(batch.positions);
+    free(batch.hashes);
+
+    return ok;
+}
+
+// ------------------------- MMR RECONCILE ----------------------------------
+
+// Message kinds, the first byte of every reconciliation message
+#define RECONCILE_REQUEST 1
+#define RECONCILE_RESPONSE 2
+
+// Kind and query count in front of a request, then start and height per query
+#define RECONCILE_REQUEST_HEADER (1 + sizeof(uint32_t))
+#define RECONCILE_QUERY_BYTES (sizeof(uint64_t) + 1)
+
+// Kind, leaf count and answer count in front of a response
+#define RECONCILE_RESPONSE_HEADER (1 + sizeof(uint64_t) + sizeof(uint32_t))
+
+/**
+ * A subtree named by its first leaf position and its height
+ * Both replicas agree on these names for any range they both hold
+ */
+typedef struct
+{
+    uint64_t start;
+    unsigned height;
+} SubtreeRef;
+
+/**
+ * Initiator state of a reconciliation
+ * Queued subtrees are compared in rounds; the queries of the request in
+ * flight are the first in_flight entries of the queue
+ */
+struct MMRReconcile
+{
+    const MMRAccumulator *acc;
+
+    uint64_t local_leaves;
+    uint64_t remote_leaves;
+    bool started;
+
+    SubtreeRef *queue;
+    size_t head;
+    size_t tail;
+    size_t capacity;
+    size_t in_flight;
+
+    MMRLeafRange *ranges;
+    size_t n_ranges;
+    size_t ranges_capacity;
+    bool sorted;
+
+    uint64_t comparisons;
+};
+
+/**
+ * Find the hash of the subtree of 2^height leaves starting at a position
+ * Levels left unstored by a collapsed subtree are rebuilt from its leaves
+ * Caller holds the writer mutex, which keeps every mountain in place
+ * @param acc Pointer to accumulator
+ * @param start Position of the subtree's first leaf, a multiple of its size
+ * @param height Height of the subtree
+ * @param hash Output subtree hash
+ * @return true if the subtree exists and its hash is known, false if it is
+ *         out of range or beneath a placeholder left by compaction
+ */
+static bool subtree_hash(const MMRAccumulator *acc, uint64_t start, unsigned height, bytes32 *hash)
+{
+    if (height >= MMR_MAX_HEIGHT) return false;
+
+    uint64_t size = (uint64_t) 1 << height;
+    if (start % size != 0) return false;
+
+    // Ranges come from the remote side, so reject any past the end without adding
+    uint64_t leaves = leaf_count(acc);
+    if (start >= leaves || size > leaves - start) return false;
+
+    // Every aligned range inside the accumulator lies within a single mountain
+    uint64_t first = leaves;
+    const MMRNode *node = acc->head;
+
+    while (node)
+    {
+        first -= node->n_leaves;
+        if (start >= first) break;
+        node = node->next;
+    }
+
+    if (!node || start + size > first + node->n_leaves) return false;
+
+    while (node->n_leaves > size)
+    {
+        if (!node->left) return false;
+
+        if (node_collapsed(node))
+        {
+            bytes32 hashes[1 << MMR_MAX_SPARSE_HEIGHT];
+            const MMRNode *leaf = node->left;
+
+            for (uint64_t skip = start - first; leaf && skip > 0; --skip) leaf = leaf->next;
+
+            for (uint64_t i = 0; i < size; ++i, leaf = leaf->next)
+            {
+                if (!leaf) return false;
+                memcpy(hashes[i], leaf->hash, sizeof(bytes32));
+            }
+
+            for (uint64_t pairs = size / 2; pairs > 0; pairs /= 2)
+            {
+                merkle_hash_level(acc->hash_backend, hashes, pairs, hashes);
+            }
+
+            memcpy(*hash, hashes[0], sizeof(bytes32));
+            return true;
+        }
+
+        if (start < first + node->left->n_leaves)
+        {
+            node = node->left;
+        }
+        else
+        {
+            first += node->left->n_leaves;
+            node = node->right;
+        }
+    }
+
+    memcpy(*hash, node->hash, sizeof(bytes32));
+
+    return true;
+}
+
+/**
+ * Queue a subtree for comparison
+ * @param r Reconciliation
+ * @param start Position of the subtree's first leaf
+ * @param height Height of the subtree
+ * @return true on success, false on allocation failure
+ */
+static bool reconcile_push(struct MMRReconcile *r, uint64_t start, unsigned height)
+{
+    if (r->tail == r->capacity)
+    {
+        // Reuse the space of answered queries before growing
+        if (r->head > r->capacity / 2)
+        {
+            memmove(r->queue, r->queue + r->head, (r->tail - r->head) * sizeof(SubtreeRef));
+            r->tail -= r->head;
+            r->head = 0;
+        }
+        else
+        {
+            size_t capacity = r->capacity ? r->capacity * 2 : 64;
+            SubtreeRef *queue = realloc(r->queue, capacity * sizeof(SubtreeRef));
+            if (!queue) return false;
+
+            r->queue = queue;
+            r->capacity = capacity;
+        }
+    }
+
+    r->queue[r->tail].start = start;
+    r->queue[r->tail++].height = height;
+
+    return true;
+}
+
+/**
+ * Record a range of leaves on which the replicas differ
+ * @param r Reconciliation
+ * @param start Position of the first differing leaf
+ * @param count Number of leaves in the range
+ * @return true on success, false on allocation failure
+ */
+static bool reconcile_differ(struct MMRReconcile *r, uint64_t start, uint64_t count)
+{
+    if (count == 0) return true;
+
+    if (r->n_ranges == r->ranges_capacity)
+    {
+        size_t capacity = r->ranges_capacity ? r->ranges_capacity * 2 : 16;
+        MMRLeafRange *ranges = realloc(r->ranges, capacity * sizeof(MMRLeafRange));
+        if (!ranges) return false;
+
+        r->ranges = ranges;
+        r->ranges_capacity = capacity;
+    }
+
+    r->ranges[r->n_ranges].start = start;
+    r->ranges[r->n_ranges++].count = count;
+    r->sorted = false;
+
+    return true;
+}
+
+/**
+ * Start reconciling a local accumulator against a remote replica
+ * @param acc Local accumulator, must outlive the reconciliation
+ * @return New reconciliation state, or NULL on failure
+ */
+struct MMRReconcile *mmr_reconcile_start(const MMRAccumulator *acc)
+{
+    if (!acc) return NULL;
+
+    struct MMRReconcile *r = calloc(1, sizeof(struct MMRReconcile));
+    if (!r) return NULL;
+
+    r->acc = acc;
+    r->sorted = true;
+
+    mmr_write_begin(acc);
+    r->local_leaves = leaf_count(acc);
+    mmr_write_end(acc);
+
+    return r;
+}
+
+/**
+ * Free a reconciliation and its results
+ * @param r Reconciliation, may be NULL
+ */
+void mmr_reconcile_free(struct MMRReconcile *r)
+{
+    if (!r) return;
+
+    free(r->queue);
+    free(r->ranges);
+    free(r);
+}
+
+/**
+ * Write the next request to send to the remote replica
+ * The first request only asks for the remote leaf count; later ones ask
+ * for the hashes of as many queued subtrees as fit in the buffer
+ * @param r Reconciliation
+ * @param buf Output buffer
+ * @param cap Capacity of the buffer, at least MMR_RECONCILE_MIN_REQUEST bytes
+ * @param len Output for the request length
+ * @return true if a request was written, false once reconciliation is complete or on invalid parameters
+ */
+bool mmr_reconcile_next(struct MMRReconcile *r, uint8_t *buf, size_t cap, size_t *len)
+{
+    if (len) *len = 0;
+    if (!r || !buf || !len || cap < MMR_RECONCILE_MIN_REQUEST || r->in_flight) return false;
+    if (r->started && r->head == r->tail) return false;
+
+    size_t fit = (cap - RECONCILE_REQUEST_HEADER) / RECONCILE_QUERY_BYTES;
+    size_t n = r->tail - r->head < fit ? r->tail - r->head : fit;
+    if (n > UINT32_MAX) n = UINT32_MAX;
+
+    uint8_t *out = buf;
+    *out++ = RECONCILE_REQUEST;
+
+    uint32_t count = htole32((uint32_t) n);
+    memcpy(out, &count, sizeof(count));
+    out += sizeof(count);
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        const SubtreeRef *ref = &r->queue[r->head + i];
+
+        uint64_t start = htole64(ref->start);
+        memcpy(out, &start, sizeof(start));
+        out += sizeof(start);
+
+        *out++ = (uint8_t) ref->height;
+    }
+
+    r->in_flight = n;
+    *len = (size_t) (out - buf);
+
+    return true;
+}
+
+/**
+ * Answer a reconciliation request from the remote replica
+ * Each queried subtree gets a flag and, when the subtree's hash is known, the hash
+ * Writers are held off while the answer is built, readers carry on
+ * @param acc Accumulator to answer from
+ * @param req Request received
+ * @param req_len Length of the request
+ * @param buf Output buffer for the response
+ * @param cap Capacity of the output buffer
+ * @param len Output for the response length (or the length required, if cap is too small)
+ * @return true on success, false if the request is malformed or the buffer too small
+ */
+bool mmr_reconcile_respond(const MMRAccumulator *acc, const uint8_t *req, size_t req_len, uint8_t *buf, size_t cap,
+                           size_t *len)
+{
+    if (len) *len = 0;
+    if (!acc || !req || !buf || !len || req_len < RECONCILE_REQUEST_HEADER || req[0] != RECONCILE_REQUEST)
+    {
+        return false;
+    }
+
+    uint32_t n;
+    memcpy(&n, req + 1, sizeof(n));
+    n = le32toh(n);
+
+    if ((req_len - RECONCILE_REQUEST_HEADER) / RECONCILE_QUERY_BYTES != n ||
+        (req_len - RECONCILE_REQUEST_HEADER) % RECONCILE_QUERY_BYTES != 0)
+    {
+        return false;
+    }
+
+    // Worst case, every subtree is known
+    *len = RECONCILE_RESPONSE_HEADER + (size_t) n * (1 + sizeof(bytes32));
+    if (cap < *len) return false;
+
+    mmr_write_begin(acc);
+
+    uint8_t *out = buf;
+    *out++ = RECONCILE_RESPONSE;
+
+    uint64_t leaves = htole64(leaf_count(acc));
+    memcpy(out, &leaves, sizeof(leaves));
+    out += sizeof(leaves);
+
+    uint32_t count = htole32(n);
+    memcpy(out, &count, sizeof(count));
+    out += sizeof(count);
+
+    const uint8_t *in = req + RECONCILE_REQUEST_HEADER;
+
+    for (uint32_t i = 0; i < n; ++i, in += RECONCILE_QUERY_BYTES)
+    {
+        uint64_t start;
+        memcpy(&start, in, sizeof(start));
+
+        bytes32 hash;
+        bool known = subtree_hash(acc, le64toh(start), in[sizeof(start)], &hash);
+
+        *out++ = known;
+        if (!known) continue;
+
+        memcpy(out, hash, sizeof(bytes32));
+        out += sizeof(bytes32);
+    }
+
+    mmr_write_end(acc);
+
+    *len = (size_t) (out - buf);
+
+    return true;
+}
+
+/**
+ * Process the remote replica's response to the last request
+ * Matching subtrees are settled; differing ones are split into their two
+ * halves for the next round, down to single leaves. A subtree whose hash
+ * either side cannot produce is reported whole, as is any range of leaves
+ * only one replica holds
+ * On failure the state is left as it was, so the call can be retried
+ * @param r Reconciliation
+ * @param resp Response received
+ * @param len Length of the response
+ * @return true on success, false if the response is malformed or on allocation failure
+ */
+bool mmr_reconcile_receive(struct MMRReconcile *r, const uint8_t *resp, size_t len)
+{
+    if (!r || !resp || len < RECONCILE_RESPONSE_HEADER || resp[0] != RECONCILE_RESPONSE) return false;
+
+    uint64_t leaves;
+    memcpy(&leaves, resp + 1, sizeof(leaves));
+    leaves = le64toh(leaves);
+
+    uint32_t n;
+    memcpy(&n, resp + 1 + sizeof(leaves), sizeof(n));
+    n = le32toh(n);
+
+    if (n != r->in_flight) return false;
+
+    const uint8_t *in = resp + RECONCILE_RESPONSE_HEADER;
+    const uint8_t *end = resp + len;
+    bool ok = true;
+
+    // Pushing may compact the queue, so remember its length rather than its tail
+    size_t queued = r->tail - r->head;
+    size_t n_ranges = r->n_ranges;
+    uint64_t comparisons = r->comparisons;
+
+    if (!r->started)
+    {
+        if (in != end) return false;
+
+        // Compare the mountains of the shared prefix; the rest only one side holds
+        uint64_t shared = leaves < r->local_leaves ? leaves : r->local_leaves;
+        uint64_t longer = leaves < r->local_leaves ? r->local_leaves : leaves;
+        uint64_t start = 0;
+
+        for (int h = MMR_MAX_HEIGHT - 1; ok && h >= 0; --h)
+        {
+            if (!(shared >> h & 1)) continue;
+
+            ok = reconcile_push(r, start, (unsigned) h);
+            start += (uint64_t) 1 << h;
+        }
+
+        ok = ok && reconcile_differ(r, shared, longer - shared);
+
+        if (!ok)
+        {
+            r->tail = r->head + queued;
+            r->n_ranges = n_ranges;
+            return false;
+        }
+
+        r->remote_leaves = leaves;
+        r->started = true;
+
+        return true;
+    }
+
+    mmr_write_begin(r->acc);
+
+    for (uint32_t i = 0; ok && i < n; ++i)
+    {
+        if (in >= end || (*in && (size_t) (end - in) < 1 + sizeof(bytes32)))
+        {
+            ok = false;
+            break;
+        }
+
+        bool known = *in++;
+        const uint8_t *remote = in;
+        if (known) in += sizeof(bytes32);
+
+        SubtreeRef ref = r->queue[r->head + i];
+
+        bytes32 local;
+        bool found = subtree_hash(r->acc, ref.start, ref.height, &local);
+
+        ++r->comparisons;
+
+        if (known && found && memcmp(local, remote, sizeof(bytes32)) == 0) continue;
+
+        if (known && found && ref.height > 0)
+        {
+            uint64_t half = (uint64_t) 1 << (ref.height - 1);
+            ok = reconcile_push(r, ref.start, ref.height - 1) && reconcile_push(r, ref.start + half, ref.height - 1);
+        }
+        else
+        {
+            ok = reconcile_differ(r, ref.start, (uint64_t) 1 << ref.height);
+        }
+    }
+
+    mmr_write_end(r->acc);
+
+    if (!ok || in != end)
+    {
+        // Drop the halves queued and ranges recorded for this response
+        r->tail = r->head + queued;
+        r->n_ranges = n_ranges;
+        r->comparisons = comparisons;
+        return false;
+    }
+
+    r->head += r->in_flight;
+    r->in_flight = 0;
+
+    return true;
+}
+
+static int leaf_range_cmp(const void *a, const void *b)
+{
+    const MMRLeafRange *x = a;
+    const MMRLeafRange *y = b;
+
+    return (x->start > y->start) - (x->start < y->start);
+}
+
+/**
+ * Get the leaf ranges found to differ so far, sorted and with neighbours merged
+ * @param r Reconciliation
+ * @param ranges Output pointer to the ranges, valid until the next call on r
+ * @param comparisons Optional output for the number of subtree hashes compared
+ * @return Number of ranges
+ */
+size_t mmr_reconcile_result(struct MMRReconcile *r, const MMRLeafRange **ranges, uint64_t *comparisons)
+{
+    if (ranges) *ranges = NULL;
+    if (comparisons) *comparisons = 0;
+    if (!r) return 0;
+
+    if (!r->sorted && r->n_ranges > 0)
+    {
+        qsort(r->ranges, r->n_ranges, sizeof(MMRLeafRange), leaf_range_cmp);
+
+        size_t kept = 0;
+        for (size_t i = 1; i < r->n_ranges; ++i)
+        {
+            MMRLeafRange *last = &r->ranges[kept];
+
+            if (r->ranges[i].start <= last->start + last->count)
+            {
+                uint64_t end = r->ranges[i].start + r->ranges[i].count;
+                if (end > last->start + last->count) last->count = end - last->start;
+            }
+            else
+            {
+                r->ranges[++kept] = r->ranges[i];
+            }
+        }
+
+        r->n_ranges = kept + 1;
+    }
+
+    r->sorted = true;
+
+    if (ranges) *ranges = r->ranges;
+    if (comparisons) *comparisons = r->comparisons;
+
+    return r->n_ranges;
+}
+
+// ------------------------- MMR FRONTIER -----------------------------------
+
+/**
+ * Drop the siblings a client can supply from its cached frontier
+ * A full witness climbs to the peak of its mountain; a client caching the
+ * levels down to depth below each peak needs only the part below that
+ * @param w Witness to trim in place; the siblings array itself is left untouched
+ * @param depth Number of levels below the peaks the client caches
+ * @return true on success, false if the witness is invalid
+ */
+bool mmr_witness_trim(MMRWitness *w, unsigned depth)
+{
+    if (!w || w->n_siblings > WITNESS_MAX_SIBLINGS) return false;
+
+    uint16_t keep = depth < w->n_siblings ? (uint16_t) (w->n_siblings - depth) : 0;
+
+    w->n_siblings = keep;
+    w->path &= ((uint64_t) 1 << keep) - 1;
+
+    return true;
+}
+
+static int frontier_node_cmp(const void *a, const void *b)
+{
+    return memcmp(((const MMRFrontierNode *) a)->hash, ((const MMRFrontierNode *) b)->hash, sizeof(bytes32));
+}
+
+/**
+ * Snapshot the frontier a client caches: the level depth below every peak
+ * Mountains no taller than depth contribute their leaves. The peaks and
+ * every level in between follow from these nodes
+ * @param acc Pointer to accumulator
+ * @param depth Number of levels below the peaks to cache
+ * @param f Frontier to fill, freed with mmr_frontier_free()
+ * @return true on success, false on invalid parameters or allocation failure
+ */
+bool mmr_frontier_init(const MMRAccumulator *acc, unsigned depth, MMRFrontier *f)
+{
+    if (!f) return false;
+
+    memset(f, 0, sizeof(MMRFrontier));
+    if (!acc || depth >= MMR_MAX_HEIGHT) return false;
+
+    f->depth = depth;
+    f->hash_backend = acc->hash_backend;
+
+    mmr_write_begin(acc);
+
+    f->leaves = leaf_count(acc);
+
+    size_t capacity = 0;
+    for (const MMRNode *root = acc->head; root; root = root->next)
+    {
+        unsigned height = mountain_height(root->n_leaves);
+        capacity += (size_t) 1 << (height < depth ? height : depth);
+    }
+
+    f->nodes = malloc((capacity ? capacity : 1) * sizeof(MMRFrontierNode));
+    bool ok = f->nodes != NULL;
+
+    uint64_t end = f->leaves;
+
+    for (const MMRNode *root = acc->head; ok && root; root = root->next)
+    {
+        uint64_t start = end - root->n_leaves;
+        unsigned height = mountain_height(root->n_leaves);
+        unsigned cut = height > depth ? height - depth : 0;
+
+        // Subtrees beneath compaction placeholders are gone, and so are their proofs
+        for (uint64_t first = start; first < end; first += (uint64_t) 1 << cut)
+        {
+            MMRFrontierNode *node = &f->nodes[f->count];
+            if (!subtree_hash(acc, first, cut, &node->hash)) continue;
+
+            node->start = first;
+            node->height = (uint16_t) cut;
+            ++f->count;
+        }
+
+        end = start;
+    }
+
+    mmr_write_end(acc);
+
+    if (!ok)
+    {
+        mmr_frontier_free(f);
+        return false;
+    }
+
+    qsort(f->nodes, f->count, sizeof(MMRFrontierNode), frontier_node_cmp);
+
+    return true;
+}
+
+/**
+ * Free the nodes of a frontier
+ * @param f Frontier to free
+ */
+void mmr_frontier_free(MMRFrontier *f)
+{
+    if (!f) return;
+
+    free(f->nodes);
+    memset(f, 0, sizeof(MMRFrontier));
+}
+
+/**
+ * Verify a witness against a client's cached frontier instead of an accumulator
+ * The path is folded level by level and accepted as soon as it reaches a
+ * cached node of the same height, so trimmed and full witnesses both verify
+ * @param f Frontier the client holds
+ * @param w Witness, typically trimmed to the frontier's depth
+ * @return true if the witness leads to a cached node, false otherwise
+ */
+bool mmr_frontier_verify(const MMRFrontier *f, const MMRWitness *w)
+{
+    if (!f || !w || f->count == 0) return false;
+    if (w->n_siblings > 0 && !w->siblings) return false;
+    if (w->n_siblings > WITNESS_MAX_SIBLINGS) return false;
+    if (w->path >= (1ULL << w->n_siblings)) return false;
+
+    bytes32 levels[WITNESS_MAX_SIBLINGS + 1];
+    if (!fold_witness(f->hash_backend, w, levels)) return false;
+
+    for (uint16_t i = 0; i <= w->n_siblings; ++i)
+    {
+        MMRFrontierNode key;
+        memcpy(key.hash, levels[i], sizeof(bytes32));
+
+        const MMRFrontierNode *node = bsearch(&key, f->nodes, f->count, sizeof(MMRFrontierNode), frontier_node_cmp);
+        if (node && node->height == i) return true;
+    }
+
+    return false;
+}
+
+// -------------------------- MMR MIGRATION ---------------------------------
+
+// Leaves of a migration built on one thread before being grafted, a multiple of every sparse group
+#define MIGRATE_PART_LEAVES (1u << 16)
+
+/**
+ * State shared by the threads of a migration
+ * Part i holds leaves [i * MIGRATE_PART_LEAVES, (i + 1) * MIGRATE_PART_LEAVES)
+ * in an accumulator of its own, so the threads share no tracker
+ */
+typedef struct
+{
+    const MMRAccumulator *src;
+    const MMRAccumulator *dst;
+    MMRLeafSource source;
+    void *ctx;
+    MMRLeafMapping *mapping;
+
+    // Source peaks from the oldest, with the position of their first leaf
+    const MMRNode *peaks[MMR_MAX_HEIGHT];
+    uint64_t starts[MMR_MAX_HEIGHT];
+    unsigned n_peaks;
+
+    uint64_t leaves;
+    MMRAccumulator *parts;
+    bool failed;
+} Migration;
+
+/**
+ * Copy the digests of a subtree's leaves that fall in [lo, hi)
+ * Leaves beneath a placeholder left by compaction stay unknown
+ * @param node Subtree root
+ * @param start Position of the subtree's first leaf
+ * @param lo First position wanted
+ * @param hi One past the last position wanted
+ * @param hashes Output digests, indexed from lo
+ * @param known Output flags set for every digest copied, indexed from lo
+ */
+static void migrate_old_leaves(const MMRNode *node, uint64_t start, uint64_t lo, uint64_t hi, bytes32 *hashes,
+                               bool *known)
+{
+    if (start >= hi || start + node->n_leaves <= lo || node_pruned(node)) return;
+
+    if (node->n_leaves == 1)
+    {
+        memcpy(hashes[start - lo], node->hash, sizeof(bytes32));
+        known[start - lo] = true;
+        return;
+    }
+
+    if (node_collapsed(node))
+    {
+        uint64_t pos = start;
+        for (const MMRNode *leaf = node->left; leaf && pos < hi; leaf = leaf->next, ++pos)
+        {
+            if (pos < lo) continue;
+
+            memcpy(hashes[pos - lo], leaf->hash, sizeof(bytes32));
+            known[pos - lo] = true;
+        }
+
+        return;
+    }
+
+    migrate_old_leaves(node->left, start, lo, hi, hashes, known);
+    migrate_old_leaves(node->right, start + node->left->n_leaves, lo, hi, hashes, known);
+}
+
+/**
+ * Fill the mapping for a run of leaves, checking each element against the source
+ * @param m Migration state
+ * @param pos Position of the first leaf of the run
+ * @param elems Elements of the run, from the leaf source
+ * @param hashes New leaf hashes of the run
+ * @param len Number of leaves in the run, at most ADD_BATCH_CHUNK
+ * @return true on success, false if an element does not hash to its source leaf
+ */
+static bool migrate_map(const Migration *m, uint64_t pos, const MMRElement *elems, const bytes32 *hashes,
+                        size_t len)
+{
+    bytes32 old[ADD_BATCH_CHUNK];
+    bool known[ADD_BATCH_CHUNK] = {false};
+
+    for (unsigned k = 0; k < m->n_peaks; ++k)
+    {
+        migrate_old_leaves(m->peaks[k], m->starts[k], pos, pos + len, old, known);
+    }
+
+    for (size_t i = 0; i < len; ++i)
+    {
+        MMRLeafMapping *entry = &m->mapping[pos + i];
+
+        if (!leaf_hash(m->src->hash_backend, NULL, elems[i].data, elems[i].n, &entry->old_hash)) return false;
+        if (known[i] && !hashes_equal(&entry->old_hash, &old[i])) return false;
+
+        memcpy(entry->new_hash, hashes[i], sizeof(bytes32));
+        entry->checked = known[i];
+    }
+
+    return true;
+}
+
+/**
+ * Build a range of parts, each into its own accumulator
+ * @param ctx Pointer to the Migration
+ * @param begin First part to build
+ * @param end One past the last part to build
+ */
+static void migrate_range(void *ctx, size_t begin, size_t end)
+{
+    Migration *m = ctx;
+
+    MMRConfig cfg = {.sparse_height = m->dst->sparse_height, .hash_backend = m->dst->hash_backend};
+    MMRElement elems[ADD_BATCH_CHUNK];
+    bytes32 hashes[ADD_BATCH_CHUNK];
+
+    for (size_t i = begin; i < end; ++i)
+    {
+        if (__atomic_load_n(&m->failed, __ATOMIC_RELAXED)) return;
+
+        MMRAccumulator *part = &m->parts[i];
+        bool ok = mmr_init_config(part, &cfg);
+
+        uint64_t lo = (uint64_t) i * MIGRATE_PART_LEAVES;
+        uint64_t hi = m->leaves - lo < MIGRATE_PART_LEAVES ? m->leaves : lo + MIGRATE_PART_LEAVES;
+
+        for (uint64_t pos = lo; ok && pos < hi;)
+        {
+            size_t len = hi - pos < ADD_BATCH_CHUNK ? (size_t) (hi - pos) : ADD_BATCH_CHUNK;
+
+            for (size_t j = 0; ok && j < len; ++j)
+            {
+                ok = m->source(m->ctx, pos + j, &elems[j]) && elems[j].data && elems[j].n > 0;
+            }
+
+            if (ok)
+            {
+                leaf_hash_batch(part->hash_backend, NULL, elems, len, hashes);
+
+                ok = (!m->mapping || migrate_map(m, pos, elems, hashes, len)) &&
+                     append_chunk(part, hashes, len, NULL);
+            }
+
+            pos += len;
+        }
+
+        if (!ok)
+        {
+            __atomic_store_n(&m->failed, true, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+}
+
+/**
+ * Graft the finished parts onto an empty accumulator, oldest first
+ * Each part's tracker is moved over whole and its peaks appended largest
+ * first, so only the few levels above the parts are hashed here
+ * @param dst Pointer to the empty destination accumulator (caller holds its writer mutex)
+ * @param m Migration whose parts are all built
+ * @return true on success, false on allocation failure
+ */
+static bool migrate_graft(MMRAccumulator *dst, Migration *m)
+{
+    if (m->leaves == 0) return true;
+
+    size_t n_parts = (m->leaves + MIGRATE_PART_LEAVES - 1) / MIGRATE_PART_LEAVES;
+
+    // Every mountain of the result is locked, since all of them are new
+    unsigned top = 63 - (unsigned) __builtin_clzll(m->leaves);
+
+    if (dst->sync)
+    {
+        for (unsigned h = 0; h <= top; ++h) rwlock_acquire(dst, &dst->sync->mountains[h], true);
+    }
+
+    mmr_lock_tracker(dst, true);
+
+    // One table for everything, with room for the nodes merged above the parts
+    size_t total = n_parts + MMR_MAX_HEIGHT;
+    for (size_t i = 0; i < n_parts; ++i) total += m->parts[i].tracker.count;
+
+    bool ok = mmr_tr_reserve(&dst->tracker, total);
+
+    for (size_t i = 0; ok && i < n_parts; ++i)
+    {
+        MMRAccumulator *part = &m->parts[i];
+
+        const MMRNode *cur = part->head;
+        MMRNode *peaks[MMR_MAX_HEIGHT];
+        unsigned n = 0;
+
+        for (; cur && n < MMR_MAX_HEIGHT; cur = cur->next) peaks[n++] = (MMRNode *) cur;
+
+        ok = mmr_tr_absorb(&dst->tracker, &part->tracker);
+        if (ok) part->head = NULL;
+
+        // The root list runs from the smallest peak, so graft from its end
+        while (ok && n > 0) ok = append_node(dst, peaks[--n]);
+    }
+
+    mmr_unlock_tracker(dst);
+
+    if (dst->sync)
+    {
+        for (unsigned h = 0; h <= top; ++h) pthread_rwlock_unlock(&dst->sync->mountains[h]);
+    }
+
+    if (ok) MMR_STAT_ADD(dst, adds, m->leaves);
+
+    return ok;
+}
+
+/**
+ * Copy every spent mark of one bitmap into another
+ * @param to Bitmap to mark positions in
+ * @param from Bitmap to copy
+ * @return true on success, false on allocation failure
+ */
+static bool spent_copy(struct MMRSpent *to, const struct MMRSpent *from)
+{
+    for (size_t i = 0; i < from->count; ++i)
+    {
+        const SpentContainer *c = &from->containers[i];
+        uint64_t base = c->key << SPENT_CONTAINER_BITS;
+
+        if (!c->bits)
+        {
+            for (uint32_t j = 0; j < c->card; ++j)
+            {
+                if (spent_set(to, base + c->array[j]) < 0) return false;
+            }
+
+            continue;
+        }
+
+        for (uint32_t w = 0; w < SPENT_BITMAP_WORDS; ++w)
+        {
+            for (uint64_t bits = c->bits[w]; bits; bits &= bits - 1)
+            {
+                if (spent_set(to, base + w * 64 + (uint64_t) __builtin_ctzll(bits)) < 0) return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Replace the marks of one time index with those of another
+ * @param to Index to fill
+ * @param from Index to copy
+ * @return true on success, false on allocation failure
+ */
+static bool times_copy(struct MMRTimes *to, const struct MMRTimes *from)
+{
+    if (!times_reserve(to, from->count)) return false;
+
+    if (from->count > 0)
+    {
+        memcpy(to->keys, from->keys, from->count * sizeof(uint64_t));
+        memcpy(to->starts, from->starts, from->count * sizeof(uint64_t));
+    }
+
+    to->count = from->count;
+    return true;
+}
+
+/**
+ * Rebuild an accumulator under another hash backend from the elements behind its leaves
+ * Leaves are split into parts of MIGRATE_PART_LEAVES built on separate threads
+ * and grafted together at the end. Writers of both accumulators are held off
+ * throughout. With a mapping every element is also hashed under the source
+ * backend in the same pass and checked against the source leaf
+ * @param src Pointer to accumulator to migrate
+ * @param dst Pointer to an empty accumulator initialised with the new backend
+ * @param source Callback supplying the element of each leaf position
+ * @param ctx Context pointer passed through to source
+ * @param mapping Optional output array of mmr_leaf_count(src) old and new leaf hashes
+ * @param n_threads Maximum number of threads to use (0 or 1 works on the calling thread,
+ *                  MMR_THREADS_AUTO as tuned)
+ * @return true on success, false on invalid parameters, a missing or mismatched
+ *         element or allocation failure; dst is then to be destroyed
+ */
+bool mmr_migrate(const MMRAccumulator *src, MMRAccumulator *dst, MMRLeafSource source, void *ctx,
+                 MMRLeafMapping *mapping, unsigned n_threads)
+{
+    if (!src || !dst || src == dst || !source) return false;
+
+    mmr_write_begin(src);
+    mmr_write_begin(dst);
+
+    Migration m = {.src = src, .dst = dst, .source = source, .ctx = ctx, .mapping = mapping};
+    m.leaves = leaf_count(src);
+
+    // The root list runs from the newest peak, so fill from the right
+    for (const MMRNode *cur = src->head; cur; cur = cur->next) ++m.n_peaks;
+
+    uint64_t end = m.leaves;
+    unsigned k = m.n_peaks;
+    for (const MMRNode *cur = src->head; cur; cur = cur->next)
+    {
+        --k;
+        end -= cur->n_leaves;
+        m.peaks[k] = cur;
+        m.starts[k] = end;
+    }
+
+    size_t n_parts = (m.leaves + MIGRATE_PART_LEAVES - 1) / MIGRATE_PART_LEAVES;
+    m.parts = calloc(n_parts ? n_parts : 1, sizeof(MMRAccumulator));
+
+    bool ok = m.parts && !dst->head;
+
+    if (ok)
+    {
+        parallel_for(n_parts, tuned_threads(dst, m.leaves, n_threads), migrate_range, &m);
+        ok = !m.failed && migrate_graft(dst, &m);
+    }
+
+    // Spent marks are keyed by position, which the migration preserves
+    if (ok && src->spent && dst->spent)
+    {
+        mmr_spent_lock(src);
+        mmr_spent_lock(dst);
+        ok = spent_copy(dst->spent, src->spent);
+        mmr_spent_unlock(dst);
+        mmr_spent_unlock(src);
+    }
+
+    // So are time marks, under the writer mutexes already held
+    if (ok && src->times && dst->times) ok = times_copy(dst->times, src->times);
+
+    for (size_t i = 0; m.parts && i < n_parts; ++i) mmr_destroy(&m.parts[i]);
+    free(m.parts);
+
+    mmr_write_end(dst);
+    mmr_write_end(src);
+
+    return ok;
+}
+
+// ---------------------------- MMR TUNING ----------------------------------
+
+// Repetitions of each kernel timing
+#define TUNE_KERNEL_REPS 20000
+
+// Threads started and joined to time thread start-up
+#define TUNE_SPAWNS 16
+
+// Leaves added for each batch chunk candidate, and hashed for each thread count
+#define TUNE_BATCH_LEAVES (1u << 15)
+#define TUNE_THREAD_LEAVES (1u << 16)
+
+// Margin in percent a candidate must win by before it replaces the simpler choice
+#define TUNE_SLACK 10
+
+// Magic and version of a tuning profile, followed by its fields as little-endian 32-bit words
+static const uint8_t tuning_file_magic[5] = {'M', 'M', 'R', 'T', 1};
+#define TUNING_FILE_FIELDS 7
+
+/**
+ * Fill in the built-in tuning: 256 leaves per batch pass and a single thread
+ * @param t Profile to fill
+ */
+void mmr_tuning_default(MMRTuning *t)
+{
+    if (!t) return;
+
+    memset(t, 0, sizeof(MMRTuning));
+    t->batch_chunk = ADD_BATCH_CHUNK;
+    t->threads = 1;
+    t->parallel_min = 1;
+}
+
+/**
+ * Average a timing over the items it covered, saturating at UINT32_MAX
+ * @param start Time the measurement started
+ * @param n Number of items timed
+ * @return Nanoseconds per item
+ */
+static uint32_t tune_per_item(const struct timespec *start, size_t n)
+{
+    uint64_t ns = elapsed_ns(start) / n;
+    return ns > UINT32_MAX ? UINT32_MAX : (uint32_t) ns;
+}
+
+/**
+ * Time the leaf and node hash kernels and tracker insertion
+ * Each hash feeds the next so the work cannot be hoisted out of the loop
+ * @param t Profile to fill in
+ * @param backend Hash backend to time
+ * @return true on success, false on allocation failure
+ */
+static bool tune_kernels(MMRTuning *t, MMRHashBackend backend)
+{
+    bytes32 hash = {0};
+    struct timespec start;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < TUNE_KERNEL_REPS; ++i) leaf_hash(backend, NULL, hash, sizeof(hash), &hash);
+    t->leaf_hash_ns = tune_per_item(&start, TUNE_KERNEL_REPS);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < TUNE_KERNEL_REPS; ++i) node_hash(backend, &hash, &hash, &hash);
+    t->node_hash_ns = tune_per_item(&start, TUNE_KERNEL_REPS);
+
+    MMRTracker tracker;
+    mmr_tr_init(&tracker);
+    if (!tracker.items) return false;
+
+    bool ok = true;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; ok && i < TUNE_KERNEL_REPS; ++i)
+    {
+        MMRNode *leaf;
+        memcpy(hash, &i, sizeof(i));
+        ok = create_leaf(&tracker, &hash, &leaf);
+    }
+    t->insert_ns = tune_per_item(&start, TUNE_KERNEL_REPS);
+
+    mmr_tr_destroy(&tracker);
+
+    return ok;
+}
+
+static void *tune_idle(void *arg)
+{
+    return arg;
+}
+
+/**
+ * Time starting and joining a thread that does nothing
+ * @param t Profile to fill in
+ */
+static void tune_spawn(MMRTuning *t)
+{
+    struct timespec start;
+    size_t spawned = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (size_t i = 0; i < TUNE_SPAWNS; ++i)
+    {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, tune_idle, NULL) != 0) continue;
+
+        pthread_join(thread, NULL);
+        ++spawned;
+    }
+
+    t->spawn_ns = spawned ? tune_per_item(&start, spawned) : UINT32_MAX;
+}
+
+/**
+ * Pick the batch chunk that adds a run of leaves fastest
+ * Every candidate fills a fresh scratch accumulator built from cfg, and the
+ * best of two runs counts so a single disturbance does not decide. The
+ * default is kept unless another chunk clearly beats it
+ * @param t Profile to fill in
+ * @param cfg Configuration of the scratch accumulators
+ * @param elems Elements to add, TUNE_BATCH_LEAVES of them
+ * @return true on success, false if a scratch accumulator could not be built
+ */
+static bool tune_batch_chunk(MMRTuning *t, const MMRConfig *cfg, const MMRElement *elems)
+{
+    MMRConfig scratch = *cfg;
+    MMRTuning candidate = *t;
+    scratch.tuning = &candidate;
+
+    uint64_t best = UINT64_MAX;
+    uint64_t fallback = UINT64_MAX;
+    unsigned fastest = ADD_BATCH_CHUNK;
+
+    for (unsigned chunk = 32; chunk <= MMR_MAX_BATCH_CHUNK; chunk *= 2)
+    {
+        candidate.batch_chunk = chunk;
+
+        for (int run = 0; run < 2; ++run)
+        {
+            MMRAccumulator acc;
+            if (!mmr_init_config(&acc, &scratch)) return false;
+
+            struct timespec start;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+
+            bool ok = mmr_add_batch(&acc, elems, TUNE_BATCH_LEAVES);
+            uint64_t ns = elapsed_ns(&start);
+
+            mmr_destroy(&acc);
+            if (!ok) return false;
+
+            if (chunk == ADD_BATCH_CHUNK && ns < fallback) fallback = ns;
+
+            if (ns < best)
+            {
+                best = ns;
+                fastest = chunk;
+            }
+        }
+    }
+
+    t->batch_chunk = best * (100 + TUNE_SLACK) < fallback * 100 ? fastest : ADD_BATCH_CHUNK;
+
+    return true;
+}
+
+/**
+ * Elements hashed while timing a thread count
+ */
+typedef struct
+{
+    MMRHashBackend backend;
+    const MMRElement *elems;
+    bytes32 *hashes;
+} TuneHash;
+
+static void tune_hash_range(void *ctx, size_t begin, size_t end)
+{
+    TuneHash *work = ctx;
+    leaf_hash_batch(work->backend, NULL, work->elems + begin, end - begin, work->hashes + begin);
+}
+
+/**
+ * Pick the fewest threads that hash a large batch about as fast as any count
+ * Counts double up to the number of online cores, which is tried as well
+ * @param t Profile to fill in
+ * @param backend Hash backend to time
+ * @param elems Elements to hash, TUNE_THREAD_LEAVES of them
+ * @param max_threads Most threads to consider, 0 for every online core
+ * @return true on success, false on allocation failure
+ */
+static bool tune_threads(MMRTuning *t, MMRHashBackend backend, const MMRElement *elems, unsigned max_threads)
+{
+    long online = 1;
+#ifdef _SC_NPROCESSORS_ONLN
+    online = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+    unsigned cores = online > 1 ? (unsigned) online : 1;
+    if (max_threads && max_threads < cores) cores = max_threads;
+
+    TuneHash work = {.backend = backend, .elems = elems};
+    work.hashes = malloc(TUNE_THREAD_LEAVES * sizeof(bytes32));
+    if (!work.hashes) return false;
+
+    unsigned counts[MMR_MAX_HEIGHT];
+    uint64_t times[MMR_MAX_HEIGHT];
+    unsigned n = 0;
+    uint64_t best = UINT64_MAX;
+
+    for (unsigned threads = 1; n < MMR_MAX_HEIGHT; threads = threads * 2 < cores ? threads * 2 : cores)
+    {
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        parallel_for(TUNE_THREAD_LEAVES, threads, tune_hash_range, &work);
+
+        counts[n] = threads;
+        times[n] = elapsed_ns(&start);
+        if (times[n] < best) best = times[n];
+        ++n;
+
+        if (threads == cores) break;
+    }
+
+    free(work.hashes);
+
+    // Counts were tried in increasing order, so the first good enough is the fewest
+    for (unsigned i = 0; i < n; ++i)
+    {
+        if (times[i] * 100 <= best * (100 + TUNE_SLACK))
+        {
+            t->threads = counts[i];
+            break;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Measure the current host and derive a tuning profile from it
+ * Kernel, tracker and thread start-up costs are measured directly, the batch
+ * chunk and thread count by timing real batch work at each candidate value
+ * A thread is then only worth starting for enough leaf hashes to cover twice
+ * its start-up cost
+ * @param t Profile to fill
+ * @param cfg Configuration of the accumulators the profile is meant for, or NULL
+ * @param max_threads Most threads to consider, 0 for every online core
+ * @return true on success, false on invalid parameters or allocation failure
+ */
+bool mmr_tune(MMRTuning *t, const MMRConfig *cfg, unsigned max_threads)
+{
+    if (!t) return false;
+
+    MMRConfig base;
+    if (cfg)
+    {
+        base = *cfg;
+    }
+    else
+    {
+        memset(&base, 0, sizeof(MMRConfig));
+    }
+
+    if (!hash_supported(base.hash_backend)) return false;
+
+    MMRTuning tuned;
+    mmr_tuning_default(&tuned);
+
+    size_t count = TUNE_THREAD_LEAVES > TUNE_BATCH_LEAVES ? TUNE_THREAD_LEAVES : TUNE_BATCH_LEAVES;
+    uint64_t *data = malloc(count * 4 * sizeof(uint64_t));
+    MMRElement *elems = malloc(count * sizeof(MMRElement));
+
+    bool ok = data && elems;
+
+    // Distinct 32-byte elements, the size of a typical transaction or output id
+    for (size_t i = 0; ok && i < count; ++i)
+    {
+        data[4 * i] = htole64(i + 1);
+        data[4 * i + 1] = data[4 * i + 2] = data[4 * i + 3] = 0;
+
+        elems[i].data = (const uint8_t *) &data[4 * i];
+        elems[i].n = 4 * sizeof(uint64_t);
+    }
+
+    ok = ok && tune_kernels(&tuned, base.hash_backend);
+    if (ok) tune_spawn(&tuned);
+
+    ok = ok && tune_batch_chunk(&tuned, &base, elems) && tune_threads(&tuned, base.hash_backend, elems, max_threads);
+
+    if (ok)
+    {
+        uint64_t items = tuned.leaf_hash_ns ? 2ULL * tuned.spawn_ns / tuned.leaf_hash_ns : TUNE_THREAD_LEAVES;
+        if (items < 1) items = 1;
+        if (items > TUNE_THREAD_LEAVES) items = TUNE_THREAD_LEAVES;
+
+        tuned.parallel_min = (unsigned) items;
+        *t = tuned;
+    }
+
+    free(data);
+    free(elems);
+
+    return ok;
+}
+
+/**
+ * Write a tuning profile to a stream
+ * @param t Profile to write
+ * @param out Stream to write to
+ * @return true on success, false on invalid parameters or a write error
+ */
+bool mmr_tuning_save(const MMRTuning *t, FILE *out)
+{
+    if (!t || !out || !tuning_valid(t)) return false;
+
+    uint32_t fields[TUNING_FILE_FIELDS] = {t->batch_chunk,  t->threads,   t->parallel_min, t->leaf_hash_ns,
+                                           t->node_hash_ns, t->insert_ns, t->spawn_ns};
+
+    for (size_t i = 0; i < TUNING_FILE_FIELDS; ++i) fields[i] = htole32(fields[i]);
+
+    return fwrite(tuning_file_magic, sizeof(tuning_file_magic), 1, out) == 1 &&
+           fwrite(fields, sizeof(fields), 1, out) == 1;
+}
+
+/**
+ * Read a tuning profile written by mmr_tuning_save()
+ * @param t Profile to fill, left unchanged on failure
+ * @param in Stream to read from
+ * @return true on success, false on a read error or an invalid profile
+ */
+bool mmr_tuning_load(MMRTuning *t, FILE *in)
+{
+    if (!t || !in) return false;
+
+    uint8_t magic[sizeof(tuning_file_magic)];
+    if (fread(magic, sizeof(magic), 1, in) != 1 || memcmp(magic, tuning_file_magic, sizeof(magic)) != 0)
+    {
+        return false;
+    }
+
+    uint32_t fields[TUNING_FILE_FIELDS];
+    if (fread(fields, sizeof(fields), 1, in) != 1) return false;
+
+    for (size_t i = 0; i < TUNING_FILE_FIELDS; ++i) fields[i] = le32toh(fields[i]);
+
+    MMRTuning loaded = {
+        .batch_chunk = fields[0],
+        .threads = fields[1],
+        .parallel_min = fields[2],
+        .leaf_hash_ns = fields[3],
+        .node_hash_ns = fields[4],
+        .insert_ns = fields[5],
+        .spawn_ns = fields[6],
+    };
+
+    if (!tuning_valid(&loaded)) return false;
+
+    *t = loaded;
+    return true;
+}
+
+// --------------------------- MMR ITERATOR ---------------------------------
+
+// Leaves a collapsed chain is prefetched ahead of the one being yielded
+#define ITER_PREFETCH_LEAVES 8
+
+/**
+ * Position of a scan between batches
+ * Only positions are kept, never node pointers, so writers may add and
+ * compact freely between batches
+ */
+struct MMRIter
+{
+    const MMRAccumulator *acc;
+    uint64_t next;
+    uint64_t end;
+};
+
+/**
+ * Output of the batch being filled
+ */
+typedef struct
+{
+    uint64_t *positions;
+    bytes32 *digests;
+    size_t cap;
+    size_t count;
+
+    // Next position wanted and one past the last
+    uint64_t next;
+    uint64_t end;
+} IterBatch;
+
+/**
+ * Yield one leaf into the batch
+ * @param b Batch being filled (not yet full)
+ * @param pos Position of the leaf
+ * @param leaf Leaf node
+ */
+static inline void iter_yield(IterBatch *b, uint64_t pos, const MMRNode *leaf)
+{
+    if (b->positions) b->positions[b->count] = pos;
+    memcpy(b->digests[b->count], leaf->hash, sizeof(bytes32));
+
+    ++b->count;
+    b->next = pos + 1;
+}
+
+/**
+ * Yield the wanted leaves of a collapsed subtree by walking its leaf chain
+ * The chain is prefetched a few leaves ahead, since each leaf is its own allocation
+ * @param b Batch being filled
+ * @param group Root of the collapsed subtree
+ * @param start Position of its first leaf
+ * @return true if the walk got past the subtree, false once the batch is full or the range is done
+ */
+static bool iter_collapsed(IterBatch *b, const MMRNode *group, uint64_t start)
+{
+    const MMRNode *leaf = group->left;
+    uint64_t pos = start;
+
+    for (; leaf && pos < b->next; ++pos) leaf = leaf->next;
+
+    const MMRNode *ahead = leaf;
+    for (unsigned i = 0; ahead && i < ITER_PREFETCH_LEAVES; ++i) ahead = ahead->next;
+
+    for (; leaf && pos < b->end; leaf = leaf->next, ++pos)
+    {
+        if (b->count == b->cap) return false;
+
+        if (ahead)
+        {
+            __builtin_prefetch(ahead);
+            ahead = ahead->next;
+        }
+
+        iter_yield(b, pos, leaf);
+    }
+
+    return pos < b->end;
+}
+
+/**
+ * Yield the wanted leaves of a subtree in position order
+ * Subtrees wholly before the resume position are skipped without being
+ * entered, so resuming costs one descent; placeholders left by compaction
+ * are skipped, leaving a gap in the positions
+ * @param b Batch being filled
+ * @param node Subtree root
+ * @param start Position of the subtree's first leaf
+ * @return true to carry on with the next subtree, false once the batch is full or the range is done
+ */
+static bool iter_subtree(IterBatch *b, const MMRNode *node, uint64_t start)
+{
+    uint64_t end = start + node->n_leaves;
+
+    if (end <= b->next) return true;
+    if (start >= b->end) return false;
+
+    if (node_pruned(node))
+    {
+        b->next = end;
+        return true;
+    }
+
+    if (node->n_leaves == 1)
+    {
+        if (b->count == b->cap) return false;
+
+        iter_yield(b, start, node);
+        return true;
+    }
+
+    if (node_collapsed(node)) return iter_collapsed(b, node, start);
+
+    // The right half is needed next, so start fetching it while the left is walked
+    __builtin_prefetch(node->right);
+
+    return iter_subtree(b, node->left, start) && iter_subtree(b, node->right, start + node->left->n_leaves);
+}
+
+/**
+ * Start a scan of the leaves in a range of positions, in insertion order
+ * @param acc Pointer to accumulator, which must outlive the scan
+ * @param start Position of the first leaf to yield
+ * @param count Number of positions to cover, UINT64_MAX for every leaf from start
+ * @return New iterator, freed with mmr_iter_free(), or NULL on invalid parameters or allocation failure
+ */
+struct MMRIter *mmr_iter_start(const MMRAccumulator *acc, uint64_t start, uint64_t count)
+{
+    if (!acc) return NULL;
+
+    struct MMRIter *it = malloc(sizeof(struct MMRIter));
+    if (!it) return NULL;
+
+    mmr_write_begin(acc);
+    uint64_t leaves = leaf_count(acc);
+    mmr_write_end(acc);
+
+    // Leaves added after the scan starts are left out
+    it->acc = acc;
+    it->next = start < leaves ? start : leaves;
+    it->end = count < leaves - it->next ? it->next + count : leaves;
+
+    return it;
+}
+
+/**
+ * Yield the next batch of leaves of a scan
+ * Writers are held off only while the batch is filled, which resumes with
+ * a single descent from the peaks
+ * @param it Iterator
+ * @param positions Optional output array of cap leaf positions
+ * @param digests Output array of cap leaf digests
+ * @param cap Capacity of the output arrays
+ * @return Number of leaves yielded, 0 once the range is exhausted
+ */
+size_t mmr_iter_next(struct MMRIter *it, uint64_t *positions, bytes32 *digests, size_t cap)
+{
+    if (!it || !digests || cap == 0 || it->next >= it->end) return 0;
+
+    const MMRAccumulator *acc = it->acc;
+
+    IterBatch b = {.positions = positions, .digests = digests, .cap = cap, .next = it->next, .end = it->end};
+
+    mmr_write_begin(acc);
+
+    // The root list runs from the newest peak, so fill from the right
+    const MMRNode *peaks[MMR_MAX_HEIGHT];
+    uint64_t starts[MMR_MAX_HEIGHT];
+    unsigned n = 0;
+
+    for (const MMRNode *cur = acc->head; cur && n < MMR_MAX_HEIGHT; cur = cur->next) ++n;
+
+    uint64_t first = leaf_count(acc);
+    unsigned k = n;
+    for (const MMRNode *cur = acc->head; cur && k > 0; cur = cur->next)
+    {
+        --k;
+        first -= cur->n_leaves;
+        peaks[k] = cur;
+        starts[k] = first;
+    }
+
+    bool more = true;
+    for (unsigned i = 0; more && i < n; ++i) more = iter_subtree(&b, peaks[i], starts[i]);
+
+    mmr_write_end(acc);
+
+    // Stopping short of a full batch means the rest of the range was reclaimed or yielded
+    it->next = b.count < cap ? b.end : b.next;
+
+    return b.count;
+}
+
+/**
+ * Free an iterator
+ * @param it Iterator, may be NULL
+ */
+void mmr_iter_free(struct MMRIter *it)
+{
+    free(it);
+}
+
+// -------------------------- MMR TIME INDEX --------------------------------
+
+/**
+ * Find the first mark whose key is at least a given key
+ * Heights and clock times tend to grow evenly, so probes interpolate between
+ * the bounds, alternating with bisection so that uneven keys still take at
+ * most twice the steps of a binary search
+ * @param times Index to search
+ * @param key Key to look for
+ * @return Index of the first mark with a key >= key, or the mark count if none
+ */
+static size_t times_lower_bound(const struct MMRTimes *times, uint64_t key)
+{
+    size_t lo = 0;
+    size_t hi = times->count;
+    bool bisect = false;
+
+    while (lo < hi)
+    {
+        uint64_t first = times->keys[lo];
+        uint64_t last = times->keys[hi - 1];
+
+        if (key <= first) return lo;
+        if (key > last) return hi;
+
+        // first < key <= last, so the probe lands in [lo, hi - 1]
+        size_t mid = lo + (hi - lo) / 2;
+        if (!bisect)
+        {
+            double frac = (double) (key - first) / (double) (last - first);
+            mid = lo + (size_t) (frac * (double) (hi - 1 - lo));
+            if (mid > hi - 1) mid = hi - 1;
+        }
+        bisect = !bisect;
+
+        if (times->keys[mid] < key)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+/**
+ * Record that the leaves added from now on carry a key, such as a block
+ * height or timestamp, until the next mark
+ * Marking the last key again is a no-op, and a mark that never received a
+ * leaf is overwritten by the next one
+ * @param acc Pointer to accumulator with cfg->time_index
+ * @param key Key of the leaves to follow, at least the previous mark's key
+ * @return true on success, false without an index, on a decreasing key or allocation failure
+ */
+bool mmr_time_mark(MMRAccumulator *acc, uint64_t key)
+{
+    if (!acc || !acc->times) return false;
+
+    mmr_write_begin(acc);
+
+    struct MMRTimes *times = acc->times;
+    uint64_t start = leaf_count(acc);
+    size_t last = times->count - 1;
+    bool ok = true;
+
+    if (times->count > 0 && key < times->keys[last])
+    {
+        ok = false;
+    }
+    else if (times->count > 0 && key == times->keys[last])
+    {
+        // The leaves keep counting towards the current mark
+    }
+    else if (times->count > 0 && times->starts[last] == start)
+    {
+        times->keys[last] = key;
+    }
+    else if ((ok = times_reserve(times, times->count + 1)))
+    {
+        times->keys[times->count] = key;
+        times->starts[times->count] = start;
+        ++times->count;
+    }
+
+    mmr_write_end(acc);
+
+    return ok;
+}
+
+/**
+ * Look up the positions of the leaves added under keys in an inclusive range
+ * Leaves added before the first mark carry no key and are never included
+ * @param acc Pointer to accumulator with cfg->time_index
+ * @param from Smallest key to include
+ * @param to Largest key to include
+ * @param range Output run of leaf positions, empty if no leaf matches
+ * @return true on success, false on invalid parameters or without an index
+ */
+bool mmr_time_range(const MMRAccumulator *acc, uint64_t from, uint64_t to, MMRLeafRange *range)
+{
+    if (!acc || !acc->times || !range) return false;
+
+    mmr_write_begin(acc);
+
+    const struct MMRTimes *times = acc->times;
+    uint64_t leaves = leaf_count(acc);
+
+    size_t first = times_lower_bound(times, from);
+    size_t end = to == UINT64_MAX ? times->count : times_lower_bound(times, to + 1);
+
+    uint64_t start = first < times->count ? times->starts[first] : leaves;
+    uint64_t stop = end < times->count ? times->starts[end] : leaves;
+
+    mmr_write_end(acc);
+
+    range->start = start;
+    range->count = from <= to && stop > start ? stop - start : 0;
+
+    return true;
+}
+
+/**
+ * Start a scan of the leaves added under keys in an inclusive range
+ * @param acc Pointer to accumulator with cfg->time_index, which must outlive the scan
+ * @param from Smallest key to include
+ * @param to Largest key to include
+ * @return New iterator, freed with mmr_iter_free(), or NULL on invalid parameters,
+ *         without an index or on allocation failure
+ */
+struct MMRIter *mmr_iter_time(const MMRAccumulator *acc, uint64_t from, uint64_t to)
+{
+    MMRLeafRange range;
+    if (!mmr_time_range(acc, from, to, &range)) return NULL;
+
+    return mmr_iter_start(acc, range.start, range.count);
 }
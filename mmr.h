@@ -11,6 +11,36 @@
 typedef uint8_t bytes32[SHA256_DIGEST_LENGTH];
 typedef uint8_t merkle64[SHA256_DIGEST_LENGTH * 2];
 
+// Deepest possible inclusion proof, bounded by the 64-bit witness path
+#define WITNESS_MAX_SIBLINGS 63
+
+// Tallest subtree whose interior levels may be left unstored
+#define MMR_MAX_SPARSE_HEIGHT 8
+
+/**
+ * Precomputed hash state for a fixed prefix hashed in front of elements
+ * Lets tagged leaves (e.g. BIP-340 style domain separation) resume from the
+ * prefix midstate instead of rehashing the prefix and copying every element
+ */
+typedef struct
+{
+    SHA256_CTX ctx;
+    size_t n;
+} MMRPrefix;
+
+/**
+ * Hash function an accumulator uses for its leaves and interior nodes
+ * Every backend yields 32-byte digests, so witnesses and their encodings are
+ * the same size whichever is chosen
+ */
+typedef enum
+{
+    MMR_HASH_SHA256 = 0,
+    MMR_HASH_SHA3_256,
+    MMR_HASH_BLAKE2S_256,
+    MMR_HASH_SHA512_256,
+} MMRHashBackend;
+
 // --------------------------- MMR FOREST -----------------------------------
 
 /**
@@ -27,7 +57,8 @@ typedef struct MMRNode
     struct MMRNode *left;
     struct MMRNode *right;
 
-    // Only relevant for root nodes
+    // Links root nodes together, and chains the leaves
+    // of a collapsed subtree in order (see MMRConfig)
     struct MMRNode *next;
 } MMRNode;
 
@@ -62,6 +93,10 @@ typedef struct MMRItem
     MMRWitness witness;
     MMRNode *witness_root;
 
+    // Cached wire encoding of the witness, built on first request
+    uint8_t *encoded;
+    size_t encoded_len;
+
     struct MMRItem *next;
 } MMRItem;
 
@@ -84,8 +119,158 @@ typedef struct
     size_t count;
 } MMRTracker;
 
+// ------------------------- MMR STATISTICS ---------------------------------
+
+// Hardware events sampled per operation, by bit in MMRStats.perf_events
+enum
+{
+    MMR_PERF_CYCLES,
+    MMR_PERF_INSTRUCTIONS,
+    MMR_PERF_LLC_MISSES,
+    MMR_PERF_DTLB_MISSES,
+    MMR_PERF_BRANCH_MISSES,
+    MMR_PERF_EVENTS
+};
+
+// Sampled operations, indexing MMRStats.perf
+enum
+{
+    MMR_OP_ADD,
+    MMR_OP_WITNESS,
+    MMR_OP_VERIFY,
+    MMR_OP_TRACKER,
+    MMR_OPS
+};
+
+/**
+ * Latency and hardware counter totals for one kind of operation
+ * Divide by ops for per-operation figures
+ */
+typedef struct
+{
+    uint64_t ops;
+    uint64_t ns;
+    uint64_t events[MMR_PERF_EVENTS];
+} MMRPerfCounters;
+
+/**
+ * Running operation counters for an accumulator
+ * All fields are uint64_t so snapshots can be taken field by field
+ * Intended for benchmarks and workload generators that need to report
+ * witness cache effectiveness alongside latency
+ * A stale miss is a miss where a cached witness existed but its root
+ * had since been merged away by later additions
+ */
+typedef struct
+{
+    uint64_t adds;
+    uint64_t verifies;
+
+    uint64_t witness_hits;
+    uint64_t witness_misses;
+    uint64_t witness_stale;
+
+    // Lock acquisitions that had to block, and the total time spent blocked
+    uint64_t lock_waits;
+    uint64_t lock_wait_ns;
+
+    // Per-operation figures, only collected with cfg->perf_counters
+    // Bit i of perf_events is set once event i could be counted; other events stay 0
+    // Tracker figures cover hash table lookups, which also count towards the enclosing op
+    uint64_t perf_events;
+    MMRPerfCounters perf[MMR_OPS];
+} MMRStats;
+
 // ------------------------ MMR ACCUMULATOR ---------------------------------
 
+// Most leaves a batch add may hash per pass, see MMRTuning
+#define MMR_MAX_BATCH_CHUNK 1024
+
+// Thread count asking a batch call for the thread count its accumulator was tuned to
+#define MMR_THREADS_AUTO 0xFFFFFFFFu
+
+/**
+ * Host specific tuning profile, measured by mmr_tune() and kept with mmr_tuning_save()
+ * The accumulator acts on the first three fields; the measured costs are
+ * kept so profiles from different hosts can be compared
+ */
+typedef struct
+{
+    // Leaves hashed per pass of a batch add or pipeline stage before they are merged
+    unsigned batch_chunk;
+
+    // Threads batch calls use when given MMR_THREADS_AUTO, and the default
+    // number of pipeline hash workers
+    unsigned threads;
+
+    // Fewest items worth starting a thread for in a batch call
+    unsigned parallel_min;
+
+    // Costs measured on the host, in nanoseconds
+    uint32_t leaf_hash_ns;
+    uint32_t node_hash_ns;
+    uint32_t insert_ns;
+    uint32_t spawn_ns;
+} MMRTuning;
+
+/**
+ * Optional behaviour selected when initialising an accumulator
+ * A zeroed configuration gives the same accumulator as mmr_init()
+ */
+typedef struct
+{
+    // Guard each mountain (peak subtree) with its own reader/writer lock so that
+    // mmr_witness and mmr_verify may run on many threads while another thread
+    // calls mmr_add, blocking only on the mountains an add actually merges
+    // Readers should then use mmr_witness_into to own their proof data
+    bool concurrent;
+
+    // Keep only the root and leaves of every complete subtree of this height,
+    // freeing the levels in between. mmr_witness recomputes them on demand,
+    // costing up to 2^sparse_height - 2 extra hashes per cold witness and
+    // saving roughly that many nodes per 2^sparse_height leaves
+    // 0 (or 1) stores every level; at most MMR_MAX_SPARSE_HEIGHT
+    unsigned sparse_height;
+
+    // Sample latency and hardware counters (cycles, instructions, LLC, dTLB and
+    // branch misses) around every add, witness, verify and tracker lookup
+    // Each sample costs a few system calls, so this is meant for benchmarks only
+    // Events the kernel refuses to count are left out, latency is always kept
+    bool perf_counters;
+
+    // Allow mmr_remove and mmr_spend to tombstone leaves in a compact bitmap
+    // keyed by leaf position; spent leaves get no more witnesses and fully
+    // spent subtrees are reclaimed by mmr_compact
+    bool tombstones;
+
+    // Hash function for leaves and interior nodes, SHA-256 when zeroed
+    // Only SHA-256 has the single-block fast paths, and prefix midstates are
+    // SHA-256 states, so tagged operations fail under any other backend
+    MMRHashBackend hash_backend;
+
+    // Tuning profile from mmr_tune() or mmr_tuning_load(), copied at
+    // initialisation; NULL keeps the built-in defaults
+    const MMRTuning *tuning;
+
+    // Keep a side index of user keys, such as timestamps or block heights, to
+    // the leaf positions added under them; see mmr_time_mark and mmr_time_range
+    // Costs 16 bytes per mark, not per leaf
+    bool time_index;
+} MMRConfig;
+
+// Opaque lock set, only allocated for concurrent accumulators
+struct MMRSync;
+
+// Opaque spent-leaf bitmap and background compactor, only allocated with tombstones
+struct MMRSpent;
+struct MMRCompactor;
+
+// Opaque background warm-up thread, see mmr_warm()
+struct MMRWarmer;
+
+// Opaque time index, only allocated with cfg->time_index
+struct MMRTimes;
+
 /**
  * Merkle Mountain Range accumulator for incremental set membership proofs
  * Maintains a forest of perfect binary trees
@@ -100,8 +285,41 @@ typedef struct
 {
     MMRNode *head;
     MMRTracker tracker;
+
+    // Heap allocated so counters can be updated through const accumulators
+    MMRStats *stats;
+    struct MMRSync *sync;
+    struct MMRSpent *spent;
+    struct MMRCompactor *compactor;
+    struct MMRWarmer *warmer;
+    struct MMRTimes *times;
+
+    unsigned sparse_height;
+    bool perf_counters;
+    MMRHashBackend hash_backend;
+    MMRTuning tuning;
 } MMRAccumulator;
 
+/**
+ * A single element of a batch operation
+ * Points at caller owned data that must stay valid for the duration of the call
+ */
+typedef struct
+{
+    const uint8_t *data;
+    size_t n;
+} MMRElement;
+
+/**
+ * A single entry of a batch verification
+ * Pairs a witness with the accumulator it should be checked against
+ */
+typedef struct
+{
+    const MMRAccumulator *acc;
+    const MMRWitness *witness;
+} MMRVerifyRequest;
+
 /**
  * Initialize an empty MMR accumulator
  * Sets up the internal data structures for storing MMR nodes and witnesses
@@ -110,6 +328,22 @@ typedef struct
  */
 void mmr_init(MMRAccumulator *acc);
 
+/**
+ * Initialize an empty MMR accumulator with optional behaviour
+ * Behaves like mmr_init() and additionally applies the given configuration
+ * CONCURRENCY: With cfg->concurrent set, mmr_witness() read-locks only the
+ * mountain holding the leaf and mmr_verify() hashes without locks, briefly
+ * sharing the root lookup. mmr_add() write-locks just the small mountains it
+ * merges, so readers of larger mountains are not held up by appends. Writers
+ * are serialized among themselves. Witness siblings from mmr_witness() remain owned by
+ * the tracker and may be freed once another thread changes the accumulator
+ * roots - use mmr_witness_into() to get a copy that is safe to keep
+ * @param acc Pointer to accumulator structure to initialize
+ * @param cfg Configuration to apply, or NULL for defaults
+ * @return true on success, false if the configuration could not be applied
+ */
+bool mmr_init_config(MMRAccumulator *acc, const MMRConfig *cfg);
+
 /**
  * Destroy MMR accumulator and free all associated memory
  * Cleans up all nodes, witnesses, hash table, and internal data structures
@@ -120,6 +354,19 @@ void mmr_init(MMRAccumulator *acc);
  */
 void mmr_destroy(MMRAccumulator *acc);
 
+/**
+ * Destroy MMR accumulator without blocking on the teardown
+ * Detaches every node, witness and the tracker from the accumulator right away,
+ * then frees them in bounded steps on a detached background thread, so that
+ * replacing a very large accumulator does not stall the calling thread
+ * Falls back to freeing synchronously if no thread can be started
+ * After calling this function, the accumulator is invalid until re-initialised
+ * No other thread may be using the accumulator when this is called
+ * @param acc Pointer to accumulator to destroy
+ * @return true if the teardown runs in the background, false if it ran synchronously
+ */
+bool mmr_destroy_deferred(MMRAccumulator *acc);
+
 /**
  * Add element to MMR accumulator
  * Creates a leaf node for the element and merges it with existing roots
@@ -131,15 +378,133 @@ void mmr_destroy(MMRAccumulator *acc);
  */
 bool mmr_add(MMRAccumulator *acc, const uint8_t *e, size_t n);
 
+/**
+ * Add element to MMR accumulator with its leaf hash taken over prefix || e
+ * @param acc Pointer to accumulator to add element to
+ * @param prefix Prefix registered with mmr_prefix_init, or NULL for no prefix
+ * @param e Element data to add to the accumulator
+ * @param n Size of element data in bytes (must be > 0)
+ * @return true on successful addition, false on failure or invalid parameters
+ */
+bool mmr_add_tagged(MMRAccumulator *acc, const MMRPrefix *prefix, const uint8_t *e, size_t n);
+
+/**
+ * Add a batch of elements to MMR accumulator
+ * Equivalent to calling mmr_add() for each element in order, but hashes the
+ * elements in chunks ahead of merging them and takes the writer lock once per chunk
+ * Elements of up to 55 bytes are hashed with a single SHA-256 compression
+ * The whole batch is rejected if any element is invalid; concurrent readers
+ * may observe the batch partially applied while it is being added
+ * @param acc Pointer to accumulator to add elements to
+ * @param elems Elements to add, in order (each must have n > 0)
+ * @param count Number of elements in the batch
+ * @return true if every element was added, false on failure or invalid parameters
+ */
+bool mmr_add_batch(MMRAccumulator *acc, const MMRElement *elems, size_t count);
+
+/**
+ * Add a batch of elements to MMR accumulator, each hashed as prefix || e
+ * @param acc Pointer to accumulator to add elements to
+ * @param prefix Prefix registered with mmr_prefix_init, or NULL for no prefix
+ * @param elems Elements to add, in order (each must have n > 0)
+ * @param count Number of elements in the batch
+ * @return true if every element was added, false on failure or invalid parameters
+ */
+bool mmr_add_batch_tagged(MMRAccumulator *acc, const MMRPrefix *prefix, const MMRElement *elems, size_t count);
+
+/**
+ * Get the sibling capacity mmr_add_batch_witness() needs for a batch
+ * Exact as long as no other thread adds elements before the batch runs
+ * @param acc Pointer to accumulator the batch will be added to
+ * @param count Number of elements in the batch
+ * @return Number of bytes32 entries to allocate for the siblings
+ */
+size_t mmr_add_batch_witness_size(const MMRAccumulator *acc, size_t count);
+
+/**
+ * Add a batch of elements and emit a witness for each new leaf
+ * Behaves like mmr_add_batch_tagged() and additionally reads every new leaf's
+ * proof off the tree while it is being built, instead of re-hashing the
+ * elements and walking the tree again in mmr_witness()
+ * The witnesses prove membership against the roots right after the batch
+ * MEMORY OWNERSHIP: witnesses[i].siblings points into the caller's siblings
+ * buffer, which the caller keeps owning; the witness cache is not touched
+ * Nothing is added if cap is too small; see mmr_add_batch_witness_size()
+ * @param acc Pointer to accumulator to add elements to
+ * @param prefix Prefix registered with mmr_prefix_init, or NULL for no prefix
+ * @param elems Elements to add, in order (each must have n > 0)
+ * @param count Number of elements in the batch
+ * @param witnesses Output array of count witnesses, in element order
+ * @param siblings Output buffer the witness siblings are packed into
+ * @param cap Capacity of siblings in bytes32 entries
+ * @return true if every element was added and witnessed, false otherwise
+ */
+bool mmr_add_batch_witness(MMRAccumulator *acc, const MMRPrefix *prefix, const MMRElement *elems, size_t count,
+                           MMRWitness *witnesses, bytes32 *siblings, size_t cap);
+
 /**
  * Remove element from MMR accumulator using witness
- * TODO: This function is currently unimplemented
+ * Requires cfg->tombstones: the leaf is marked spent in the tombstone bitmap
+ * and the trees are left as they are, so no peak or other proof changes
+ * Witness requests for the leaf fail from then on, while witnesses handed
+ * out earlier keep verifying until the peaks move on
  * @param acc Pointer to accumulator to remove element from
  * @param w Witness proving the element's membership for safe removal
- * @return true on successful removal, false on failure
- *       */
+ * @return true on successful removal, false if the witness is invalid or the leaf already spent
+ */
 bool mmr_remove(MMRAccumulator *acc, const MMRWitness *w);
 
+/**
+ * Mark an element as spent without checking a witness
+ * Same as mmr_remove() for callers that have already authenticated the element
+ * @param acc Pointer to accumulator in tombstone mode
+ * @param e Element data
+ * @param n Size of element data in bytes
+ * @return true if the element was newly marked, false if it is unknown or already spent
+ */
+bool mmr_spend(MMRAccumulator *acc, const uint8_t *e, size_t n);
+
+/**
+ * Get the number of leaves marked spent
+ * @param acc Pointer to accumulator
+ * @return Number of tombstoned leaves, 0 without cfg->tombstones
+ */
+uint64_t mmr_spent_count(const MMRAccumulator *acc);
+
+/**
+ * Get the number of leaves added so far
+ * @param acc Pointer to accumulator
+ * @return Number of leaves, spent or not
+ */
+uint64_t mmr_leaf_count(const MMRAccumulator *acc);
+
+/**
+ * Reclaim the memory of fully spent subtrees
+ * Each maximal subtree whose leaves are all spent is freed down to its root,
+ * which stays behind as a placeholder hash for its live neighbours' proofs
+ * In sparse mode only subtrees of at least 2^sparse_height leaves are reclaimed
+ * @param acc Pointer to accumulator in tombstone mode
+ * @return Number of nodes freed
+ */
+size_t mmr_compact(MMRAccumulator *acc);
+
+/**
+ * Run mmr_compact() periodically on a background thread
+ * Requires a concurrent accumulator in tombstone mode; the accumulator
+ * structure must not move while the compactor runs
+ * @param acc Pointer to accumulator
+ * @param interval_ms Time between compaction passes in milliseconds
+ * @return true if the compactor was started, false otherwise
+ */
+bool mmr_compact_start(MMRAccumulator *acc, unsigned interval_ms);
+
+/**
+ * Stop the background compactor, waiting for a running pass to finish
+ * Called by mmr_destroy(), so only needed to stop compaction early
+ * @param acc Pointer to accumulator
+ */
+void mmr_compact_stop(MMRAccumulator *acc);
+
 /**
  * Verify witness against MMR accumulator
  * Reconstructs the root hash by following the witness path and sibling hashes
@@ -151,6 +516,45 @@ bool mmr_remove(MMRAccumulator *acc, const MMRWitness *w);
  */
 bool mmr_verify(const MMRAccumulator *acc, const MMRWitness *w);
 
+/**
+ * Verify a batch of witnesses against one or more accumulators
+ * Requests are sorted by accumulator and the hash chains spread over up to
+ * n_threads threads; each witness takes its target's tracker read lock for
+ * its own root lookup, as in mmr_verify()
+ * Each request is checked exactly as mmr_verify() would check it
+ * @param reqs Array of (accumulator, witness) pairs to verify
+ * @param n Number of requests in the batch
+ * @param results Optional output array of n flags, true where the witness verified
+ * @param n_threads Maximum number of threads to use (0 or 1 verifies on the calling thread,
+ *                  MMR_THREADS_AUTO as tuned, taking the fewest threads any target's tuning allows)
+ * @return Number of requests whose witness verified
+ */
+size_t mmr_verify_batch(const MMRVerifyRequest *reqs, size_t n, bool *results, unsigned n_threads);
+
+/**
+ * Apply a block: verify every input witness, then add every output, as one operation
+ * Inputs are verified in parallel against the peaks from before the block, while
+ * the outputs are hashed in the same pass; the outputs are added only if every
+ * input verified. Other writers are held off throughout, and readers see either
+ * the peaks from before the block or those after it, never a partial block.
+ * The outputs are built into subtrees before any reader lock is taken, so
+ * readers wait only while those are grafted on, a few hashes per touched height
+ * As with mmr_add_batch(), an allocation failure while appending may leave a
+ * prefix of the outputs added
+ * @param acc Pointer to accumulator
+ * @param prefix Prefix registered with mmr_prefix_init to hash the outputs under, or NULL
+ * @param inputs Witnesses of the elements the block spends
+ * @param n_inputs Number of inputs
+ * @param outputs Elements the block creates, in order (each must have n > 0)
+ * @param n_outputs Number of outputs
+ * @param results Optional output array of n_inputs flags, true where the input verified
+ * @param n_threads Maximum number of threads to use (0 or 1 works on the calling thread,
+ *                  MMR_THREADS_AUTO as tuned)
+ * @return true if every input verified and every output was added, false otherwise
+ */
+bool mmr_apply_block(MMRAccumulator *acc, const MMRPrefix *prefix, const MMRWitness *inputs, size_t n_inputs,
+                     const MMRElement *outputs, size_t n_outputs, bool *results, unsigned n_threads);
+
 /**
  * Create witness for element in MMR accumulator
  * Generates a Merkle inclusion proof by collecting sibling hashes along
@@ -168,4 +572,738 @@ bool mmr_verify(const MMRAccumulator *acc, const MMRWitness *w);
  */
 bool mmr_witness(const MMRAccumulator *acc, MMRWitness *w, const uint8_t *e, size_t n);
 
+/**
+ * Create witness for an element that was added with mmr_add_tagged()
+ * Same ownership rules as mmr_witness()
+ * @param acc Pointer to accumulator containing the element
+ * @param prefix Prefix the element was added under, or NULL for no prefix
+ * @param w Witness structure to populate with proof data
+ * @param e Element data to create witness for
+ * @param n Size of element data in bytes (must be > 0)
+ * @return true on successful witness generation, false if element not found or failure
+ */
+bool mmr_witness_tagged(const MMRAccumulator *acc, const MMRPrefix *prefix, MMRWitness *w, const uint8_t *e,
+                        size_t n);
+
+/**
+ * Create witness for element with siblings written to caller owned storage
+ * Same proof as mmr_witness(), but the siblings are copied out of the cache
+ * so they stay valid regardless of later changes to the accumulator
+ * Prefer this over mmr_witness() when other threads may call mmr_add()
+ * @param acc Pointer to accumulator containing the element
+ * @param w Witness structure to populate, w->siblings is set to siblings
+ * @param siblings Caller owned array with room for WITNESS_MAX_SIBLINGS hashes
+ * @param e Element data to create witness for
+ * @param n Size of element data in bytes (must be > 0)
+ * @return true on successful witness generation, false if element not found or failure
+ */
+bool mmr_witness_into(const MMRAccumulator *acc, MMRWitness *w, bytes32 *siblings, const uint8_t *e, size_t n);
+
+/**
+ * Create witness for a leaf by its digest, as yielded by mmr_iter_next()
+ * Same ownership rules as mmr_witness_into()
+ * @param acc Pointer to accumulator containing the leaf
+ * @param w Witness structure to populate, w->siblings is set to siblings
+ * @param siblings Caller owned array with room for WITNESS_MAX_SIBLINGS hashes
+ * @param digest Leaf digest to create witness for
+ * @return true on successful witness generation, false if the leaf is not found, spent or on failure
+ */
+bool mmr_witness_leaf_into(const MMRAccumulator *acc, MMRWitness *w, bytes32 *siblings, const bytes32 *digest);
+
+/**
+ * Fetch the proof for an element in the compact wire encoding
+ * The encoded bytes are cached alongside the witness and rebuilt only when
+ * the cached witness is invalidated by a change to its root, so serving an
+ * unchanged proof costs a lookup and a copy
+ * @param acc Pointer to accumulator containing the element
+ * @param e Element data to fetch the proof for
+ * @param n Size of element data in bytes (must be > 0)
+ * @param buf Output buffer for the encoded proof
+ * @param cap Capacity of the output buffer in bytes
+ * @param len Output for the encoded size, set even when cap is too small
+ * @return true on success, false if the element is not found or buf is too small
+ */
+bool mmr_witness_bytes(const MMRAccumulator *acc, const uint8_t *e, size_t n, uint8_t *buf, size_t cap, size_t *len);
+
+/**
+ * Take a snapshot of the accumulator's operation counters
+ * @param acc Pointer to accumulator to read counters from
+ * @param stats Output structure to populate (zeroed if counters are unavailable)
+ */
+void mmr_stats(const MMRAccumulator *acc, MMRStats *stats);
+
+/**
+ * Reset all operation counters of the accumulator to zero
+ * Useful for separating a warm-up phase from a measured phase
+ * @param acc Pointer to accumulator whose counters should be cleared
+ */
+void mmr_stats_reset(MMRAccumulator *acc);
+
+/**
+ * Write a per-operation report of latency and hardware counters
+ * Events that were unavailable are shown as "-"
+ * @param stats Snapshot taken with mmr_stats()
+ * @param out Stream to write the report to
+ */
+void mmr_stats_print(const MMRStats *stats, FILE *out);
+
+// -------------------------- MMR PREFIXES ----------------------------------
+
+/**
+ * Register a fixed prefix to be hashed in front of elements
+ * The prefix is absorbed once; tagged operations resume from its midstate
+ * Prefixes that are a multiple of 64 bytes long let elements of up to
+ * 55 bytes be hashed with a single compression
+ * @param prefix Prefix state to initialise
+ * @param data Prefix bytes
+ * @param n Length of the prefix in bytes
+ * @return true on success, false on invalid parameters
+ */
+bool mmr_prefix_init(MMRPrefix *prefix, const uint8_t *data, size_t n);
+
+/**
+ * Register a BIP-340 style tagged hash prefix, SHA256(tag) || SHA256(tag)
+ * @param prefix Prefix state to initialise
+ * @param tag Tag bytes
+ * @param n Length of the tag in bytes
+ * @return true on success, false on invalid parameters
+ */
+bool mmr_prefix_init_tag(MMRPrefix *prefix, const uint8_t *tag, size_t n);
+
+// ------------------------- MMR ENCODING -----------------------------------
+
+/**
+ * Size of a witness in the compact wire encoding
+ * Layout: sibling count (1 byte), leaf hash (32 bytes), path bits
+ * (little-endian, ceil(n_siblings / 8) bytes), then n_siblings hashes
+ * @param w Witness to measure
+ * @return Encoded size in bytes, or 0 if the witness is invalid
+ */
+size_t mmr_witness_encoded_size(const MMRWitness *w);
+
+/**
+ * Encode a witness into the compact wire encoding
+ * @param w Witness to encode
+ * @param buf Output buffer
+ * @param cap Capacity of the output buffer in bytes
+ * @param len Optional output for the encoded size, set even when cap is too small
+ * @return true on success, false if the witness is invalid or buf is too small
+ */
+bool mmr_witness_encode(const MMRWitness *w, uint8_t *buf, size_t cap, size_t *len);
+
+/**
+ * Decode a witness from the compact wire encoding
+ * @param w Witness to populate, w->siblings is set to the siblings array
+ * @param siblings Caller owned array with room for WITNESS_MAX_SIBLINGS hashes
+ * @param buf Encoded input
+ * @param len Length of the encoded input in bytes
+ * @param used Optional output for the number of bytes consumed
+ * @return true on success, false if the input is truncated or malformed
+ */
+bool mmr_witness_decode(MMRWitness *w, bytes32 *siblings, const uint8_t *buf, size_t len, size_t *used);
+
+// ------------------------ MMR CACHE FILES ---------------------------------
+
+/**
+ * Save the accumulator's valid witness cache entries to a stream
+ * Meant to be written next to a snapshot, so a restarted process can reload
+ * the proofs it was serving instead of recomputing them on first request
+ * Each entry holds the leaf hash (the cache key), the hash of the peak it
+ * proves against and the siblings; entries whose peak has been merged away
+ * are skipped
+ * @param acc Pointer to accumulator to save the cache of
+ * @param out Stream to write to
+ * @param count Optional output for the number of entries written
+ * @return true on success, false on invalid parameters or a write error
+ */
+bool mmr_cache_save(const MMRAccumulator *acc, FILE *out, size_t *count);
+
+/**
+ * Load witness cache entries saved with mmr_cache_save()
+ * Entries are validated against the current peaks: an entry is installed
+ * only if its leaf is present, the leaf's peak still has the saved hash and
+ * the siblings reproduce it. Stale entries are silently discarded
+ * @param acc Pointer to accumulator, already restored to the snapshot state
+ * @param in Stream to read from
+ * @param count Optional output for the number of entries installed
+ * @return true if the stream was read to the end, false if it is malformed
+ */
+bool mmr_cache_load(const MMRAccumulator *acc, FILE *in, size_t *count);
+
+// ------------------------- MMR HIERARCHY ----------------------------------
+
+// Opaque sealed batch of a hierarchy
+struct MMRBatch;
+
+/**
+ * Two-level accumulator of accumulators
+ * Every batch of elements is built into its own small accumulator and sealed;
+ * only the batch roots are added to the outer accumulator. Adding a batch
+ * never touches earlier batches, so the inner half of a proof is fixed for
+ * good and only the short outer half ever needs refreshing
+ * CONCURRENCY: mmr_hier_add_batch() must not overlap other calls on the same
+ * hierarchy; witness and verify calls may run alongside each other
+ */
+typedef struct
+{
+    MMRAccumulator outer;
+
+    struct MMRBatch **batches;
+    size_t n_batches;
+    size_t capacity;
+
+    // Applied to every inner accumulator as it is created
+    MMRConfig cfg;
+    MMRTuning tuning;
+} MMRHierarchy;
+
+/**
+ * Proof of membership in a hierarchy
+ * inner runs from the leaf to its batch root, through the bag of the batch's peaks
+ * outer proves the batch root (hashed as an element) against the outer accumulator
+ */
+typedef struct
+{
+    MMRWitness inner;
+    MMRWitness outer;
+} MMRHierWitness;
+
+/**
+ * Initialize an empty hierarchy
+ * @param h Pointer to hierarchy to initialize
+ * @param cfg Configuration for the outer and each inner accumulator, or NULL for defaults
+ * @return true on success, false if the configuration could not be applied
+ */
+bool mmr_hier_init(MMRHierarchy *h, const MMRConfig *cfg);
+
+/**
+ * Destroy a hierarchy and free every batch
+ * @param h Pointer to hierarchy to destroy
+ */
+void mmr_hier_destroy(MMRHierarchy *h);
+
+/**
+ * Add a batch of elements as a new sealed inner accumulator
+ * The batch's peaks are bagged into a single root which is added to the outer accumulator
+ * @param h Pointer to hierarchy
+ * @param elems Elements of the batch, in order (each must have n > 0)
+ * @param count Number of elements (at least one)
+ * @param index Optional output for the new batch's index
+ * @return true on success, false on failure or invalid parameters
+ */
+bool mmr_hier_add_batch(MMRHierarchy *h, const MMRElement *elems, size_t count, size_t *index);
+
+/**
+ * Get the root of a sealed batch
+ * @param h Pointer to hierarchy
+ * @param index Batch index returned by mmr_hier_add_batch()
+ * @param root Output for the batch root
+ * @return true on success, false if the batch does not exist
+ */
+bool mmr_hier_batch_root(const MMRHierarchy *h, size_t index, bytes32 *root);
+
+/**
+ * Create a combined witness for an element of a sealed batch
+ * MEMORY OWNERSHIP: Both halves point into the caller's siblings array, the inner
+ * half at its start and the outer half WITNESS_MAX_SIBLINGS hashes in
+ * @param h Pointer to hierarchy
+ * @param index Batch the element was added in
+ * @param w Combined witness to populate
+ * @param siblings Caller owned array of at least 2 * WITNESS_MAX_SIBLINGS hashes
+ * @param e Element to prove
+ * @param n Size of element in bytes
+ * @return true on success, false if the element is not in the batch or on failure
+ */
+bool mmr_hier_witness(const MMRHierarchy *h, size_t index, MMRHierWitness *w, bytes32 *siblings, const uint8_t *e,
+                      size_t n);
+
+/**
+ * Recompute only the outer half of a combined witness after later batches
+ * The inner half is left untouched since sealed batches never change
+ * @param h Pointer to hierarchy
+ * @param w Combined witness, w->outer.siblings must have room for WITNESS_MAX_SIBLINGS hashes
+ * @return true on success, false if the inner half leads to no known batch root
+ */
+bool mmr_hier_refresh(const MMRHierarchy *h, MMRHierWitness *w);
+
+/**
+ * Verify a combined witness against the hierarchy's current state
+ * @param h Pointer to hierarchy
+ * @param w Combined witness to verify
+ * @return true if the proof is valid, false otherwise
+ */
+bool mmr_hier_verify(const MMRHierarchy *h, const MMRHierWitness *w);
+
+// -------------------------- MMR PIPELINE ----------------------------------
+
+/**
+ * Persist stage callback of an ingest pipeline
+ * Called from the persist thread with consecutive merged elements in push order,
+ * for example to append them to a write-ahead log
+ * @param ctx Caller context from MMRPipelineConfig
+ * @param elems Elements, valid only for the duration of the call
+ * @param hashes Leaf hashes of the elements
+ * @param count Number of elements
+ * @return true on success, false to flag the pipeline as failed
+ */
+typedef bool (*mmr_persist_fn)(void *ctx, const MMRElement *elems, const bytes32 *hashes, size_t count);
+
+/**
+ * Ingest pipeline configuration
+ * A zeroed configuration gives one hash worker, 1024 slots and no persist stage
+ */
+typedef struct
+{
+    // Threads hashing elements between the push and merge stages
+    unsigned hash_workers;
+
+    // Ring capacity in elements, a power of two; producers block when it is full
+    size_t slots;
+
+    // Prefix to hash elements under, or NULL for none
+    const MMRPrefix *prefix;
+
+    // Optional persist stage, run after each element has been merged
+    mmr_persist_fn persist;
+    void *persist_ctx;
+} MMRPipelineConfig;
+
+/**
+ * Running counters of an ingest pipeline
+ * Waits count the times a stage found nothing to do (or, for pushes, a full
+ * ring); the _ns fields are time spent working, for per-stage utilisation
+ */
+typedef struct
+{
+    uint64_t pushed;
+    uint64_t hashed;
+    uint64_t merged;
+    uint64_t persisted;
+
+    uint64_t push_waits;
+    uint64_t hash_waits;
+    uint64_t merge_waits;
+    uint64_t persist_waits;
+
+    uint64_t hash_batches;
+    uint64_t merge_batches;
+    uint64_t persist_batches;
+    uint64_t persist_failures;
+
+    uint64_t hash_ns;
+    uint64_t merge_ns;
+    uint64_t persist_ns;
+
+    // Elements pushed but not yet through the last stage
+    uint64_t in_flight;
+} MMRPipelineStats;
+
+// Opaque running pipeline
+struct MMRPipeline;
+
+/**
+ * Start a staged ingest pipeline feeding an accumulator
+ * Elements go through a bounded lock-free ring: any number of producers
+ * push, hash workers hash runs of them together, a single merge thread
+ * appends them to the accumulator in push order and an optional persist
+ * thread hands them to a callback. Each stage blocks when the one before is
+ * empty, and producers block when the ring is full
+ * The pipeline is the accumulator's writer; other threads may still add
+ * and read if the accumulator is concurrent
+ * @param acc Accumulator to append to, must outlive the pipeline
+ * @param cfg Pipeline configuration, or NULL for defaults
+ * @return The running pipeline, or NULL on failure or an invalid configuration
+ */
+struct MMRPipeline *mmr_pipeline_start(MMRAccumulator *acc, const MMRPipelineConfig *cfg);
+
+/**
+ * Push an element into the pipeline
+ * The element is copied, so the caller may reuse its buffer straight away
+ * @param p Pipeline
+ * @param e Element data
+ * @param n Size of element data in bytes
+ * @return true if the element was queued, false if the pipeline is finishing or on failure
+ */
+bool mmr_pipeline_push(struct MMRPipeline *p, const uint8_t *e, size_t n);
+
+/**
+ * Wait until every element pushed so far has passed the last stage
+ * @param p Pipeline
+ * @return true if no stage has failed so far
+ */
+bool mmr_pipeline_flush(struct MMRPipeline *p);
+
+/**
+ * Drain the pipeline, stop its threads and free it
+ * @param p Pipeline, invalid after the call
+ * @return true if every element was merged and persisted without failure
+ */
+bool mmr_pipeline_finish(struct MMRPipeline *p);
+
+/**
+ * Take a snapshot of the pipeline's counters
+ * @param p Pipeline
+ * @param stats Output structure to populate
+ */
+void mmr_pipeline_stats(const struct MMRPipeline *p, MMRPipelineStats *stats);
+
+// -------------------------- MMR WARM-UP -----------------------------------
+
+/**
+ * Warm an accumulator's memory for serving after startup, upper levels first
+ * The top levels of every mountain, which every witness walks through, are
+ * read in before returning, so the first proofs do not fault in pages at random
+ * A concurrent accumulator is then usable straight away while a background
+ * thread carries on warming the lower levels; other accumulators only get the
+ * top levels, since a background walk would race with their adds
+ * A warm-up still running from an earlier call is abandoned first
+ * @param acc Pointer to accumulator, must not move while warming runs
+ * @param levels Number of levels below each peak to warm before returning
+ * @param touched Optional output for the number of nodes warmed before returning
+ * @return true if the top levels were warmed and any background pass was started
+ */
+bool mmr_warm(MMRAccumulator *acc, unsigned levels, size_t *touched);
+
+/**
+ * Finish the background warm-up started by mmr_warm()
+ * Called by mmr_destroy(), so only needed to wait for or cut short the warm-up
+ * @param acc Pointer to accumulator
+ * @param wait true to let the warm-up reach the leaves, false to abandon it
+ * @return Number of nodes the background pass warmed
+ */
+size_t mmr_warm_stop(MMRAccumulator *acc, bool wait);
+
+// ------------------------- MMR ARROW EXPORT -------------------------------
+
+/**
+ * Options for mmr_export_arrow
+ * A zeroed configuration exports the leaves in batches of 65536 rows
+ */
+typedef struct
+{
+    // Also export the hash of every stored or rebuildable subtree, one level after another
+    bool nodes;
+
+    // Rows per record batch, 0 for the default; must fit a 32-byte hash column
+    size_t batch_rows;
+} MMRExportConfig;
+
+/**
+ * Export accumulator contents as an Arrow IPC stream for analytics
+ * The schema has three non-nullable columns: level (uint8, 0 for leaves),
+ * position (uint64, first leaf of the subtree) and hash (fixed_size_binary[32])
+ * Rows come out level by level in leaf order, each record batch holding one
+ * level; leaves reclaimed by compaction are skipped, so positions may have gaps
+ * Writers are held off only while each record batch is filled, not while it
+ * is written; leaves added after the export starts are not included
+ * Write to a file, or to memory through open_memstream() or fmemopen()
+ * @param acc Pointer to accumulator
+ * @param out Stream to write to
+ * @param cfg Export configuration, or NULL for defaults
+ * @param rows Optional output for the number of rows written
+ * @return true on success, false on invalid parameters, allocation failure or a write error
+ */
+bool mmr_export_arrow(const MMRAccumulator *acc, FILE *out, const MMRExportConfig *cfg, size_t *rows);
+
+// ------------------------- MMR RECONCILE ----------------------------------
+
+// Smallest buffer mmr_reconcile_next() can write a request into
+#define MMR_RECONCILE_MIN_REQUEST 14
+
+/**
+ * A run of consecutive leaf positions
+ */
+typedef struct
+{
+    uint64_t start;
+    uint64_t count;
+} MMRLeafRange;
+
+// Opaque initiator state of a reconciliation
+struct MMRReconcile;
+
+/**
+ * Start finding where a local accumulator and a remote replica diverge
+ * The initiator compares the peaks of the leaf range both replicas hold and
+ * descends only into subtrees whose hashes differ, so d differing leaves cost
+ * O(d log N) hash comparisons. Subtrees are named by (first leaf, height),
+ * which both sides agree on, and requests and responses are plain byte
+ * messages for any transport:
+ *
+ *   while (mmr_reconcile_next(r, req, sizeof(req), &req_len))
+ *       send req; the remote answers with mmr_reconcile_respond();
+ *       mmr_reconcile_receive(r, resp, resp_len);
+ *
+ * Both replicas should not be written to while reconciling
+ * @param acc Local accumulator, must outlive the reconciliation
+ * @return New reconciliation state to free with mmr_reconcile_free(), or NULL on failure
+ */
+struct MMRReconcile *mmr_reconcile_start(const MMRAccumulator *acc);
+
+/**
+ * Free a reconciliation and its results
+ * @param r Reconciliation, may be NULL
+ */
+void mmr_reconcile_free(struct MMRReconcile *r);
+
+/**
+ * Write the next request for the remote replica
+ * Larger buffers batch more subtree queries into each round trip
+ * @param r Reconciliation
+ * @param buf Output buffer
+ * @param cap Capacity of the buffer, at least MMR_RECONCILE_MIN_REQUEST bytes
+ * @param len Output for the request length
+ * @return true if a request was written, false once reconciliation is complete or on invalid parameters
+ */
+bool mmr_reconcile_next(struct MMRReconcile *r, uint8_t *buf, size_t cap, size_t *len);
+
+/**
+ * Answer a reconciliation request, on the remote replica
+ * A response needs at most 13 + 33 bytes per query in the request
+ * @param acc Accumulator to answer from
+ * @param req Request received
+ * @param req_len Length of the request
+ * @param buf Output buffer for the response
+ * @param cap Capacity of the output buffer
+ * @param len Output for the response length (or the length required, if cap is too small)
+ * @return true on success, false if the request is malformed or the buffer too small
+ */
+bool mmr_reconcile_respond(const MMRAccumulator *acc, const uint8_t *req, size_t req_len, uint8_t *buf, size_t cap,
+                           size_t *len);
+
+/**
+ * Feed the remote replica's response to the last request
+ * A failed call changes nothing, so the same or a resent response can be fed again
+ * @param r Reconciliation
+ * @param resp Response received
+ * @param len Length of the response
+ * @return true on success, false if the response is malformed or on allocation failure
+ */
+bool mmr_reconcile_receive(struct MMRReconcile *r, const uint8_t *resp, size_t len);
+
+/**
+ * Get the leaf ranges on which the replicas differ, sorted and merged
+ * Includes leaves only one replica holds and subtrees either side has
+ * reclaimed by compaction, which cannot be descended into
+ * @param r Reconciliation
+ * @param ranges Output pointer to the ranges, valid until the next call on r
+ * @param comparisons Optional output for the number of subtree hashes compared
+ * @return Number of ranges
+ */
+size_t mmr_reconcile_result(struct MMRReconcile *r, const MMRLeafRange **ranges, uint64_t *comparisons);
+
+// ------------------------- MMR FRONTIER -----------------------------------
+
+/**
+ * One node of a client's cached frontier
+ * start is the position of the node's first leaf, height 0 being a leaf
+ */
+typedef struct
+{
+    bytes32 hash;
+    uint64_t start;
+    uint16_t height;
+} MMRFrontierNode;
+
+/**
+ * Upper levels of an accumulator cached by a light client
+ * Holds the level depth below every peak, sorted by hash, as of leaves leaves
+ */
+typedef struct
+{
+    MMRFrontierNode *nodes;
+    size_t count;
+
+    uint64_t leaves;
+    unsigned depth;
+    MMRHashBackend hash_backend;
+} MMRFrontier;
+
+/**
+ * Trim a witness for a client that caches the levels down to depth below each peak
+ * Drops the top depth siblings, which the client's frontier supplies, so proofs
+ * shrink by depth hashes. Works on any full witness, single or from a batch;
+ * a mountain no taller than depth needs no siblings at all
+ * @param w Witness to trim in place; the siblings array itself is left untouched
+ * @param depth Depth the client states it caches
+ * @return true on success, false if the witness is invalid
+ */
+bool mmr_witness_trim(MMRWitness *w, unsigned depth);
+
+/**
+ * Snapshot the frontier a client caches: the nodes depth levels below every peak
+ * Mountains no taller than depth contribute their leaves. Writers are held off
+ * while the snapshot is taken. After later adds a client should take a fresh
+ * frontier once its proofs stop verifying
+ * @param acc Pointer to accumulator
+ * @param depth Number of levels below the peaks to cache
+ * @param f Frontier to fill, freed with mmr_frontier_free()
+ * @return true on success, false on invalid parameters or allocation failure
+ */
+bool mmr_frontier_init(const MMRAccumulator *acc, unsigned depth, MMRFrontier *f);
+
+/**
+ * Free the nodes of a frontier
+ * @param f Frontier to free
+ */
+void mmr_frontier_free(MMRFrontier *f);
+
+/**
+ * Verify a witness against a cached frontier, completing the path from the cache
+ * Accepts the witness once its path reaches a cached node of the same height,
+ * so both trimmed and full witnesses verify
+ * @param f Frontier the client holds
+ * @param w Witness to verify
+ * @return true if the witness leads to a node of the frontier, false otherwise
+ */
+bool mmr_frontier_verify(const MMRFrontier *f, const MMRWitness *w);
+
+// -------------------------- MMR MIGRATION ---------------------------------
+
+/**
+ * Supplies the element behind a leaf position to mmr_migrate()
+ * Called from several threads at once; the element data must stay valid
+ * until the migration returns
+ * @param ctx Context pointer given to mmr_migrate()
+ * @param position Leaf position, counted from the oldest leaf
+ * @param element Output element
+ * @return true on success, false if the element is unavailable
+ */
+typedef bool (*MMRLeafSource)(void *ctx, uint64_t position, MMRElement *element);
+
+/**
+ * Old and new leaf hash of one position, emitted by mmr_migrate()
+ * checked is set where the old hash was matched against the source leaf;
+ * leaves reclaimed by compaction can no longer be checked
+ */
+typedef struct
+{
+    bytes32 old_hash;
+    bytes32 new_hash;
+    bool checked;
+} MMRLeafMapping;
+
+/**
+ * Rebuild an accumulator under another hash backend, in parallel across threads
+ * dst must be empty and is normally initialised like src apart from its
+ * hash_backend. Leaf positions are preserved, as are spent marks when both
+ * accumulators keep tombstones. With a mapping each element is hashed under
+ * both backends in one pass, and rejected unless its old hash matches the
+ * leaf src holds, so the mapping shows that both commit to the same elements
+ * @param src Pointer to accumulator to migrate
+ * @param dst Pointer to an empty accumulator with the new backend
+ * @param source Callback supplying the element behind every leaf of src
+ * @param ctx Context pointer passed through to source
+ * @param mapping Optional output array of mmr_leaf_count(src) entries
+ * @param n_threads Maximum number of threads to use (0 or 1 works on the calling thread,
+ *                  MMR_THREADS_AUTO as tuned)
+ * @return true on success, false on invalid parameters, a missing or mismatched
+ *         element or allocation failure, after which dst should be destroyed
+ */
+bool mmr_migrate(const MMRAccumulator *src, MMRAccumulator *dst, MMRLeafSource source, void *ctx,
+                 MMRLeafMapping *mapping, unsigned n_threads);
+
+// ---------------------------- MMR TUNING ----------------------------------
+
+/**
+ * Fill in the built-in tuning: 256 leaves per batch pass and a single thread
+ * @param t Profile to fill
+ */
+void mmr_tuning_default(MMRTuning *t);
+
+/**
+ * Measure the current host and derive a tuning profile from it
+ * Times the leaf and node hash kernels, tracker insertion, thread start-up,
+ * batch adds at each chunk size and hashing across growing thread counts.
+ * Takes in the order of a few hundred milliseconds
+ * @param t Profile to fill
+ * @param cfg Configuration of the accumulators the profile is meant for, or NULL
+ * @param max_threads Most threads to consider, 0 for every online core
+ * @return true on success, false on invalid parameters or allocation failure
+ */
+bool mmr_tune(MMRTuning *t, const MMRConfig *cfg, unsigned max_threads);
+
+/**
+ * Write a tuning profile to a stream
+ * @param t Profile to write
+ * @param out Stream to write to
+ * @return true on success, false on invalid parameters or a write error
+ */
+bool mmr_tuning_save(const MMRTuning *t, FILE *out);
+
+/**
+ * Read a tuning profile written by mmr_tuning_save()
+ * @param t Profile to fill, left unchanged on failure
+ * @param in Stream to read from
+ * @return true on success, false on a read error or an invalid profile
+ */
+bool mmr_tuning_load(MMRTuning *t, FILE *in);
+
+// --------------------------- MMR ITERATOR ---------------------------------
+
+// Opaque scan over a range of leaf positions, see mmr_iter_start()
+struct MMRIter;
+
+/**
+ * Start a scan of the leaves in a range of positions, in insertion order
+ * Leaves added after the scan starts are not included
+ * @param acc Pointer to accumulator, which must outlive the scan
+ * @param start Position of the first leaf to yield
+ * @param count Number of positions to cover, UINT64_MAX for every leaf from start
+ * @return New iterator, freed with mmr_iter_free(), or NULL on invalid parameters or allocation failure
+ */
+struct MMRIter *mmr_iter_start(const MMRAccumulator *acc, uint64_t start, uint64_t count);
+
+/**
+ * Yield the next batch of (position, digest) pairs of a scan
+ * Writers are held off only while each batch is filled, and may add or
+ * compact in between. Leaves reclaimed by compaction are skipped, so
+ * positions may have gaps
+ * @param it Iterator
+ * @param positions Optional output array of cap leaf positions
+ * @param digests Output array of cap leaf digests
+ * @param cap Capacity of the output arrays
+ * @return Number of leaves yielded, 0 once the range is exhausted
+ */
+size_t mmr_iter_next(struct MMRIter *it, uint64_t *positions, bytes32 *digests, size_t cap);
+
+/**
+ * Free an iterator
+ * @param it Iterator, may be NULL
+ */
+void mmr_iter_free(struct MMRIter *it);
+
+// -------------------------- MMR TIME INDEX --------------------------------
+
+/**
+ * Record that the leaves added from now on carry a key until the next mark
+ * Call before adding each block, with its height or timestamp as the key
+ * @param acc Pointer to accumulator initialised with cfg->time_index
+ * @param key Key of the leaves to follow, no smaller than the previous mark's key
+ * @return true on success, false without an index, on a decreasing key or allocation failure
+ */
+bool mmr_time_mark(MMRAccumulator *acc, uint64_t key);
+
+/**
+ * Look up the leaf positions added under keys from through to, inclusive
+ * Marks are kept sorted, so this is a search of the index and not of the leaves
+ * @param acc Pointer to accumulator initialised with cfg->time_index
+ * @param from Smallest key to include
+ * @param to Largest key to include
+ * @param range Output run of leaf positions, empty if no leaf matches
+ * @return true on success, false on invalid parameters or without an index
+ */
+bool mmr_time_range(const MMRAccumulator *acc, uint64_t from, uint64_t to, MMRLeafRange *range);
+
+/**
+ * Start a scan of the leaves added under keys from through to, inclusive
+ * Same as mmr_iter_start() over the range mmr_time_range() returns
+ * @param acc Pointer to accumulator initialised with cfg->time_index
+ * @param from Smallest key to include
+ * @param to Largest key to include
+ * @return New iterator, freed with mmr_iter_free(), or NULL on invalid parameters,
+ *         without an index or on allocation failure
+ */
+struct MMRIter *mmr_iter_time(const MMRAccumulator *acc, uint64_t from, uint64_t to);
+
 #endif
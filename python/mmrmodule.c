@@ -0,0 +1,560 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "mmr.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+// --------------------------- MMR PYTHON -----------------------------------
+
+// Proof length marking an element that has no witness in witness_batch output
+#define PY_MMR_MISSING 0xFFFF
+
+/**
+ * Python wrapper around an accumulator
+ * Accumulators not configured as concurrent are guarded by the object's own
+ * lock, taken with the GIL released, so Python threads can share one safely
+ */
+typedef struct
+{
+    PyObject_HEAD
+
+    MMRAccumulator acc;
+    PyThread_type_lock lock;
+    bool ready;
+} PyAccumulator;
+
+/**
+ * Take the object lock for a non-concurrent accumulator
+ * Must be called with the GIL released
+ * @param self Accumulator object
+ */
+static void py_acc_lock(PyAccumulator *self)
+{
+    if (self->lock) PyThread_acquire_lock(self->lock, WAIT_LOCK);
+}
+
+/**
+ * Release the lock taken by py_acc_lock
+ * @param self Accumulator object
+ */
+static void py_acc_unlock(PyAccumulator *self)
+{
+    if (self->lock) PyThread_release_lock(self->lock);
+}
+
+/**
+ * Get a contiguous view of a buffer argument
+ * @param obj Object exporting the buffer protocol
+ * @param view Output view, released by the caller with PyBuffer_Release
+ * @param writable true for output arrays
+ * @param name Argument name for error messages
+ * @return true on success, false with a Python exception set
+ */
+static bool py_buffer(PyObject *obj, Py_buffer *view, bool writable, const char *name)
+{
+    int flags = writable ? PyBUF_WRITABLE : PyBUF_SIMPLE;
+
+    if (PyObject_GetBuffer(obj, view, flags | PyBUF_C_CONTIGUOUS) == 0) return true;
+
+    PyErr_Format(PyExc_TypeError, "%s must be a contiguous%s buffer", name, writable ? " writable" : "");
+    return false;
+}
+
+/**
+ * Check that an output buffer has room for count items of size bytes
+ * @param view Output view
+ * @param count Number of items
+ * @param size Byte size of each item
+ * @param name Argument name for error messages
+ * @return true if it is large enough, false with a Python exception set
+ */
+static bool py_buffer_fits(const Py_buffer *view, size_t count, size_t size, const char *name)
+{
+    if ((size_t) view->len / size >= count) return true;
+
+    PyErr_Format(PyExc_ValueError, "%s needs room for %zu items of %zu bytes", name, count, size);
+    return false;
+}
+
+/**
+ * Get a view of an array argument and check it holds count items
+ * @param obj Object exporting the buffer protocol
+ * @param views Array of views held so far, the new one is appended
+ * @param held In/out number of views held, all released by the caller
+ * @param count Number of items
+ * @param size Byte size of each item
+ * @param writable true for output arrays
+ * @param name Argument name for error messages
+ * @return true on success, false with a Python exception set
+ */
+static bool py_buffer_array(PyObject *obj, Py_buffer *views, size_t *held, size_t count, size_t size, bool writable,
+                            const char *name)
+{
+    if (!py_buffer(obj, &views[*held], writable, name)) return false;
+
+    return py_buffer_fits(&views[(*held)++], count, size, name);
+}
+
+/**
+ * Split a buffer of packed elements into batch entries
+ * Elements are either all width bytes long, or delimited by count + 1
+ * ascending uint64 offsets into the buffer
+ * @param data View of the packed elements
+ * @param width Fixed element size, 0 when offsets are given
+ * @param offsets Optional view of the offsets
+ * @param count Output number of elements
+ * @return Array of count entries pointing into data (freed with free), or NULL with a Python exception set
+ */
+static MMRElement *py_elements(const Py_buffer *data, Py_ssize_t width, const Py_buffer *offsets, size_t *count)
+{
+    const uint8_t *base = data->buf;
+    size_t len = (size_t) data->len;
+    const uint64_t *ends = NULL;
+
+    if (offsets)
+    {
+        if (offsets->len < (Py_ssize_t) sizeof(uint64_t) || offsets->len % sizeof(uint64_t) != 0)
+        {
+            PyErr_SetString(PyExc_ValueError, "offsets must hold count + 1 uint64 values");
+            return NULL;
+        }
+
+        ends = offsets->buf;
+        *count = (size_t) offsets->len / sizeof(uint64_t) - 1;
+    }
+    else
+    {
+        if (width <= 0 || len % (size_t) width != 0)
+        {
+            PyErr_SetString(PyExc_ValueError, "elements must be a whole number of width byte elements");
+            return NULL;
+        }
+
+        *count = len / (size_t) width;
+    }
+
+    MMRElement *elems = malloc((*count ? *count : 1) * sizeof(MMRElement));
+    if (!elems)
+    {
+        PyErr_NoMemory();
+        return NULL;
+    }
+
+    for (size_t i = 0; i < *count; ++i)
+    {
+        size_t start = ends ? ends[i] : i * (size_t) width;
+        size_t end = ends ? ends[i + 1] : start + (size_t) width;
+
+        if (start >= end || end > len)
+        {
+            free(elems);
+            PyErr_Format(PyExc_ValueError, "element %zu is empty or out of range", i);
+            return NULL;
+        }
+
+        elems[i].data = base + start;
+        elems[i].n = end - start;
+    }
+
+    return elems;
+}
+
+/**
+ * Parse the (elements, width, offsets) arguments shared by the batch methods
+ * @param elements Elements argument
+ * @param width Width argument
+ * @param offsets Offsets argument, or NULL / None
+ * @param data Output view of the elements
+ * @param count Output number of elements
+ * @return Element entries, or NULL with data released and a Python exception set
+ */
+static MMRElement *py_parse_elements(PyObject *elements, Py_ssize_t width, PyObject *offsets, Py_buffer *data,
+                                     size_t *count)
+{
+    if (!py_buffer(elements, data, false, "elements")) return NULL;
+
+    Py_buffer ends;
+    bool has_offsets = offsets && offsets != Py_None;
+
+    if (has_offsets && !py_buffer(offsets, &ends, false, "offsets"))
+    {
+        PyBuffer_Release(data);
+        return NULL;
+    }
+
+    MMRElement *elems = py_elements(data, width, has_offsets ? &ends : NULL, count);
+
+    if (has_offsets) PyBuffer_Release(&ends);
+    if (!elems) PyBuffer_Release(data);
+
+    return elems;
+}
+
+static int py_acc_init(PyAccumulator *self, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"concurrent", "sparse_height", "tombstones", "hash", NULL};
+
+    int concurrent = 0;
+    unsigned sparse_height = 0;
+    int tombstones = 0;
+    unsigned hash = MMR_HASH_SHA256;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|pIpI", kwlist, &concurrent, &sparse_height, &tombstones, &hash))
+    {
+        return -1;
+    }
+
+    if (self->ready)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "accumulator is already initialised");
+        return -1;
+    }
+
+    MMRConfig cfg = {0};
+    cfg.concurrent = concurrent;
+    cfg.sparse_height = sparse_height;
+    cfg.tombstones = tombstones;
+    cfg.hash_backend = (MMRHashBackend) hash;
+
+    if (!concurrent)
+    {
+        self->lock = PyThread_allocate_lock();
+        if (!self->lock)
+        {
+            PyErr_NoMemory();
+            return -1;
+        }
+    }
+
+    if (!mmr_init_config(&self->acc, &cfg))
+    {
+        if (self->lock) PyThread_free_lock(self->lock);
+        self->lock = NULL;
+
+        PyErr_SetString(PyExc_ValueError, "invalid accumulator configuration");
+        return -1;
+    }
+
+    self->ready = true;
+
+    return 0;
+}
+
+static void py_acc_dealloc(PyAccumulator *self)
+{
+    if (self->ready) mmr_destroy(&self->acc);
+    if (self->lock) PyThread_free_lock(self->lock);
+
+    Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+/**
+ * Check that __init__ ran before a method touches the accumulator
+ * @param self Accumulator object
+ * @return true if usable, false with a Python exception set
+ */
+static bool py_acc_ready(const PyAccumulator *self)
+{
+    if (self->ready) return true;
+
+    PyErr_SetString(PyExc_RuntimeError, "accumulator is not initialised");
+    return false;
+}
+
+PyDoc_STRVAR(py_acc_add_batch_doc, "add_batch(elements, width=0, offsets=None)\n--\n\n"
+                                   "Add every element of a packed buffer, either fixed width elements or\n"
+                                   "elements delimited by count + 1 uint64 offsets. Returns the count added.");
+
+static PyObject *py_acc_add_batch(PyAccumulator *self, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"elements", "width", "offsets", NULL};
+
+    PyObject *elements;
+    Py_ssize_t width = 0;
+    PyObject *offsets = NULL;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|nO", kwlist, &elements, &width, &offsets)) return NULL;
+    if (!py_acc_ready(self)) return NULL;
+
+    Py_buffer data;
+    size_t count;
+    MMRElement *elems = py_parse_elements(elements, width, offsets, &data, &count);
+    if (!elems) return NULL;
+
+    bool ok;
+
+    Py_BEGIN_ALLOW_THREADS;
+    py_acc_lock(self);
+    ok = mmr_add_batch(&self->acc, elems, count);
+    py_acc_unlock(self);
+    Py_END_ALLOW_THREADS;
+
+    free(elems);
+    PyBuffer_Release(&data);
+
+    if (!ok)
+    {
+        PyErr_SetString(PyExc_MemoryError, "adding the batch failed");
+        return NULL;
+    }
+
+    return PyLong_FromSize_t(count);
+}
+
+PyDoc_STRVAR(py_acc_witness_batch_doc,
+             "witness_batch(elements, siblings, paths, lengths, width=0, offsets=None, digests=None, depth=0)\n--\n\n"
+             "Write a proof for every element into preallocated arrays: siblings holds\n"
+             "MAX_SIBLINGS hashes of HASH_SIZE bytes per element, paths one uint64 and\n"
+             "lengths one uint16 sibling count, MISSING where the element has no proof.\n"
+             "digests optionally receives each element's leaf hash. depth trims every proof\n"
+             "for a client caching that many levels below the peaks. Returns the count proven.");
+
+static PyObject *py_acc_witness_batch(PyAccumulator *self, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"elements", "siblings", "paths", "lengths", "width", "offsets", "digests", "depth", NULL};
+
+    PyObject *elements, *siblings_obj, *paths_obj, *lengths_obj;
+    Py_ssize_t width = 0;
+    PyObject *offsets = NULL;
+    PyObject *digests_obj = NULL;
+    unsigned depth = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "OOOO|nOOI", kwlist, &elements, &siblings_obj, &paths_obj,
+                                     &lengths_obj, &width, &offsets, &digests_obj, &depth))
+    {
+        return NULL;
+    }
+
+    if (!py_acc_ready(self)) return NULL;
+
+    Py_buffer data;
+    size_t count;
+    MMRElement *elems = py_parse_elements(elements, width, offsets, &data, &count);
+    if (!elems) return NULL;
+
+    Py_buffer out[4];
+    size_t held = 0;
+    bool has_digests = digests_obj && digests_obj != Py_None;
+    bool ok = py_buffer_array(siblings_obj, out, &held, count, WITNESS_MAX_SIBLINGS * sizeof(bytes32), true,
+                              "siblings") &&
+              py_buffer_array(paths_obj, out, &held, count, sizeof(uint64_t), true, "paths") &&
+              py_buffer_array(lengths_obj, out, &held, count, sizeof(uint16_t), true, "lengths") &&
+              (!has_digests || py_buffer_array(digests_obj, out, &held, count, sizeof(bytes32), true, "digests"));
+
+    size_t proven = 0;
+
+    if (ok)
+    {
+        bytes32 *siblings = out[0].buf;
+        uint8_t *paths = out[1].buf;
+        uint8_t *lengths = out[2].buf;
+        bytes32 *digests = has_digests ? out[3].buf : NULL;
+
+        Py_BEGIN_ALLOW_THREADS;
+        py_acc_lock(self);
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            MMRWitness w;
+            uint64_t path = 0;
+            uint16_t length = PY_MMR_MISSING;
+
+            // Siblings land straight in the caller's array
+            if (mmr_witness_into(&self->acc, &w, siblings + i * WITNESS_MAX_SIBLINGS, elems[i].data, elems[i].n) &&
+                mmr_witness_trim(&w, depth))
+            {
+                path = w.path;
+                length = w.n_siblings;
+                if (digests) memcpy(digests[i], w.hash, sizeof(bytes32));
+                ++proven;
+            }
+            else if (digests)
+            {
+                memset(digests[i], 0, sizeof(bytes32));
+            }
+
+            // Output arrays need not be aligned for their element type
+            memcpy(paths + i * sizeof(uint64_t), &path, sizeof(uint64_t));
+            memcpy(lengths + i * sizeof(uint16_t), &length, sizeof(uint16_t));
+        }
+
+        py_acc_unlock(self);
+        Py_END_ALLOW_THREADS;
+    }
+
+    while (held > 0) PyBuffer_Release(&out[--held]);
+    free(elems);
+    PyBuffer_Release(&data);
+
+    if (!ok) return NULL;
+
+    return PyLong_FromSize_t(proven);
+}
+
+PyDoc_STRVAR(py_acc_verify_batch_doc,
+             "verify_batch(digests, siblings, paths, lengths, results=None, threads=0)\n--\n\n"
+             "Verify proofs laid out as witness_batch writes them, for count = len(digests) / HASH_SIZE\n"
+             "leaf hashes. results optionally receives one byte per proof, 1 where it verified.\n"
+             "threads spreads the hashing over that many threads. Returns the count verified.");
+
+static PyObject *py_acc_verify_batch(PyAccumulator *self, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"digests", "siblings", "paths", "lengths", "results", "threads", NULL};
+
+    PyObject *digests_obj, *siblings_obj, *paths_obj, *lengths_obj;
+    PyObject *results_obj = NULL;
+    unsigned threads = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "OOOO|OI", kwlist, &digests_obj, &siblings_obj, &paths_obj,
+                                     &lengths_obj, &results_obj, &threads))
+    {
+        return NULL;
+    }
+
+    if (!py_acc_ready(self)) return NULL;
+
+    Py_buffer in[5];
+    if (!py_buffer(digests_obj, &in[0], false, "digests")) return NULL;
+
+    // The digests set the batch size, every other array must cover it
+    size_t held = 1;
+    size_t count = (size_t) in[0].len / sizeof(bytes32);
+    bool has_results = results_obj && results_obj != Py_None;
+    bool ok = py_buffer_array(siblings_obj, in, &held, count, WITNESS_MAX_SIBLINGS * sizeof(bytes32), false,
+                              "siblings") &&
+              py_buffer_array(paths_obj, in, &held, count, sizeof(uint64_t), false, "paths") &&
+              py_buffer_array(lengths_obj, in, &held, count, sizeof(uint16_t), false, "lengths") &&
+              (!has_results || py_buffer_array(results_obj, in, &held, count, 1, true, "results"));
+
+    MMRWitness *witnesses = NULL;
+    MMRVerifyRequest *reqs = NULL;
+    size_t *index = NULL;
+    bool *flags = NULL;
+
+    if (ok)
+    {
+        witnesses = malloc((count ? count : 1) * sizeof(MMRWitness));
+        reqs = malloc((count ? count : 1) * sizeof(MMRVerifyRequest));
+        index = malloc((count ? count : 1) * sizeof(size_t));
+        flags = malloc(count ? count : 1);
+        ok = witnesses && reqs && index && flags;
+        if (!ok) PyErr_NoMemory();
+    }
+
+    size_t verified = 0;
+
+    if (ok)
+    {
+        const bytes32 *digests = in[0].buf;
+        bytes32 *siblings = in[1].buf;
+        const uint8_t *paths = in[2].buf;
+        const uint8_t *lengths = in[3].buf;
+        uint8_t *results = has_results ? in[4].buf : NULL;
+
+        Py_BEGIN_ALLOW_THREADS;
+
+        // Entries without a proof are left out of the batch and reported as failed
+        size_t n = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            uint16_t length;
+            memcpy(&length, lengths + i * sizeof(uint16_t), sizeof(uint16_t));
+            if (results) results[i] = 0;
+            if (length == PY_MMR_MISSING) continue;
+
+            MMRWitness *w = &witnesses[n];
+            memcpy(w->hash, digests[i], sizeof(bytes32));
+            memcpy(&w->path, paths + i * sizeof(uint64_t), sizeof(uint64_t));
+            w->n_siblings = length;
+            w->siblings = siblings + i * WITNESS_MAX_SIBLINGS;
+
+            reqs[n].acc = &self->acc;
+            reqs[n].witness = w;
+            index[n++] = i;
+        }
+
+        py_acc_lock(self);
+        verified = mmr_verify_batch(reqs, n, flags, threads);
+        py_acc_unlock(self);
+
+        for (size_t j = 0; results && j < n; ++j)
+        {
+            results[index[j]] = flags[j];
+        }
+
+        Py_END_ALLOW_THREADS;
+    }
+
+    free(witnesses);
+    free(reqs);
+    free(index);
+    free(flags);
+    while (held > 0) PyBuffer_Release(&in[--held]);
+
+    if (!ok) return NULL;
+
+    return PyLong_FromSize_t(verified);
+}
+
+static PyMethodDef py_acc_methods[] = {
+    {"add_batch", (PyCFunction) (void (*)(void)) py_acc_add_batch, METH_VARARGS | METH_KEYWORDS,
+     py_acc_add_batch_doc},
+    {"witness_batch", (PyCFunction) (void (*)(void)) py_acc_witness_batch, METH_VARARGS | METH_KEYWORDS,
+     py_acc_witness_batch_doc},
+    {"verify_batch", (PyCFunction) (void (*)(void)) py_acc_verify_batch, METH_VARARGS | METH_KEYWORDS,
+     py_acc_verify_batch_doc},
+    {NULL, NULL, 0, NULL},
+};
+
+PyDoc_STRVAR(py_acc_doc, "Accumulator(concurrent=False, sparse_height=0, tombstones=False, hash=HASH_SHA256)\n--\n\n"
+                         "Merkle Mountain Range accumulator with batch operations over buffers.\n"
+                         "The native work of every method runs with the GIL released.");
+
+static PyTypeObject PyAccumulatorType = {
+    PyVarObject_HEAD_INIT(NULL, 0).tp_name = "mmr.Accumulator",
+    .tp_basicsize = sizeof(PyAccumulator),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = py_acc_doc,
+    .tp_new = PyType_GenericNew,
+    .tp_init = (initproc) py_acc_init,
+    .tp_dealloc = (destructor) py_acc_dealloc,
+    .tp_methods = py_acc_methods,
+};
+
+static struct PyModuleDef py_mmr_module = {
+    PyModuleDef_HEAD_INIT,
+    .m_name = "mmr",
+    .m_doc = "Batch-oriented bindings for the Merkle Mountain Range accumulator",
+    .m_size = -1,
+};
+
+PyMODINIT_FUNC PyInit_mmr(void)
+{
+    if (PyType_Ready(&PyAccumulatorType) < 0) return NULL;
+
+    PyObject *module = PyModule_Create(&py_mmr_module);
+    if (!module) return NULL;
+
+    if (PyModule_AddIntConstant(module, "HASH_SIZE", sizeof(bytes32)) < 0 ||
+        PyModule_AddIntConstant(module, "MAX_SIBLINGS", WITNESS_MAX_SIBLINGS) < 0 ||
+        PyModule_AddIntConstant(module, "MISSING", PY_MMR_MISSING) < 0 ||
+        PyModule_AddIntConstant(module, "HASH_SHA256", MMR_HASH_SHA256) < 0 ||
+        PyModule_AddIntConstant(module, "HASH_SHA3_256", MMR_HASH_SHA3_256) < 0 ||
+        PyModule_AddIntConstant(module, "HASH_BLAKE2S_256", MMR_HASH_BLAKE2S_256) < 0 ||
+        PyModule_AddIntConstant(module, "HASH_SHA512_256", MMR_HASH_SHA512_256) < 0)
+    {
+        Py_DECREF(module);
+        return NULL;
+    }
+
+    Py_INCREF(&PyAccumulatorType);
+    if (PyModule_AddObject(module, "Accumulator", (PyObject *) &PyAccumulatorType) < 0)
+    {
+        Py_DECREF(&PyAccumulatorType);
+        Py_DECREF(module);
+        return NULL;
+    }
+
+    return module;
+}
@@ -0,0 +1,17 @@
+from setuptools import Extension, setup
+
+# Builds the bindings together with the accumulator itself: python setup.py build_ext --inplace
+setup(
+    name="mmr",
+    version="0.1.0",
+    ext_modules=[
+        Extension(
+            "mmr",
+            sources=["mmrmodule.c", "../mmr.c"],
+            include_dirs=[".."],
+            libraries=["crypto"],
+            extra_compile_args=["-std=c11", "-pthread"],
+            extra_link_args=["-pthread"],
+        )
+    ],
+)
@@ -0,0 +1,1192 @@
+/**
+ * Test driver for the threaded paths of the accumulator
+ * Build from the repository root with:
+ *   gcc -std=c11 -O2 -I. tests/mmr_test.c mmr.c -o mmr_test -lcrypto -pthread
+ * Add -fsanitize=address,undefined or -fsanitize=thread to check memory and races
+ */
+#define _GNU_SOURCE
+
+#include "mmr.h"
+
+#include <endian.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+static int failures = 0;
+
+// Unlike assert this stays on under NDEBUG and keeps going after a failure
+#define CHECK(cond)                                                                                                    \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        if (!(cond))                                                                                                   \
+        {                                                                                                              \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);                                   \
+            ++failures;                                                                                                \
+        }                                                                                                              \
+    } while (0)
+
+#define ELEMENT_BYTES 12
+
+/**
+ * Fill element i with distinct test data
+ * @param data Output buffer of ELEMENT_BYTES bytes
+ * @param i Element index
+ */
+static void element_data(uint8_t *data, uint64_t i)
+{
+    memcpy(data, "leaf", 4);
+    memcpy(data + 4, &i, sizeof(i));
+}
+
+/**
+ * Build an array of n distinct test elements
+ * @param n Number of elements
+ * @param data Output pointer to the element bytes, freed by the caller
+ * @return Elements pointing into *data, freed by the caller
+ */
+static MMRElement *make_elements(uint64_t n, uint8_t **data)
+{
+    *data = malloc(n * ELEMENT_BYTES);
+    MMRElement *elems = malloc(n * sizeof(MMRElement));
+    if (!*data || !elems) abort();
+
+    for (uint64_t i = 0; i < n; ++i)
+    {
+        element_data(*data + i * ELEMENT_BYTES, i);
+        elems[i].data = *data + i * ELEMENT_BYTES;
+        elems[i].n = ELEMENT_BYTES;
+    }
+
+    return elems;
+}
+
+/**
+ * Compare the peaks of two accumulators
+ * @param a First accumulator
+ * @param b Second accumulator
+ * @return true if both hold the same leaf count and peak hashes
+ */
+static bool same_peaks(const MMRAccumulator *a, const MMRAccumulator *b)
+{
+    MMRFrontier fa, fb;
+    if (!mmr_frontier_init(a, 0, &fa)) return false;
+    if (!mmr_frontier_init(b, 0, &fb))
+    {
+        mmr_frontier_free(&fa);
+        return false;
+    }
+
+    bool same = fa.count == fb.count && fa.leaves == fb.leaves;
+    for (size_t i = 0; same && i < fa.count; ++i)
+    {
+        same = memcmp(fa.nodes[i].hash, fb.nodes[i].hash, sizeof(bytes32)) == 0;
+    }
+
+    mmr_frontier_free(&fa);
+    mmr_frontier_free(&fb);
+
+    return same;
+}
+
+// -------------------------------- PIPELINE ------------------------------------
+
+typedef struct
+{
+    const MMRElement *elems;
+    uint64_t next;
+    bool in_order;
+} PersistCheck;
+
+static bool persist_in_order(void *ctx, const MMRElement *elems, const bytes32 *hashes, size_t count)
+{
+    PersistCheck *check = ctx;
+    (void) hashes;
+
+    for (size_t i = 0; i < count; ++i, ++check->next)
+    {
+        const MMRElement *want = &check->elems[check->next];
+        if (elems[i].n != want->n || memcmp(elems[i].data, want->data, want->n) != 0) check->in_order = false;
+    }
+
+    return true;
+}
+
+/**
+ * A pipeline fed from one producer builds exactly what sequential adds build,
+ * and persists the elements in push order
+ */
+static void test_pipeline(void)
+{
+    const uint64_t n = 100003;
+    uint8_t *data;
+    MMRElement *elems = make_elements(n, &data);
+
+    for (unsigned workers = 1; workers <= 4; workers *= 2)
+    {
+        MMRAccumulator seq, piped;
+        MMRConfig cfg = {.concurrent = true, .sparse_height = 4};
+        CHECK(mmr_init_config(&seq, &cfg));
+        CHECK(mmr_init_config(&piped, &cfg));
+
+        for (uint64_t i = 0; i < n; ++i) CHECK(mmr_add(&seq, elems[i].data, elems[i].n));
+
+        PersistCheck check = {.elems = elems, .next = 0, .in_order = true};
+        MMRPipelineConfig pcfg = {.hash_workers = workers, .slots = 256, .persist = persist_in_order,
+                                  .persist_ctx = &check};
+
+        struct MMRPipeline *p = mmr_pipeline_start(&piped, &pcfg);
+        CHECK(p != NULL);
+        if (!p) return;
+
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            CHECK(mmr_pipeline_push(p, elems[i].data, elems[i].n));
+            if (i == n / 2) CHECK(mmr_pipeline_flush(p));
+        }
+
+        CHECK(mmr_pipeline_finish(p));
+        CHECK(check.next == n && check.in_order);
+        CHECK(same_peaks(&seq, &piped));
+
+        mmr_destroy(&seq);
+        mmr_destroy(&piped);
+    }
+
+    free(elems);
+    free(data);
+}
+
+// -------------------------------- MIGRATION -----------------------------------
+
+static bool element_source(void *ctx, uint64_t position, MMRElement *element)
+{
+    *element = ((const MMRElement *) ctx)[position];
+    return true;
+}
+
+/**
+ * Migrating to another backend and back reproduces the original peaks, and the
+ * mapping pairs every leaf with its hash under both backends
+ */
+static void test_migrate(void)
+{
+    const uint64_t n = 150001;
+    uint8_t *data;
+    MMRElement *elems = make_elements(n, &data);
+
+    MMRConfig cfg = {.sparse_height = 4, .tombstones = true};
+    MMRAccumulator src, ref;
+    CHECK(mmr_init_config(&src, &cfg));
+    CHECK(mmr_init_config(&ref, &cfg));
+    CHECK(mmr_add_batch(&src, elems, n));
+
+    // A fully spent aligned block is reclaimed by compaction, leaving its leaves unknown
+    for (uint64_t i = 2048; i < 2048 + 64; ++i) CHECK(mmr_spend(&src, elems[i].data, elems[i].n));
+    CHECK(mmr_compact(&src) > 0);
+
+    MMRConfig sha3 = cfg;
+    sha3.hash_backend = MMR_HASH_SHA3_256;
+    MMRAccumulator dst, back;
+    CHECK(mmr_init_config(&dst, &sha3));
+    CHECK(mmr_init_config(&back, &cfg));
+
+    MMRLeafMapping *mapping = calloc(n, sizeof(MMRLeafMapping));
+    if (!mapping) abort();
+
+    CHECK(mmr_migrate(&src, &dst, element_source, elems, mapping, 4));
+    CHECK(mmr_leaf_count(&dst) == n);
+    CHECK(mmr_spent_count(&dst) == mmr_spent_count(&src));
+
+    uint64_t unchecked = 0;
+    for (uint64_t i = 0; i < n; ++i)
+    {
+        bytes32 old;
+        SHA256(elems[i].data, elems[i].n, old);
+        CHECK(memcmp(mapping[i].old_hash, old, sizeof(bytes32)) == 0);
+        if (!mapping[i].checked) ++unchecked;
+    }
+    CHECK(unchecked == 64);
+
+    MMRWitness w;
+    bytes32 siblings[WITNESS_MAX_SIBLINGS];
+    CHECK(mmr_witness_into(&dst, &w, siblings, elems[n - 2].data, elems[n - 2].n));
+    CHECK(mmr_verify(&dst, &w));
+    CHECK(!mmr_verify(&src, &w));
+
+    CHECK(mmr_migrate(&dst, &back, element_source, elems, NULL, 3));
+    CHECK(same_peaks(&src, &back));
+
+    // Peaks only depend on the leaves, so an uncompacted copy matches too
+    CHECK(mmr_add_batch(&ref, elems, n));
+    CHECK(same_peaks(&ref, &back));
+
+    free(mapping);
+    mmr_destroy(&src);
+    mmr_destroy(&ref);
+    mmr_destroy(&dst);
+    mmr_destroy(&back);
+    free(elems);
+    free(data);
+}
+
+// --------------------------- CONCURRENT VERIFY --------------------------------
+
+#define VERIFY_BASE_LEAVES (1u << 14)
+#define VERIFY_READERS 3
+
+typedef struct
+{
+    MMRAccumulator *acc;
+    const MMRElement *elems;
+    unsigned seed;
+    volatile bool *stop;
+    uint64_t verified;
+    uint64_t failed;
+} VerifyReader;
+
+/**
+ * Prove and verify leaves of the first mountain until told to stop
+ * That mountain holds VERIFY_BASE_LEAVES leaves and the writer adds fewer,
+ * so its peak never merges and every proof must verify throughout
+ */
+static void *verify_reader(void *arg)
+{
+    VerifyReader *r = arg;
+
+    while (!__atomic_load_n(r->stop, __ATOMIC_ACQUIRE))
+    {
+        uint64_t i = (uint64_t) rand_r(&r->seed) % VERIFY_BASE_LEAVES;
+
+        MMRWitness w;
+        bytes32 siblings[WITNESS_MAX_SIBLINGS];
+        bool ok = mmr_witness_into(r->acc, &w, siblings, r->elems[i].data, r->elems[i].n) && mmr_verify(r->acc, &w);
+
+        if (ok)
+        {
+            ++r->verified;
+        }
+        else
+        {
+            ++r->failed;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Witnesses and verifies race against batch adds and block applies on a
+ * concurrent accumulator without a single failure
+ */
+static void test_concurrent_verify(void)
+{
+    const uint64_t n = 2 * VERIFY_BASE_LEAVES - 1;
+    uint8_t *data;
+    MMRElement *elems = make_elements(n, &data);
+
+    MMRConfig cfg = {.concurrent = true, .sparse_height = 3};
+    MMRAccumulator acc, ref;
+    CHECK(mmr_init_config(&acc, &cfg));
+    CHECK(mmr_init_config(&ref, &cfg));
+    CHECK(mmr_add_batch(&acc, elems, VERIFY_BASE_LEAVES));
+
+    volatile bool stop = false;
+    VerifyReader readers[VERIFY_READERS];
+    pthread_t threads[VERIFY_READERS];
+
+    for (unsigned t = 0; t < VERIFY_READERS; ++t)
+    {
+        readers[t] = (VerifyReader) {.acc = &acc, .elems = elems, .seed = t + 1, .stop = &stop};
+        CHECK(pthread_create(&threads[t], NULL, verify_reader, &readers[t]) == 0);
+    }
+
+    // Alternate plain batches with blocks of odd sizes so the grafts land unaligned
+    uint64_t pos = VERIFY_BASE_LEAVES;
+    for (unsigned round = 0; pos < n; ++round)
+    {
+        uint64_t len = 37 + (round * 101) % 500;
+        if (len > n - pos) len = n - pos;
+
+        if (round % 2)
+        {
+            CHECK(mmr_apply_block(&acc, NULL, NULL, 0, elems + pos, len, NULL, 2));
+        }
+        else
+        {
+            CHECK(mmr_add_batch(&acc, elems + pos, len));
+        }
+
+        pos += len;
+    }
+
+    __atomic_store_n(&stop, true, __ATOMIC_RELEASE);
+
+    uint64_t verified = 0;
+    for (unsigned t = 0; t < VERIFY_READERS; ++t)
+    {
+        pthread_join(threads[t], NULL);
+        CHECK(readers[t].failed == 0);
+        verified += readers[t].verified;
+    }
+
+    CHECK(verified > 0);
+    CHECK(mmr_leaf_count(&acc) == n);
+    CHECK(mmr_add_batch(&ref, elems, n));
+    CHECK(same_peaks(&acc, &ref));
+
+    mmr_destroy(&acc);
+    mmr_destroy(&ref);
+    free(elems);
+    free(data);
+}
+
+// ------------------------------- CACHE FILES ----------------------------------
+
+/**
+ * Saved witness cache entries reload into a restored accumulator and serve
+ * hits, entries whose peak has moved on are dropped and a cut stream is refused
+ */
+static void test_cache_files(void)
+{
+    const uint64_t n = 5000;
+    uint8_t *data;
+    MMRElement *elems = make_elements(n, &data);
+
+    MMRAccumulator served, restored, moved;
+    mmr_init(&served);
+    mmr_init(&restored);
+    mmr_init(&moved);
+    CHECK(mmr_add_batch(&served, elems, n));
+    CHECK(mmr_add_batch(&restored, elems, n));
+    CHECK(mmr_add_batch(&moved, elems, n));
+
+    MMRWitness w;
+    for (uint64_t i = 0; i < n; i += 10) CHECK(mmr_witness(&served, &w, elems[i].data, elems[i].n));
+
+    char *buf = NULL;
+    size_t len = 0, saved = 0, loaded = 0;
+    FILE *out = open_memstream(&buf, &len);
+    CHECK(out && mmr_cache_save(&served, out, &saved));
+    fclose(out);
+    CHECK(saved == n / 10);
+
+    FILE *in = fmemopen(buf, len, "rb");
+    CHECK(in && mmr_cache_load(&restored, in, &loaded));
+    fclose(in);
+    CHECK(loaded == saved);
+
+    MMRStats before, after;
+    mmr_stats(&restored, &before);
+    for (uint64_t i = 0; i < n; i += 10)
+    {
+        CHECK(mmr_witness(&restored, &w, elems[i].data, elems[i].n));
+        CHECK(mmr_verify(&restored, &w));
+    }
+    mmr_stats(&restored, &after);
+    CHECK(after.witness_hits - before.witness_hits == saved);
+
+    // 128 more leaves merge every peak but the largest, so only its entries stay valid
+    for (uint64_t i = n; i < n + 128; ++i)
+    {
+        uint8_t extra[ELEMENT_BYTES];
+        element_data(extra, i);
+        CHECK(mmr_add(&moved, extra, sizeof(extra)));
+    }
+
+    in = fmemopen(buf, len, "rb");
+    CHECK(in && mmr_cache_load(&moved, in, &loaded));
+    fclose(in);
+    CHECK(loaded == 4096 / 10 + 1);
+
+    in = fmemopen(buf, len - 1, "rb");
+    CHECK(in && !mmr_cache_load(&moved, in, NULL));
+    fclose(in);
+
+    free(buf);
+    mmr_destroy(&served);
+    mmr_destroy(&restored);
+    mmr_destroy(&moved);
+    free(elems);
+    free(data);
+}
+
+// -------------------------------- COMPACTION ----------------------------------
+
+/**
+ * Compacting fully spent subtrees frees nodes without moving any peak, spent
+ * leaves get no proofs and their live neighbours keep verifying
+ */
+static void test_compaction(void)
+{
+    const uint64_t n = 10000;
+    uint8_t *data;
+    MMRElement *elems = make_elements(n, &data);
+
+    for (unsigned sparse = 0; sparse <= 4; sparse += 4)
+    {
+        MMRConfig cfg = {.concurrent = true, .tombstones = true, .sparse_height = sparse};
+        MMRAccumulator acc, ref;
+        CHECK(mmr_init_config(&acc, &cfg));
+        CHECK(mmr_init_config(&ref, &cfg));
+        CHECK(mmr_add_batch(&acc, elems, n));
+        CHECK(mmr_add_batch(&ref, elems, n));
+
+        // An aligned run of 256 is reclaimable whole, a lone leaf never is
+        for (uint64_t i = 512; i < 768; ++i) CHECK(mmr_spend(&acc, elems[i].data, elems[i].n));
+        CHECK(mmr_spend(&acc, elems[5].data, elems[5].n));
+        CHECK(!mmr_spend(&acc, elems[5].data, elems[5].n));
+
+        MMRWitness w;
+        bytes32 siblings[WITNESS_MAX_SIBLINGS];
+        CHECK(mmr_witness_into(&acc, &w, siblings, elems[3000].data, elems[3000].n));
+        CHECK(mmr_remove(&acc, &w));
+        CHECK(!mmr_remove(&acc, &w));
+        CHECK(mmr_spent_count(&acc) == 258);
+
+        CHECK(mmr_compact(&acc) > 0);
+        CHECK(mmr_compact(&acc) == 0);
+        CHECK(same_peaks(&acc, &ref));
+        CHECK(mmr_leaf_count(&acc) == n);
+
+        CHECK(!mmr_witness_into(&acc, &w, siblings, elems[600].data, elems[600].n));
+        CHECK(!mmr_witness_into(&acc, &w, siblings, elems[5].data, elems[5].n));
+
+        const uint64_t live[] = {4, 6, 511, 768, 2999, 3001, n - 1};
+        for (size_t i = 0; i < sizeof(live) / sizeof(live[0]); ++i)
+        {
+            const MMRElement *e = &elems[live[i]];
+            CHECK(mmr_witness_into(&acc, &w, siblings, e->data, e->n));
+            CHECK(mmr_verify(&acc, &w));
+        }
+
+        // The background compactor reclaims later spends while proofs are served
+        CHECK(mmr_compact_start(&acc, 1));
+        for (uint64_t i = 1024; i < 2048; ++i) CHECK(mmr_spend(&acc, elems[i].data, elems[i].n));
+        struct timespec pause = {.tv_nsec = 20 * 1000 * 1000};
+        nanosleep(&pause, NULL);
+        mmr_compact_stop(&acc);
+        mmr_compact(&acc);
+        CHECK(mmr_compact(&acc) == 0);
+        CHECK(same_peaks(&acc, &ref));
+        CHECK(mmr_witness_into(&acc, &w, siblings, elems[2048].data, elems[2048].n));
+        CHECK(mmr_verify(&acc, &w));
+
+        mmr_destroy(&acc);
+        mmr_destroy(&ref);
+    }
+
+    free(elems);
+    free(data);
+}
+
+// ------------------------------- ARROW EXPORT ---------------------------------
+
+#define EXPORT_LEAVES 3000
+#define EXPORT_BATCH_ROWS 64
+
+typedef struct
+{
+    MMRAccumulator *acc;
+    const MMRElement *elems;
+    uint64_t count;
+    bool ok;
+} ExportWriter;
+
+/**
+ * Add the writer's elements one at a time, racing an export
+ */
+static void *export_writer(void *arg)
+{
+    ExportWriter *w = arg;
+    w->ok = true;
+
+    for (uint64_t i = 0; i < w->count; ++i)
+    {
+        if (!mmr_add(w->acc, w->elems[i].data, w->elems[i].n)) w->ok = false;
+    }
+
+    return NULL;
+}
+
+/**
+ * Export a stream to memory
+ * @param acc Accumulator to export
+ * @param cfg Export configuration, or NULL
+ * @param rows Output for the number of rows written
+ * @param len Output for the stream length
+ * @return Stream bytes, freed by the caller, or NULL if the export failed
+ */
+static char *export_to_memory(const MMRAccumulator *acc, const MMRExportConfig *cfg, size_t *rows, size_t *len)
+{
+    char *mem = NULL;
+    FILE *out = open_memstream(&mem, len);
+    if (!out) return NULL;
+
+    bool ok = mmr_export_arrow(acc, out, cfg, rows);
+    fclose(out);
+    if (ok) return mem;
+
+    free(mem);
+    return NULL;
+}
+
+/**
+ * Every record batch of a leaves-only export carries its digests contiguously,
+ * so each run of batch_rows leaves must turn up in the stream in order
+ * @param mem Stream bytes
+ * @param len Stream length
+ * @param digests Leaf digests in position order
+ * @param count Number of leaves expected
+ * @param batch_rows Rows per record batch
+ * @return true if every run was found
+ */
+static bool export_has_leaves(const char *mem, size_t len, const bytes32 *digests, size_t count, size_t batch_rows)
+{
+    const char *from = mem;
+    for (size_t i = 0; i < count; i += batch_rows)
+    {
+        size_t run = count - i < batch_rows ? count - i : batch_rows;
+        const char *at = memmem(from, len - (size_t) (from - mem), digests[i], run * sizeof(bytes32));
+        if (!at) return false;
+        from = at + run * sizeof(bytes32);
+    }
+
+    return true;
+}
+
+/**
+ * Exports hold one row per leaf, or per aligned subtree with nodes, whatever
+ * the batch size; an overflowing batch size is refused and leaves added while
+ * an export runs between batches are left out of it
+ */
+static void test_arrow_export(void)
+{
+    const uint64_t n = EXPORT_LEAVES;
+    uint8_t *data;
+    MMRElement *elems = make_elements(2 * n, &data);
+
+    MMRConfig cfg = {.concurrent = true};
+    MMRAccumulator acc;
+    CHECK(mmr_init_config(&acc, &cfg));
+    CHECK(mmr_add_batch(&acc, elems, n));
+
+    bytes32 *digests = malloc(n * sizeof(bytes32));
+    if (!digests) abort();
+
+    struct MMRIter *it = mmr_iter_start(&acc, 0, UINT64_MAX);
+    CHECK(it);
+    CHECK(it && mmr_iter_next(it, NULL, digests, n) == n);
+    mmr_iter_free(it);
+
+    size_t rows, len;
+    char *mem = export_to_memory(&acc, NULL, &rows, &len);
+    CHECK(mem && rows == n);
+    CHECK(mem && export_has_leaves(mem, len, digests, n, n));
+    free(mem);
+
+    // Every aligned run of 2^level leaves below the leaf count is one row
+    size_t subtrees = 0;
+    for (uint64_t size = 1; size <= n; size <<= 1) subtrees += n / size;
+
+    MMRExportConfig ec = {.nodes = true, .batch_rows = EXPORT_BATCH_ROWS};
+    mem = export_to_memory(&acc, &ec, &rows, &len);
+    CHECK(mem && rows == subtrees);
+    free(mem);
+
+    ec = (MMRExportConfig) {.batch_rows = SIZE_MAX / sizeof(bytes32) + 1};
+    mem = export_to_memory(&acc, &ec, &rows, &len);
+    CHECK(!mem && rows == 0);
+
+    ExportWriter writer = {.acc = &acc, .elems = elems + n, .count = n};
+    pthread_t thread;
+    CHECK(pthread_create(&thread, NULL, export_writer, &writer) == 0);
+
+    ec = (MMRExportConfig) {.batch_rows = EXPORT_BATCH_ROWS};
+    mem = export_to_memory(&acc, &ec, &rows, &len);
+    pthread_join(thread, NULL);
+
+    CHECK(writer.ok);
+    CHECK(mem && rows >= n && rows <= 2 * n);
+    CHECK(mem && export_has_leaves(mem, len, digests, n, EXPORT_BATCH_ROWS));
+    CHECK(mmr_leaf_count(&acc) == 2 * n);
+    free(mem);
+
+    mmr_destroy(&acc);
+    free(digests);
+    free(elems);
+    free(data);
+}
+
+// --------------------------------- FRONTIER -----------------------------------
+
+/**
+ * Trimmed proofs lose depth siblings and still verify against a frontier,
+ * a tampered sibling does not, and once mountains merge a stale frontier
+ * still serves the nodes it holds but refuses trimmed proofs of new leaves
+ */
+static void test_frontier(void)
+{
+    const uint64_t n = 5000;
+    const uint64_t added = 128;
+    uint8_t *data;
+    MMRElement *elems = make_elements(n + added, &data);
+
+    for (unsigned sparse = 0; sparse <= 4; sparse += 4)
+    {
+        MMRConfig cfg = {.sparse_height = sparse};
+        MMRAccumulator acc;
+        CHECK(mmr_init_config(&acc, &cfg));
+        CHECK(mmr_add_batch(&acc, elems, n));
+
+        for (unsigned depth = 0; depth <= 12; depth += 4)
+        {
+            MMRFrontier f;
+            CHECK(mmr_frontier_init(&acc, depth, &f));
+
+            for (uint64_t i = 0; i < n; i += 7)
+            {
+                MMRWitness w;
+                bytes32 siblings[WITNESS_MAX_SIBLINGS];
+                CHECK(mmr_witness_into(&acc, &w, siblings, elems[i].data, elems[i].n));
+                CHECK(mmr_frontier_verify(&f, &w));
+
+                unsigned height = w.n_siblings;
+                CHECK(mmr_witness_trim(&w, depth));
+                CHECK(w.n_siblings == (height > depth ? height - depth : 0));
+                CHECK(mmr_frontier_verify(&f, &w));
+
+                if (w.n_siblings == 0) continue;
+                w.siblings[0][0] ^= 1;
+                CHECK(!mmr_frontier_verify(&f, &w));
+            }
+
+            mmr_frontier_free(&f);
+        }
+
+        // 5000 leaves are 4096 + 512 + 256 + 128 + 8; adding 128 merges all but the first mountain
+        const unsigned depth = 4;
+        MMRFrontier stale, fresh;
+        CHECK(mmr_frontier_init(&acc, depth, &stale));
+        CHECK(mmr_add_batch(&acc, elems + n, added));
+        CHECK(mmr_frontier_init(&acc, depth, &fresh));
+
+        const uint64_t kept = 100, merged = 4500, fresh_leaf = n + 5;
+        MMRWitness w;
+        bytes32 siblings[WITNESS_MAX_SIBLINGS];
+
+        CHECK(mmr_witness_into(&acc, &w, siblings, elems[kept].data, elems[kept].n));
+        CHECK(mmr_witness_trim(&w, depth));
+        CHECK(mmr_frontier_verify(&stale, &w));
+
+        CHECK(mmr_witness_into(&acc, &w, siblings, elems[merged].data, elems[merged].n));
+        CHECK(mmr_witness_trim(&w, depth));
+        CHECK(mmr_frontier_verify(&stale, &w));
+        CHECK(mmr_frontier_verify(&fresh, &w));
+
+        CHECK(mmr_witness_into(&acc, &w, siblings, elems[fresh_leaf].data, elems[fresh_leaf].n));
+        CHECK(mmr_witness_trim(&w, depth));
+        CHECK(!mmr_frontier_verify(&stale, &w));
+        CHECK(mmr_frontier_verify(&fresh, &w));
+
+        mmr_frontier_free(&stale);
+        mmr_frontier_free(&fresh);
+        mmr_destroy(&acc);
+    }
+
+    free(elems);
+    free(data);
+}
+
+// --------------------------------- ITERATOR -----------------------------------
+
+/**
+ * Drain a scan in batches of cap
+ * @param it Iterator, freed here
+ * @param cap Batch size
+ * @param positions Output array, large enough for the whole scan
+ * @param digests Output array, large enough for the whole scan
+ * @return Number of leaves yielded
+ */
+static size_t drain_scan(struct MMRIter *it, size_t cap, uint64_t *positions, bytes32 *digests)
+{
+    size_t total = 0, got;
+    while ((got = mmr_iter_next(it, positions + total, digests + total, cap)) > 0)
+    {
+        if (got > cap) abort();
+        total += got;
+    }
+
+    mmr_iter_free(it);
+    return total;
+}
+
+/**
+ * Scans yield positions in order with the digests witnesses carry, skip the
+ * leaves compaction reclaimed, clamp their range and leave out later adds
+ */
+static void test_iterator(void)
+{
+    const uint64_t n = 5000;
+    const uint64_t added = 128;
+    uint8_t *data;
+    MMRElement *elems = make_elements(n + added, &data);
+
+    uint64_t *positions = malloc(n * sizeof(uint64_t));
+    bytes32 *digests = malloc(n * sizeof(bytes32));
+    if (!positions || !digests) abort();
+
+    for (unsigned sparse = 0; sparse <= 4; sparse += 4)
+    {
+        MMRConfig cfg = {.concurrent = true, .tombstones = true, .sparse_height = sparse};
+        MMRAccumulator acc;
+        CHECK(mmr_init_config(&acc, &cfg));
+        CHECK(mmr_add_batch(&acc, elems, n));
+
+        // Reclaim the aligned run 512..767
+        for (uint64_t i = 512; i < 768; ++i) CHECK(mmr_spend(&acc, elems[i].data, elems[i].n));
+        CHECK(mmr_compact(&acc) > 0);
+
+        // Started before the adds, so it must stop at n
+        struct MMRIter *it = mmr_iter_start(&acc, 0, UINT64_MAX);
+        CHECK(it);
+        CHECK(mmr_add_batch(&acc, elems + n, added));
+
+        size_t got = drain_scan(it, 100, positions, digests);
+        CHECK(got == n - 256);
+
+        uint64_t want = 0;
+        for (size_t i = 0; i < got; ++i, ++want)
+        {
+            if (want == 512) want = 768;
+            CHECK(positions[i] == want);
+
+            MMRWitness w;
+            bytes32 siblings[WITNESS_MAX_SIBLINGS];
+            CHECK(mmr_witness_into(&acc, &w, siblings, elems[want].data, elems[want].n));
+            CHECK(memcmp(w.hash, digests[i], sizeof(bytes32)) == 0);
+        }
+
+        // A range running past the end is cut at the leaf count
+        got = drain_scan(mmr_iter_start(&acc, n + added - 10, 100), 3, positions, digests);
+        CHECK(got == 10 && positions[0] == n + added - 10 && positions[9] == n + added - 1);
+
+        // A range inside the reclaimed run yields nothing, one across it only the live leaves
+        CHECK(drain_scan(mmr_iter_start(&acc, 600, 100), 16, positions, digests) == 0);
+        got = drain_scan(mmr_iter_start(&acc, 500, 300), 7, positions, digests);
+        CHECK(got == 12 + 32 && positions[11] == 511 && positions[12] == 768);
+
+        CHECK(drain_scan(mmr_iter_start(&acc, n + added, 10), 4, positions, digests) == 0);
+
+        mmr_destroy(&acc);
+    }
+
+    free(positions);
+    free(digests);
+    free(elems);
+    free(data);
+}
+
+// -------------------------------- TIME INDEX ----------------------------------
+
+#define TIME_BLOCKS 20
+
+/**
+ * Key ranges map to exactly the leaves added under them, scans over them yield
+ * digests that prove, and decreasing keys or a missing index are refused
+ */
+static void test_time_index(void)
+{
+    uint64_t sizes[TIME_BLOCKS], starts[TIME_BLOCKS], n = 0;
+    for (unsigned b = 0; b < TIME_BLOCKS; ++b)
+    {
+        // Block 7 is empty, to check a mark with no leaves behind it
+        sizes[b] = b == 7 ? 0 : 37 + b * 13;
+        starts[b] = n;
+        n += sizes[b];
+    }
+
+    uint8_t *data;
+    MMRElement *elems = make_elements(n, &data);
+
+    MMRConfig cfg = {.concurrent = true, .time_index = true};
+    MMRAccumulator acc;
+    CHECK(mmr_init_config(&acc, &cfg));
+
+    // Block b is keyed 10 * (b + 1), with the last two blocks sharing a key
+    for (unsigned b = 0; b < TIME_BLOCKS; ++b)
+    {
+        uint64_t key = 10 * (b + 1 < TIME_BLOCKS ? b + 1 : b);
+        CHECK(mmr_time_mark(&acc, key));
+        CHECK(mmr_add_batch(&acc, elems + starts[b], sizes[b]));
+    }
+
+    CHECK(!mmr_time_mark(&acc, 10 * (TIME_BLOCKS - 1) - 1));
+
+    MMRLeafRange range;
+    for (unsigned b = 0; b + 2 < TIME_BLOCKS; ++b)
+    {
+        CHECK(mmr_time_range(&acc, 10 * (b + 1), 10 * (b + 1), &range));
+        CHECK(range.count == sizes[b]);
+        CHECK(sizes[b] == 0 || range.start == starts[b]);
+    }
+
+    CHECK(mmr_time_range(&acc, 10 * (TIME_BLOCKS - 1), UINT64_MAX, &range));
+    CHECK(range.start == starts[TIME_BLOCKS - 2] && range.start + range.count == n);
+
+    // Bounds between keys round inwards
+    CHECK(mmr_time_range(&acc, 25, 45, &range));
+    CHECK(range.start == starts[2] && range.count == sizes[2] + sizes[3]);
+
+    CHECK(mmr_time_range(&acc, 0, UINT64_MAX, &range));
+    CHECK(range.start == 0 && range.count == n);
+
+    CHECK(mmr_time_range(&acc, 11, 19, &range) && range.count == 0);
+    CHECK(mmr_time_range(&acc, 50, 40, &range) && range.count == 0);
+    CHECK(mmr_time_range(&acc, 10 * TIME_BLOCKS + 1, UINT64_MAX, &range) && range.count == 0);
+
+    // A scan over blocks 4 to 6 yields their leaves, each of which proves by digest
+    uint64_t positions[64];
+    bytes32 digests[64];
+    uint64_t want = starts[4];
+    size_t got;
+
+    struct MMRIter *it = mmr_iter_time(&acc, 50, 70);
+    CHECK(it);
+    while ((got = mmr_iter_next(it, positions, digests, 64)) > 0)
+    {
+        for (size_t i = 0; i < got; ++i, ++want)
+        {
+            CHECK(positions[i] == want);
+
+            MMRWitness w;
+            bytes32 siblings[WITNESS_MAX_SIBLINGS];
+            CHECK(mmr_witness_leaf_into(&acc, &w, siblings, &digests[i]));
+            CHECK(mmr_verify(&acc, &w));
+        }
+    }
+    mmr_iter_free(it);
+    CHECK(want == starts[7]);
+
+    mmr_destroy(&acc);
+
+    // Without an index every call is refused
+    MMRAccumulator plain;
+    mmr_init(&plain);
+    CHECK(!mmr_time_mark(&plain, 1));
+    CHECK(!mmr_time_range(&plain, 0, UINT64_MAX, &range));
+    CHECK(!mmr_iter_time(&plain, 0, UINT64_MAX));
+    mmr_destroy(&plain);
+
+    free(elems);
+    free(data);
+}
+
+// -------------------------------- RECONCILE -----------------------------------
+
+#define RECONCILE_BUFFER 4096
+
+// Wire format: a request is a kind byte and a query count, then a start and a
+// height per query; a response is a kind byte, the leaf count and the answer
+// count, then a flag and, if the subtree is known, its hash per answer
+#define REQUEST_HEADER 5
+#define QUERY_BYTES 9
+#define RESPONSE_HEADER 13
+#define ANSWER_BYTES 33
+#define COUNT_OFFSET 9
+
+// Room for four queries per request, so reconciling takes several rounds
+#define RECONCILE_SMALL_REQUEST (REQUEST_HEADER + 4 * QUERY_BYTES)
+
+/**
+ * Reconcile local against remote over an in-memory transport
+ * With corrupt set, the first response carrying answers is first fed cut
+ * short, with a byte too many and with the wrong count, each of which must
+ * be refused and leave the state ready for the intact response
+ * @param local Initiator's accumulator
+ * @param remote Replica answering the requests
+ * @param corrupt Whether to feed damaged copies of one response first
+ * @param ranges Output array for the differing ranges
+ * @param cap Capacity of the output array
+ * @return Number of differing ranges, or SIZE_MAX if reconciling failed
+ */
+static size_t reconcile_with(const MMRAccumulator *local, const MMRAccumulator *remote, bool corrupt,
+                             MMRLeafRange *ranges, size_t cap)
+{
+    struct MMRReconcile *r = mmr_reconcile_start(local);
+    if (!r) return SIZE_MAX;
+
+    uint8_t req[RECONCILE_SMALL_REQUEST];
+    uint8_t resp[RECONCILE_BUFFER + 1];
+    size_t req_len, resp_len;
+    bool ok = true;
+
+    while (ok && mmr_reconcile_next(r, req, sizeof(req), &req_len))
+    {
+        ok = mmr_reconcile_respond(remote, req, req_len, resp, RECONCILE_BUFFER, &resp_len);
+        if (!ok) break;
+
+        if (corrupt && resp_len > RESPONSE_HEADER)
+        {
+            corrupt = false;
+
+            CHECK(!mmr_reconcile_receive(r, resp, resp_len - 1));
+
+            resp[resp_len] = 0;
+            CHECK(!mmr_reconcile_receive(r, resp, resp_len + 1));
+
+            ++resp[COUNT_OFFSET];
+            CHECK(!mmr_reconcile_receive(r, resp, resp_len));
+            --resp[COUNT_OFFSET];
+
+            // The request stays in flight until its response is taken
+            CHECK(!mmr_reconcile_next(r, req, sizeof(req), &req_len));
+        }
+
+        ok = mmr_reconcile_receive(r, resp, resp_len);
+    }
+
+    const MMRLeafRange *found;
+    size_t n = mmr_reconcile_result(r, &found, NULL);
+    if (n > cap) ok = false;
+    if (ok && n > 0) memcpy(ranges, found, n * sizeof(MMRLeafRange));
+
+    mmr_reconcile_free(r);
+
+    return ok ? n : SIZE_MAX;
+}
+
+/**
+ * Replicas differing in two leaves and in length reconcile to exactly those
+ * ranges from either side, despite damaged responses along the way; requests
+ * the responder cannot answer are marked unknown or refused when malformed
+ */
+static void test_reconcile(void)
+{
+    const uint64_t n = 1000;
+    const uint64_t extra = 30;
+    uint8_t *data;
+    MMRElement *elems = make_elements(n + extra + 2, &data);
+
+    // The remote holds two different leaves and extra leaves more
+    MMRElement *changed = malloc((n + extra) * sizeof(MMRElement));
+    if (!changed) abort();
+    memcpy(changed, elems, (n + extra) * sizeof(MMRElement));
+    changed[100] = elems[n + extra];
+    changed[517] = elems[n + extra + 1];
+
+    MMRAccumulator local, remote;
+    mmr_init(&local);
+    mmr_init(&remote);
+    CHECK(mmr_add_batch(&local, elems, n));
+    CHECK(mmr_add_batch(&remote, changed, n + extra));
+
+    const MMRLeafRange want[] = {{100, 1}, {517, 1}, {n, extra}};
+    const size_t n_want = sizeof(want) / sizeof(want[0]);
+    MMRLeafRange got[8];
+
+    for (int corrupt = 0; corrupt <= 1; ++corrupt)
+    {
+        CHECK(reconcile_with(&local, &remote, corrupt, got, 8) == n_want);
+        CHECK(memcmp(got, want, sizeof(want)) == 0);
+
+        CHECK(reconcile_with(&remote, &local, corrupt, got, 8) == n_want);
+        CHECK(memcmp(got, want, sizeof(want)) == 0);
+    }
+
+    CHECK(reconcile_with(&local, &local, false, got, 8) == 0);
+
+    // Hand-built request: leaves 0..7, a height past the tallest possible and a start past the end
+    const struct
+    {
+        uint64_t start;
+        uint8_t height;
+    } queries[] = {{0, 3}, {0, 64}, {n, 0}};
+    const uint32_t n_queries = sizeof(queries) / sizeof(queries[0]);
+
+    uint8_t req[REQUEST_HEADER + 3 * QUERY_BYTES];
+    req[0] = 1;
+    uint32_t count = htole32(n_queries);
+    memcpy(req + 1, &count, sizeof(count));
+    for (uint32_t i = 0; i < n_queries; ++i)
+    {
+        uint64_t start = htole64(queries[i].start);
+        memcpy(req + REQUEST_HEADER + i * QUERY_BYTES, &start, sizeof(start));
+        req[REQUEST_HEADER + i * QUERY_BYTES + 8] = queries[i].height;
+    }
+
+    uint8_t resp[RECONCILE_BUFFER];
+    size_t len;
+    CHECK(mmr_reconcile_respond(&local, req, sizeof(req), resp, sizeof(resp), &len));
+    CHECK(len == RESPONSE_HEADER + ANSWER_BYTES + 1 + 1);
+    CHECK(resp[0] == 2 && resp[RESPONSE_HEADER] == 1 && resp[RESPONSE_HEADER + ANSWER_BYTES] == 0 &&
+          resp[RESPONSE_HEADER + ANSWER_BYTES + 1] == 0);
+
+    uint64_t leaves;
+    memcpy(&leaves, resp + 1, sizeof(leaves));
+    CHECK(le64toh(leaves) == n);
+
+    // Too small a buffer reports the worst case size
+    CHECK(!mmr_reconcile_respond(&local, req, sizeof(req), resp, RESPONSE_HEADER, &len));
+    CHECK(len == RESPONSE_HEADER + 3 * ANSWER_BYTES);
+
+    // A cut request, and one claiming more queries than it carries
+    CHECK(!mmr_reconcile_respond(&local, req, sizeof(req) - 1, resp, sizeof(resp), &len));
+    count = htole32(n_queries + 1);
+    memcpy(req + 1, &count, sizeof(count));
+    CHECK(!mmr_reconcile_respond(&local, req, sizeof(req), resp, sizeof(resp), &len));
+
+    mmr_destroy(&local);
+    mmr_destroy(&remote);
+    free(changed);
+    free(elems);
+    free(data);
+}
+
+// ------------------------------ PERF COUNTERS ---------------------------------
+
+#define PERF_ADDS 1000
+#define PERF_PROOFS 100
+
+typedef struct
+{
+    MMRAccumulator *acc;
+    const MMRElement *elems;
+    bool ok;
+} PerfWorker;
+
+/**
+ * Add the elements and prove some of them, on a thread with no counters open yet
+ */
+static void *perf_worker(void *arg)
+{
+    PerfWorker *pw = arg;
+    pw->ok = mmr_add_batch(pw->acc, pw->elems, PERF_ADDS);
+
+    for (uint64_t i = 0; pw->ok && i < PERF_PROOFS; ++i)
+    {
+        MMRWitness w;
+        bytes32 siblings[WITNESS_MAX_SIBLINGS];
+        const MMRElement *e = &pw->elems[i * 7];
+        pw->ok = mmr_witness_into(pw->acc, &w, siblings, e->data, e->n) && mmr_verify(pw->acc, &w);
+    }
+
+    return NULL;
+}
+
+/**
+ * Count the columns mmr_stats_print() left blank for unavailable events
+ * @param report Printed report
+ * @return Number of blank columns
+ */
+static size_t blank_columns(const char *report)
+{
+    // Blank columns are a lone "-" right-aligned in ten characters
+    static const char blank[] = "          -";
+
+    size_t count = 0;
+    for (const char *at = strstr(report, blank); at; at = strstr(at + 1, blank)) ++count;
+
+    return count;
+}
+
+/**
+ * With no hardware event available, the per-operation counts and latencies
+ * are still collected, every event stays 0 and the report blanks them out
+ * Counters are opened per thread on first use, so a thread started while no
+ * file descriptor can be opened gets none
+ */
+static void test_perf_fallback(void)
+{
+    uint8_t *data;
+    MMRElement *elems = make_elements(PERF_ADDS, &data);
+
+    MMRConfig cfg = {.perf_counters = true};
+    MMRAccumulator acc;
+    CHECK(mmr_init_config(&acc, &cfg));
+
+    struct rlimit saved;
+    CHECK(getrlimit(RLIMIT_NOFILE, &saved) == 0);
+
+    struct rlimit none = {.rlim_cur = 0, .rlim_max = saved.rlim_max};
+    CHECK(setrlimit(RLIMIT_NOFILE, &none) == 0);
+
+    PerfWorker pw = {.acc = &acc, .elems = elems};
+    pthread_t thread;
+    CHECK(pthread_create(&thread, NULL, perf_worker, &pw) == 0);
+    pthread_join(thread, NULL);
+
+    CHECK(setrlimit(RLIMIT_NOFILE, &saved) == 0);
+    CHECK(pw.ok);
+
+    MMRStats stats;
+    mmr_stats(&acc, &stats);
+
+    CHECK(stats.perf_events == 0);
+    CHECK(stats.perf[MMR_OP_ADD].ops == PERF_ADDS);
+    CHECK(stats.perf[MMR_OP_WITNESS].ops == PERF_PROOFS);
+    CHECK(stats.perf[MMR_OP_VERIFY].ops == PERF_PROOFS);
+
+    size_t rows = 0;
+    for (int op = 0; op < MMR_OPS; ++op)
+    {
+        if (stats.perf[op].ops == 0) continue;
+
+        ++rows;
+        CHECK(stats.perf[op].ns > 0);
+        for (int e = 0; e < MMR_PERF_EVENTS; ++e) CHECK(stats.perf[op].events[e] == 0);
+    }
+
+    char *report = NULL;
+    size_t len = 0;
+    FILE *out = open_memstream(&report, &len);
+    CHECK(out);
+    if (out)
+    {
+        mmr_stats_print(&stats, out);
+        fclose(out);
+
+        CHECK(strstr(report, "\nadd ") && strstr(report, "\nwitness ") && strstr(report, "\nverify "));
+        CHECK(blank_columns(report) == rows * MMR_PERF_EVENTS);
+        free(report);
+    }
+
+    // Without the option nothing is sampled at all
+    MMRAccumulator plain;
+    mmr_init(&plain);
+    CHECK(mmr_add_batch(&plain, elems, PERF_ADDS));
+    mmr_stats(&plain, &stats);
+    CHECK(stats.perf[MMR_OP_ADD].ops == 0 && stats.perf[MMR_OP_ADD].ns == 0);
+    mmr_destroy(&plain);
+
+    mmr_destroy(&acc);
+    free(elems);
+    free(data);
+}
+
+int main(void)
+{
+    test_pipeline();
+    test_migrate();
+    test_concurrent_verify();
+    test_cache_files();
+    test_compaction();
+    test_arrow_export();
+    test_frontier();
+    test_iterator();
+    test_time_index();
+    test_reconcile();
+    test_perf_fallback();
+
+    if (failures > 0)
+    {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+
+    puts("all tests passed");
+    return 0;
+}